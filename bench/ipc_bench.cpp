@@ -0,0 +1,123 @@
+/*
+ * Compares comms::Pipe against comms::ShmPipe for passing packets between a
+ * parent and child process. Measures raw throughput (packets/s) and wake up
+ * latency of a blocked reader (half of a ping-pong round trip).
+ *
+ * Runs on any Linux machine: make ipc_bench && ./bin/ipc_bench
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/wait.h>
+#include <time.h>
+
+#include <vector>
+#include <algorithm>
+
+#include "comms/pipes.h"
+#include "comms/shm_pipe.h"
+#include "comms/packet.h"
+
+static uint64_t now_ns() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// Blocking waits for each channel type
+static void wait_read(comms::Pipe &pipe) {
+	struct pollfd fds[1];
+	fds[0].fd = pipe.getReadfd();
+	fds[0].events = POLLIN;
+	poll(fds, 1, -1);
+}
+
+static void wait_read(comms::ShmPipe &pipe) {
+	pipe.waitRead(-1);
+}
+
+template<class Channel>
+double throughput(int total, int batch) {
+	Channel pipe;
+	if (pipe.Fork() == 0) {
+		comms::Packet buf[64];
+		int received = 0;
+		while (received < total) {
+			int n = pipe.binread(buf, sizeof (buf));
+			if (n > 0)
+				received += n / sizeof (comms::Packet);
+			else if (n == 0)
+				wait_read(pipe);
+			else
+				break;
+		}
+		// Report completion
+		pipe.binwrite(buf, sizeof (comms::Packet));
+		_exit(0);
+	}
+	std::vector<comms::Packet> packets(batch);
+	for (int i = 0; i < batch; i++)
+		packets[i].index = i;
+	uint64_t start = now_ns();
+	int sent = 0;
+	while (sent < total) {
+		int n = pipe.binwriteBatch(packets.data(), std::min(batch, total - sent));
+		if (n > 0)
+			sent += n;
+		else
+			sched_yield();
+	}
+	comms::Packet done;
+	while (pipe.binread(&done, sizeof (done)) <= 0)
+		wait_read(pipe);
+	double secs = (now_ns() - start) / 1e9;
+	wait(NULL);
+	return total / secs;
+}
+
+template<class Channel>
+std::vector<double> latency(int rounds) {
+	Channel pipe;
+	comms::Packet p;
+	if (pipe.Fork() == 0) {
+		for (int i = 0; i < rounds; i++) {
+			while (pipe.binread(&p, sizeof (p)) <= 0)
+				wait_read(pipe);
+			pipe.binwrite(&p, sizeof (p));
+		}
+		_exit(0);
+	}
+	std::vector<double> results;
+	for (int i = 0; i < rounds; i++) {
+		uint64_t start = now_ns();
+		pipe.binwrite(&p, sizeof (p));
+		while (pipe.binread(&p, sizeof (p)) <= 0)
+			wait_read(pipe);
+		results.push_back((now_ns() - start) / 2000.0);
+	}
+	wait(NULL);
+	std::sort(results.begin(), results.end());
+	return results;
+}
+
+template<class Channel>
+void run(const char *name) {
+	const int total = 1000000;
+	const int rounds = 10000;
+	double single = throughput<Channel>(total, 1);
+	double batched = throughput<Channel>(total, 32);
+	std::vector<double> lat = latency<Channel>(rounds);
+	printf("%-8s %14.0f %14.0f %10.1f %10.1f %10.1f\n", name, single, batched,
+			lat[lat.size() / 2], lat[lat.size() * 99 / 100], lat.back());
+}
+
+int main() {
+	printf("%-8s %14s %14s %10s %10s %10s\n", "channel", "packets/s", "batch32/s",
+			"wake p50", "wake p99", "wake max");
+	printf("%-8s %14s %14s %10s %10s %10s\n", "", "", "", "(us)", "(us)", "(us)");
+	run<comms::Pipe>("Pipe");
+	run<comms::ShmPipe>("ShmPipe");
+	return 0;
+}
@@ -0,0 +1,134 @@
+/*
+ * Compares the TCP and UDP multicast modes of the Ethernet link for how long
+ * packets take from Pi 1's main process to Pi 2's main process. Both ends
+ * (Raspi1 and Raspi2, each with their child process) run on this machine
+ * over loopback. Packets carry the time they were sent and are sent at a
+ * steady rate like IMU data.
+ *
+ * Runs on any Linux machine: make link_bench && ./bin/link_bench
+ * Arguments (all optional): seconds per mode, packets per second, label for
+ * the results (e.g. the loss applied). bench/netem_loss.sh runs it with
+ * different amounts of packet loss on loopback.
+ *
+ * Packets still missing 2s after the last one was sent count as lost.
+ * Logs go to /Docs/Logs as usual.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <time.h>
+
+#include <vector>
+#include <string>
+#include <algorithm>
+
+#include "Ethernet/Ethernet.h"
+#include "comms/protocol.h"
+#include "comms/packet.h"
+
+static uint64_t now_ns() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static double percentile(const std::vector<double> &sorted, double p) {
+	if (sorted.empty())
+		return 0;
+	return sorted[std::min(sorted.size() - 1, (size_t) (sorted.size() * p))];
+}
+
+/**
+ * Send packets from Pi 1 to Pi 2 and print the latency percentiles
+ */
+static void run(const char *mode, bool multicast, int port, double seconds, int rate,
+		const char *label) {
+	Raspi2 pi2(port);
+	Raspi1 pi1(port, "127.0.0.1");
+	if (multicast) {
+		pi2.use_multicast("239.255.31.41", "127.0.0.1");
+		pi1.use_multicast("239.255.31.41", "127.0.0.1");
+	}
+	pi2.run("/tmp/link_bench_pi2");
+	pi1.run("/tmp/link_bench_pi1");
+	// Give the TCP connection time to come up
+	usleep(500000);
+
+	int total = seconds * rate;
+	std::vector<double> latency;
+	latency.reserve(total);
+	uint64_t period = 1000000000ull / rate;
+	uint64_t start = now_ns();
+	int sent = 0;
+	auto collect = [&]() {
+		comms::Packet p;
+		while (pi2.recvPacket(p) > 0) {
+			uint64_t stamp;
+			comms::byte1_t id;
+			comms::byte2_t index;
+			comms::byte1_t data[16];
+			if (comms::Protocol::unpack(p, id, index, data) || id != ID_DATA1)
+				continue;
+			memcpy(&stamp, data, sizeof (stamp));
+			latency.push_back((now_ns() - stamp) / 1e6);
+		}
+	};
+	while (sent < total) {
+		// Check for arrivals often so their time is measured to ~0.1ms
+		while (now_ns() < start + sent * period) {
+			collect();
+			usleep(50);
+		}
+		comms::Packet p;
+		comms::byte1_t data[16] = {0};
+		uint64_t stamp = now_ns();
+		memcpy(data, &stamp, sizeof (stamp));
+		comms::Protocol::pack(p, ID_DATA1, sent, data);
+		if (pi1.sendPacket(p) > 0)
+			sent++;
+		collect();
+	}
+	uint64_t end = now_ns() + 2000000000ull;
+	while ((int) latency.size() < total && now_ns() < end) {
+		usleep(50);
+		collect();
+	}
+	pi1.end();
+	pi2.end();
+	std::sort(latency.begin(), latency.end());
+	int lost = total - latency.size();
+	printf("%-10s %-8s %8d %8d %8.2f %8.2f %8.2f %8.2f %8.2f %8.2f\n", label, mode, total, lost,
+			100.0 * lost / total, percentile(latency, 0.5), percentile(latency, 0.9),
+			percentile(latency, 0.99), percentile(latency, 0.999),
+			latency.empty() ? 0 : latency.back());
+	fflush(stdout);
+}
+
+int main(int argc, char *argv[]) {
+	double seconds = argc > 1 ? atof(argv[1]) : 10;
+	int rate = argc > 2 ? atoi(argv[2]) : 500;
+	const char *label = argc > 3 ? argv[3] : "-";
+	if (argc < 5 || strcmp(argv[4], "--no-header") != 0) {
+		printf("%-10s %-8s %8s %8s %8s %8s %8s %8s %8s %8s\n", "label", "mode", "sent", "lost",
+				"lost %", "p50", "p90", "p99", "p99.9", "max");
+		printf("%-10s %-8s %8s %8s %8s %8s %8s %8s %8s %8s\n", "", "", "", "", "",
+				"(ms)", "(ms)", "(ms)", "(ms)", "(ms)");
+	}
+	fflush(stdout); // Before forking
+	// Each mode in its own process so nothing is left over from the last
+	int port = 40000 + getpid() % 10000;
+	if (fork() == 0) {
+		run("tcp", false, port, seconds, rate, label);
+		exit(0);
+	}
+	wait(NULL);
+	if (fork() == 0) {
+		run("udp-mc", true, port + 2, seconds, rate, label);
+		exit(0);
+	}
+	wait(NULL);
+	return 0;
+}
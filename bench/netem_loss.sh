@@ -0,0 +1,21 @@
+#!/bin/sh
+# Runs link_bench with different amounts of packet loss (and a little delay)
+# added to loopback by netem, to compare the TCP and UDP multicast modes of
+# the Ethernet link. Needs root for tc: sudo ./bench/netem_loss.sh
+#
+# Optional arguments: seconds per run, packets per second
+
+SECONDS_PER_RUN=${1:-10}
+RATE=${2:-500}
+BENCH=./bin/link_bench
+DELAY=1ms
+
+make link_bench || exit 1
+trap 'tc qdisc del dev lo root 2>/dev/null' EXIT INT TERM
+
+header=""
+for loss in 0 0.1 1 5; do
+	tc qdisc replace dev lo root netem delay $DELAY loss ${loss}% || exit 1
+	$BENCH $SECONDS_PER_RUN $RATE "loss=${loss}%" $header
+	header="--no-header"
+done
@@ -0,0 +1,272 @@
+/*
+ * Micro-benchmarks for the communication hot paths: CRC, COBS, packing,
+ * framing received bytes, passing packets between processes, logging and
+ * backing up received packets.
+ * Needs no hardware: make bench
+ *
+ * Results are printed and written as CSV (default ./bin/bench_results.csv)
+ * with the columns:
+ *		benchmark,ops,ns_per_op,mb_per_s,p50_ns,p99_ns
+ * mb_per_s is 0 where a benchmark has no meaningful byte count and the
+ * percentiles are 0 where operations are too short to time one by one.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/wait.h>
+#include <time.h>
+
+#include <vector>
+#include <string>
+#include <algorithm>
+
+#include "comms/protocol.h"
+#include "comms/packet.h"
+#include "comms/transceiver.h"
+#include "comms/pipes.h"
+#include "comms/shm_pipe.h"
+#include "logger/logger.h"
+#include "comms/backup_log.h"
+
+#include <fstream>
+#include <sstream>
+
+static uint64_t now_ns() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// Stop the compiler optimising away work whose result is unused
+template<class T>
+static void keep(T const &value) {
+	asm volatile("" : : "g"(&value) : "memory");
+}
+
+struct Result {
+	std::string name;
+	uint64_t ops;
+	double ns_per_op;
+	double mb_per_s;
+	double p50;
+	double p99;
+};
+
+static std::vector<Result> results;
+
+static void report(const Result &r) {
+	printf("%-28s %12llu %12.1f %10.1f %10.0f %10.0f\n", r.name.c_str(),
+			(unsigned long long) r.ops, r.ns_per_op, r.mb_per_s, r.p50, r.p99);
+	results.push_back(r);
+}
+
+/*
+ * Run f repeatedly for about 0.2s
+ * bytes: Bytes processed by each call (0 if not meaningful)
+ */
+template<class F>
+static void throughput(const char *name, size_t bytes, F f) {
+	uint64_t ops = 1000;
+	for (;;) {
+		uint64_t start = now_ns();
+		for (uint64_t i = 0; i < ops; i++)
+			f();
+		uint64_t elapsed = now_ns() - start;
+		if (elapsed > 200000000ull || ops > (1ull << 32)) {
+			Result r;
+			r.name = name;
+			r.ops = ops;
+			r.ns_per_op = (double) elapsed / ops;
+			r.mb_per_s = bytes ? bytes * ops / (elapsed / 1e9) / 1e6 : 0;
+			r.p50 = r.p99 = 0;
+			report(r);
+			return;
+		}
+		ops *= 4;
+	}
+}
+
+/*
+ * Time each of a number of operations so percentiles can be given
+ */
+static void latency(const char *name, std::vector<double> &samples) {
+	std::sort(samples.begin(), samples.end());
+	double total = 0;
+	for (size_t i = 0; i < samples.size(); i++)
+		total += samples[i];
+	Result r;
+	r.name = name;
+	r.ops = samples.size();
+	r.ns_per_op = total / samples.size();
+	r.mb_per_s = 0;
+	r.p50 = samples[samples.size() / 2];
+	r.p99 = samples[samples.size() * 99 / 100];
+	report(r);
+}
+
+// Blocking waits for each channel type
+static void wait_read(comms::Pipe &pipe) {
+	struct pollfd fds[1];
+	fds[0].fd = pipe.getReadfd();
+	fds[0].events = POLLIN;
+	poll(fds, 1, -1);
+}
+
+static void wait_read(comms::ShmPipe &pipe) {
+	pipe.waitRead(-1);
+}
+
+template<class Channel>
+static void round_trip(const char *name, int rounds) {
+	Channel pipe;
+	comms::Packet p;
+	memset(&p, 0, sizeof (p));
+	if (pipe.Fork() == 0) {
+		for (int i = 0; i < rounds; i++) {
+			while (pipe.binread(&p, sizeof (p)) <= 0)
+				wait_read(pipe);
+			pipe.binwrite(&p, sizeof (p));
+		}
+		_exit(0);
+	}
+	std::vector<double> samples;
+	for (int i = 0; i < rounds; i++) {
+		uint64_t start = now_ns();
+		pipe.binwrite(&p, sizeof (p));
+		while (pipe.binread(&p, sizeof (p)) <= 0)
+			wait_read(pipe);
+		samples.push_back(now_ns() - start);
+	}
+	wait(NULL);
+	latency(name, samples);
+}
+
+int main(int argc, char* argv[]) {
+	const char *out = (argc > 1) ? argv[1] : "./bin/bench_results.csv";
+	printf("%-28s %12s %12s %10s %10s %10s\n", "benchmark", "ops", "ns/op",
+			"MB/s", "p50 ns", "p99 ns");
+
+	// Checksums over one packet and a large buffer
+	comms::byte1_t buf[4096];
+	for (size_t i = 0; i < sizeof (buf); i++)
+		buf[i] = i * 31 + 7;
+	throughput("crc16Gen/19B", 19, [&]() {
+		keep(comms::Protocol::crc16Gen(buf, 19, crc_poly));
+	});
+	throughput("crc16Gen/4KB", sizeof (buf), [&]() {
+		keep(comms::Protocol::crc16Gen(buf, sizeof (buf), crc_poly));
+	});
+	throughput("crc16Bitwise/19B", 19, [&]() {
+		keep(comms::Protocol::crc16Bitwise(buf, 19, crc_poly));
+	});
+
+	// COBS over the 23 bytes of a packet after the sync byte
+	comms::Packet p;
+	comms::byte1_t data[16] = {1, 0, 2, 0, 3, 4, 5, 0, 6, 7, 8, 9, 0, 10, 11, 12};
+	comms::Protocol::pack(p, ID_DATA1, 1, data);
+	comms::byte1_t *after_sync = (comms::byte1_t*) &p + offsetof(comms::Packet, ohb);
+	throughput("cobsEncode+Decode/23B", 23, [&]() {
+		comms::Protocol::cobsDecode(after_sync, 23, 0);
+		comms::Protocol::cobsEncode(after_sync, 23, 0);
+		keep(p);
+	});
+
+	// Packing
+	throughput("pack", sizeof (comms::Packet), [&]() {
+		comms::Protocol::pack(p, ID_DATA1, 1, data);
+		keep(p);
+	});
+	comms::ImuAccGyr acc_gyr;
+	memcpy(&acc_gyr, data, sizeof (acc_gyr));
+	throughput("pack<ID_DATA1>", sizeof (comms::Packet), [&]() {
+		comms::Protocol::pack<ID_DATA1>(p, 1, acc_gyr);
+		keep(p);
+	});
+	comms::Packet packed = p;
+	throughput("unpack", sizeof (comms::Packet), [&]() {
+		comms::Packet copy = packed;
+		comms::byte1_t id;
+		comms::byte2_t index;
+		comms::byte1_t got[16];
+		keep(comms::Protocol::unpack(copy, id, index, got));
+		keep(got);
+	});
+
+	// Framing a received byte stream
+	std::vector<comms::byte1_t> stream(100 * sizeof (comms::Packet));
+	for (int i = 0; i < 100; i++)
+		memcpy(&stream[i * sizeof (comms::Packet)], &packed, sizeof (comms::Packet));
+	comms::PacketChecker checker;
+	throughput("PacketChecker::push_byte", stream.size(), [&]() {
+		int found = 0;
+		for (size_t i = 0; i < stream.size(); i++)
+			if (checker.push_byte(stream[i]))
+				found++;
+		keep(found);
+	});
+
+	// Passing a packet to a child process and back
+	round_trip<comms::Pipe>("Pipe round trip", 20000);
+	round_trip<comms::ShmPipe>("ShmPipe round trip", 20000);
+
+	// Logging a packet
+	{
+		char log_name[] = "/tmp/bench_logXXXXXX";
+		int fd = mkstemp(log_name);
+		close(fd);
+		Logger Log(log_name);
+		Log.start_log();
+		throughput("Logger packet write", 0, [&]() {
+			Log("DATA") << packed;
+		});
+		Log.stop_log();
+		std::string txt = std::string(log_name) + ".txt";
+		unlink(txt.c_str());
+		unlink(log_name);
+	}
+
+	// Backing up a received packet: the old text format against the binary
+	// records (mb_per_s is bytes written per second)
+	{
+		char backup_name[] = "/tmp/bench_backupXXXXXX";
+		int fd = mkstemp(backup_name);
+		close(fd);
+		std::stringstream line;
+		line << packed << std::endl;
+		std::ofstream outf(backup_name);
+		throughput("Backup text write", line.str().size(), [&]() {
+			outf << packed << std::endl;
+		});
+		outf.close();
+		unlink(backup_name);
+		comms::BackupLog backup;
+		backup.open(backup_name);
+		uint64_t n = 0;
+		throughput("Backup binary write", sizeof (comms::BackupRecord), [&]() {
+			backup.add(packed);
+			if (++n % 32 == 0)
+				backup.flush(); // About a frame of packets per batch
+		});
+		backup.close();
+		unlink(backup_name);
+	}
+
+	FILE *f = fopen(out, "w");
+	if (!f) {
+		perror("Failed to open results file");
+		return 1;
+	}
+	fprintf(f, "benchmark,ops,ns_per_op,mb_per_s,p50_ns,p99_ns\n");
+	for (size_t i = 0; i < results.size(); i++) {
+		const Result &r = results[i];
+		fprintf(f, "%s,%llu,%.2f,%.2f,%.0f,%.0f\n", r.name.c_str(),
+				(unsigned long long) r.ops, r.ns_per_op, r.mb_per_s, r.p50, r.p99);
+	}
+	fclose(f);
+	printf("Results written to %s\n", out);
+	return 0;
+}
@@ -18,6 +18,9 @@
 #include <iostream>  //for std::endl
 
 #include <string>
+#include <algorithm>
+#include <map>
+#include <memory>
 #include <fcntl.h>
 #include <sys/types.h>
 #include <sys/wait.h>
@@ -25,16 +28,54 @@
 
 #include "Ethernet.h"
 #include "comms/pipes.h"
+#include "comms/shm_pipe.h"
 #include "comms/transceiver.h"
 #include "comms/packet.h"
+#include "comms/protocol.h"
+#include "comms/reactor.h"
+#include "comms/sequence.h"
+#include "comms/link_window.h"
+#include "comms/fan_out.h"
+#include "comms/multicast.h"
+#include "comms/backup_log.h"
+#include "comms/clock_sync.h"
 
 #include "timing/timer.h"
+#include "timing/backoff.h"
 #include "logger/logger.h"
 #include <error.h>
 #include <sstream>
 
 #include <poll.h>
+#include <signal.h>
+#include <arpa/inet.h>
+#include <netinet/tcp.h>
 
+// Time without an answer from the other Pi before the connection is dropped
+#define DEAD_PEER_MS 2000
+// Time between pings to the other Pi
+#define PING_MS 1000
+
+/**
+ * Make the kernel notice quickly when the other Pi has gone (rebooted or
+ * the cable pulled) instead of waiting minutes. Idle connections are
+ * probed every second and anything sent must be acknowledged within
+ * DEAD_PEER_MS, otherwise reads and writes on the socket fail.
+ *
+ * @param fd: Connected socket
+ */
+void set_keepalive(int fd) {
+	int on = 1;
+	int idle = 1;
+	int interval = 1;
+	int count = 2;
+	unsigned int timeout = DEAD_PEER_MS;
+	setsockopt(fd, SOL_SOCKET, SO_KEEPALIVE, &on, sizeof (on));
+	setsockopt(fd, IPPROTO_TCP, TCP_KEEPIDLE, &idle, sizeof (idle));
+	setsockopt(fd, IPPROTO_TCP, TCP_KEEPINTVL, &interval, sizeof (interval));
+	setsockopt(fd, IPPROTO_TCP, TCP_KEEPCNT, &count, sizeof (count));
+	setsockopt(fd, IPPROTO_TCP, TCP_USER_TIMEOUT, &timeout, sizeof (timeout));
+}
 
 int Server::setup() {
 	Log("INFO") << "Setting up server to communicate on port no. " << _port;
@@ -44,6 +85,9 @@ int Server::setup() {
 		Log("ERROE") << "Server failed to open socket";
 		throw EthernetException("ERROR: Server Failed to Open Socket");
 	}
+	// Allow binding again straight away if the program restarts
+	int reuse = 1;
+	setsockopt(_sockfd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof (reuse));
 	bzero((char *) &_serv_addr, sizeof (_serv_addr));
 	// Setup details for the server address
 	_serv_addr.sin_family = AF_INET;
@@ -64,7 +108,6 @@ int Server::setup() {
 Server::~Server() {
 	Log("INFO") << "Destroying Server";
 	Log.stop_log();
-	close(_newsockfd);
 	close(_sockfd);
 }
 
@@ -73,12 +116,6 @@ Server::~Server() {
 int Client::setup() {
 	Log("INFO") << "Setting up client to communicate with " << _host_name <<
 			" on port no. " << _port;
-	// Open the socket
-	_sockfd = socket(AF_INET, SOCK_STREAM, 0);
-	if (_sockfd < 0) {
-		Log("ERROR") << "Client failed to open socket";
-		throw EthernetException("Client failed to open socket");
-	}
 	// Look for server host by given name
 	_server = gethostbyname(_host_name.c_str());
 	if (_server == NULL) {
@@ -95,20 +132,45 @@ int Client::setup() {
 	return 0;
 }
 
-int Client::open_connection() {
-	Log("INFO") << "Opening connection to server";
+int Client::open_connection(int timeout_ms) {
+	// A new socket for every attempt, a failed connect leaves it unusable
+	if (_sockfd >= 0)
+		close(_sockfd);
+	_sockfd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+	if (_sockfd < 0)
+		throw EthernetException("Client failed to open socket");
 	if (connect(_sockfd, (struct sockaddr *) &_serv_addr, sizeof (_serv_addr)) < 0) {
-		Log("ERROR") << "Request to connect to server failed";
-		throw EthernetException("Failed to connect to server"); // Failed to connect!
+		if (errno != EINPROGRESS)
+			throw EthernetException("Failed to connect to server");
+		// Wait for the connection to complete or fail
+		struct pollfd fds[1];
+		fds[0].fd = _sockfd;
+		fds[0].events = POLLOUT;
+		int n = poll(fds, 1, timeout_ms);
+		if (n == 0) {
+			errno = ETIMEDOUT;
+			throw EthernetException("Failed to connect to server");
+		}
+		int err = 0;
+		socklen_t len = sizeof (err);
+		if (n < 0 || getsockopt(_sockfd, SOL_SOCKET, SO_ERROR, &err, &len) < 0)
+			throw EthernetException("Failed to connect to server");
+		if (err) {
+			errno = err;
+			throw EthernetException("Failed to connect to server");
+		}
 	}
+	set_keepalive(_sockfd);
+	_connected = true;
 	Log("INFO") << "Successfully connected to server";
 	return 0;
 }
 
 void Client::close_connection() {
 	Log("INFO") << "Ending connection with server and closing process";
-	if (_sockfd) {
+	if (_sockfd >= 0) {
 		close(_sockfd);
+		_sockfd = -1;
 		_pipes.close_pipes();
 	}
 	_connected = false;
@@ -123,54 +185,579 @@ Client::~Client() {
 /*
  * Specific functions for the PIOneERS implementation. The client and server
  * both run as a separate process with a pipe for passing data back and forth.
- * The client regularly checks the pipe for data to be sent and does so.
- * Whenever the server receives a request it also checks it's own pipe for data
- * to be transferred to the client and does so.
+ * Packets from the pipe are bundled into ID_BULK frames and sent as soon as
+ * there are any, frames received are split up and passed to the pipe.
  *
- * General format of communication:
- * Client initiates communication and sends first data packet
- * Server responds by acknowledging receipt of the packet
- * Client continues to send packets while it has some and the server responds
- *		accordingly
- * Client informs the server it has finished sending packets.
- * Server then sends any packets it has to the client in a similar process.
- * Server informs the client it is finished and both server and client end
- *		the connection
+ * Every frame sent is kept in a LinkWindow until the other Pi acknowledges
+ * it with an ID_ACK packet (see comms/link_window.h). Acks are cumulative and
+ * sent once for each batch of frames received, so the sender never waits
+ * for them unless the window is full. If the connection is lost the client
+ * reconnects, the server accepts it again and both send everything not yet
+ * acknowledged again; frames the other side already has are ignored.
  */
 
-void Raspi1::share_data() {
+/**
+ * Start the binary backup of the packets received (see comms/backup_log.h),
+ * tools/backup_to_csv turns it into CSV
+ *
+ * @param filename: Start of the file name, the date and time are added
+ */
+static void open_backup(Logger &Log, comms::BackupLog &backup, const std::string &filename) {
+	std::stringstream name;
+	name << filename << "_" << Timer::str_datetime() << ".bin";
+	Log("INFO") << "Opening backup file: " << name.str();
+	if (backup.open(name.str()) < 0)
+		Log("ERROR") << "Unable to open backup file\n\t" << std::strerror(errno);
+}
+
+/**
+ * Bundle packets into ID_BULK frames held in the window. Only the useful
+ * part of each packet is kept and many packets share one frame.
+ *
+ * @param window: Window for the link (or a DatagramSink), needs room for a
+ * frame per packet
+ * @param p: Packets to be sent
+ * @param n: Number of packets
+ * @return Number of frames added
+ */
+template<class Sink>
+static int bundle_into(Sink &window, const comms::Packet *p, int n) {
+	comms::byte1_t payload[LARGE_PACKET_MAX_DATA];
+	int len = 0;
+	int frames = 0;
+	for (int i = 0; i <= n; i++) {
+		int used = (i < n) ? comms::Protocol::bundle(payload, len, p[i]) : -2;
+		if (used == -2 && len > 0) {
+			// Frame is full (or we have run out of packets) so keep it
+			if (window.add(payload, len) < 0)
+				return frames;
+			frames++;
+			len = 0;
+			if (i < n)
+				used = comms::Protocol::bundle(payload, len, p[i]);
+		}
+		if (used >= 0)
+			len = used;
+	}
+	return frames;
+}
+
+/**
+ * Turn a frame received from the link back into packets
+ *
+ * @param frame: Frame as received
+ * @param size: Size of the frame in bytes
+ * @param p: Array to hold the packets
+ * @param max: Size of the array
+ * @param window: Window for the link, used to ignore frames sent again
+ * @return Number of packets, -1 if the frame is corrupt
+ */
+static int unbundle_frame(comms::LargePacket &frame, int size, comms::Packet *p, int max,
+		comms::LinkWindow &window) {
+	comms::byte1_t id;
+	comms::byte2_t index;
+	if (size == sizeof (comms::Packet)) {
+		// Could be a plain packet, check without changing the frame
+		comms::Packet copy;
+		comms::byte1_t data[16];
+		memcpy(&copy, &frame, sizeof (copy));
+		if (comms::Protocol::unpack(copy, id, index, data) == 0 && id != ID_BULK) {
+			memcpy(p, &frame, sizeof (comms::Packet));
+			return 1;
+		}
+	}
+	comms::byte1_t payload[LARGE_PACKET_MAX_DATA];
+	size_t len;
+	if (comms::Protocol::unpackLarge(frame, size, id, index, payload, len) != 0 || id != ID_BULK)
+		return -1;
+	if (window.accept(index) < 0)
+		return 0; // Already received before the connection was lost
+	return comms::Protocol::unbundle(payload, len, p, max);
+}
+
+/**
+ * Log the link counters if they have changed, at most every 10s
+ *
+ * @param Log: Logger to write to
+ * @param seq: Loss/reorder counters for the packets received
+ * @param window: Window for the link
+ * @param reported: Number of events last logged, updated
+ * @param tmr: Time since last logged, reset when logged
+ */
+static void report_link(Logger &Log, const comms::SequenceTracker &seq,
+		const comms::LinkWindow &window, unsigned long &reported, Timer &tmr) {
+	unsigned long events = seq.lost() + seq.duplicates() + seq.reordered() +
+			window.resent() + window.duplicates() + window.lost() + window.dropped();
+	if (events == reported || tmr.elapsed() < 10000)
+		return;
+	Log("INFO") << "Link counters\n\tFrames resent: " << window.resent() <<
+			" ignored: " << window.duplicates() << " lost: " << window.lost() <<
+			" dropped unsent: " << window.dropped() << " waiting for ack: " <<
+			window.unacked() << "\n\t" << seq;
+	reported = events;
+	tmr.reset();
+}
+
+/*
+ * Heartbeat: each side pings the other every PING_MS and answers its pings
+ * straight away, which gives the round trip time and the offset between the
+ * two clocks (see comms/clock_sync.h). Every new estimate is logged so the
+ * data can be corrected afterwards, and put in shared memory for the main
+ * process. The pings also mean an idle connection always has something
+ * waiting to be acknowledged, so a dead peer is noticed within DEAD_PEER_MS.
+ */
+struct Heartbeat {
+	Logger &Log;
+	comms::SharedClock &shared;
+	comms::ClockSync clock; // Kept between connections
+	Timer ping_tmr;
+	comms::Packet ping; // Last ping from the other side
+	int64_t ping_received_us = 0;
+	bool pong_due = false;
+	bool pong_made = false;
+	unsigned long steps = 0;
+
+	Heartbeat(Logger &log, comms::SharedClock &s) : Log(log), shared(s) {
+	}
+
+	bool due() const {
+		return pong_due || ping_tmr.elapsed() >= PING_MS;
+	}
+
+	/**
+	 * @return Time until a ping is due in ms, for the reactor timeout
+	 */
+	int wait_ms() const {
+		return std::max(0, PING_MS - ping_tmr.elapsed());
+	}
+
+	/**
+	 * Pack the pong or ping which is due, the pong first
+	 */
+	void make(comms::Packet &p) {
+		pong_made = pong_due;
+		if (pong_made)
+			comms::ClockSync::make_pong(ping, p, ping_received_us, Timer::now_us());
+		else
+			clock.make_ping(p, Timer::now_us());
+	}
+
+	/**
+	 * Mark the packet from make() as sent
+	 */
+	void sent() {
+		if (pong_made)
+			pong_due = false;
+		else
+			ping_tmr.reset();
+	}
+
+	/**
+	 * @return true if the frame is a ping or pong, which has been dealt with
+	 */
+	bool received(const comms::LargePacket &frame, int size) {
+		if (size != sizeof (comms::Packet) || (frame.ID != ID_PING && frame.ID != ID_PONG))
+			return false;
+		int64_t now_us = Timer::now_us();
+		const comms::Packet &p = *(const comms::Packet*) &frame;
+		if (frame.ID == ID_PING) {
+			ping = p;
+			ping_received_us = now_us;
+			pong_due = true;
+			return true;
+		}
+		int result = clock.on_pong(p, now_us);
+		if (result < 0)
+			Log("ERROR") << "Corrupt pong received";
+		if (result <= 0)
+			return true;
+		if (clock.steps() != steps) {
+			steps = clock.steps();
+			Log("INFO") << "Clock of the other Pi has jumped, fitting drift again";
+		}
+		shared.store(clock.estimate());
+		Log("CLOCK") << "Round trip " << clock.last_rtt_us() << " us, " << clock.estimate();
+		return true;
+	}
+};
+
+/**
+ * Pass packets between the pipe and the other Pi until the connection is
+ * lost. Frames not acknowledged on an earlier connection are sent first.
+ *
+ * @param Log: Logger for the process
+ * @param pipes: Pipe to the main process
+ * @param sockfd: Connected socket
+ * @param backup: File to save the packets received in
+ * @param window: Window for the link, kept between connections
+ * @param seq: Loss/reorder counters, kept between connections
+ * @param hb: Pings and clock offset, kept between connections
+ * @param local: Name for packets from this Pi in the log
+ * @param remote: Name for packets from the other Pi in the log
+ */
+static void exchange(Logger &Log, comms::ShmPipe &pipes, int sockfd, comms::BackupLog &backup,
+		comms::LinkWindow &window, comms::SequenceTracker &seq, Heartbeat &hb,
+		const std::string &local, const std::string &remote) {
+	comms::Transceiver eth_comms(sockfd);
+	comms::Reactor reactor;
+	comms::LargePacket frame;
+	comms::Packet received[LARGE_PACKET_MAX_DATA / 3];
+	comms::Packet to_send[32];
+	bool writable = true;
+	unsigned long reported = 0;
+	Timer report_tmr;
+	// Send any ack, pong or ping and frames until the socket is full
+	auto flush = [&]() {
+		if (!writable)
+			return;
+		if (window.ack_due()) {
+			comms::Packet ack;
+			window.make_ack(ack);
+			int n = eth_comms.sendFrame((comms::LargePacket*) &ack, sizeof (ack));
+			if (n < 0)
+				throw EthernetException("Error sending ack");
+			if (n > 0)
+				window.ack_sent();
+		}
+		while (!window.ack_due() && hb.due()) {
+			comms::Packet p;
+			hb.make(p);
+			int n = eth_comms.sendFrame((comms::LargePacket*) &p, sizeof (p));
+			if (n < 0)
+				throw EthernetException("Error sending ping");
+			if (n == 0)
+				break;
+			hb.sent();
+		}
+		int size;
+		const comms::LargePacket *f;
+		while (!window.ack_due() && !hb.due() && (f = window.unsent(size)) != NULL) {
+			int n = eth_comms.sendFrame(f, size);
+			if (n < 0)
+				throw EthernetException("Error sending packet");
+			if (n == 0)
+				break;
+			window.sent();
+		}
+		if (window.ack_due() || hb.due() || window.unsent(size) != NULL) {
+			// Wait for the socket to drain
+			writable = false;
+			reactor.want_write(sockfd, true);
+		}
+	};
+	// Take packets from the pipe while the window has room
+	auto fill = [&]() {
+		while (window.room() > 0) {
+			int max = std::min(window.room(), 32);
+			int n = pipes.binread(to_send, max * sizeof (comms::Packet));
+			if (n < 0)
+				throw n;
+			if (n == 0)
+				break;
+			int count = n / sizeof (comms::Packet);
+			for (int i = 0; i < count; i++)
+				Log("DATA (" + local + ")") << to_send[i];
+			bundle_into(window, to_send, count);
+		}
+		flush();
+	};
+	/*
+	 * Frames are only taken from the socket while the pipe to the main
+	 * process has room for all their packets. Otherwise they wait in the
+	 * socket (and TCP slows the other side down) so nothing acknowledged is
+	 * ever dropped, e.g. with the burst after reconnecting.
+	 */
+	const int max_packets = LARGE_PACKET_MAX_DATA / 3;
+	bool blocked = false;
+	auto receive = [&]() {
+		int size = 0;
+		while (!(blocked = pipes.space() < max_packets) &&
+				(size = eth_comms.recvFrame(&frame)) > 0) {
+			if (frame.ID == ID_ACK && size == sizeof (comms::Packet)) {
+				if (window.on_ack(*(comms::Packet*) &frame) < 0)
+					Log("ERROR") << "Corrupt ack received";
+				continue;
+			}
+			if (hb.received(frame, size))
+				continue;
+			int n = unbundle_frame(frame, size, received, max_packets, window);
+			if (n < 0) {
+				Log("ERROR") << "Corrupt frame received";
+				continue;
+			}
+			for (int i = 0; i < n; i++) {
+				Log("DATA (" + remote + ")") << received[i];
+				backup.add(received[i]);
+				seq.add(received[i]);
+			}
+			int w = pipes.binwriteBatch(received, n);
+			if (w < 0) throw w;
+		}
+		backup.flush(); // One write for the whole batch
+		if (size < 0) throw EthernetException("Error receiving packet");
+		fill(); // Acks may have made room and one may be due
+		report_link(Log, seq, window, reported, report_tmr);
+	};
+	reactor.add(sockfd, receive, [&]() {
+		writable = true;
+		reactor.want_write(sockfd, false);
+		fill();
+	});
+	reactor.add(pipes.getReadfd(), fill);
+	if (window.unacked())
+		Log("INFO") << "Sending " << window.unacked() << " frames again";
+	window.rewind();
+	fill();
 	while (1) {
-		try {
-			setup();
-			open_connection();
-			comms::Transceiver eth_comms(_sockfd);
-			std::ofstream outf;
-			std::stringstream outf_name;
-			outf_name << _filename << "_" << Timer::str_datetime() << ".txt";
-			Log("INFO") << "Opening backup file: " << outf_name.str();
-			outf.open(outf_name.str());
+		// Check every 10ms for the main process making room in the pipe,
+		// wake up for pings unless waiting for the socket
+		reactor.run_once(blocked ? 10 : (writable ? hb.wait_ms() : -1));
+		if (blocked)
+			receive();
+		flush();
+	}
+}
+
+/*
+ * UDP multicast mode, chosen with use_multicast() before run(). Packets are
+ * bundled into ID_BULK frames as for TCP but each frame is sent once as a
+ * datagram: nothing is acknowledged or sent again, so a lost datagram never
+ * holds up the ones after it. The frame index counts datagrams so the
+ * receiving side can tell how many were lost.
+ */
+
+/**
+ * Sends bundled frames straight to the group, used in place of a LinkWindow
+ */
+struct DatagramSink {
+	comms::MulticastSocket &sock;
+	comms::byte2_t next; // Index of the next datagram
+	unsigned long sent;
+	unsigned long dropped; // Socket buffer full
+
+	DatagramSink(comms::MulticastSocket &s) : sock(s), next(0), sent(0), dropped(0) {
+	}
+
+	int add(const void *data, size_t len) {
+		comms::LargePacket frame;
+		int size = comms::Protocol::packLarge(frame, ID_BULK, next++, data, len);
+		if (size < 0)
+			return size;
+		int n = sock.send(&frame, size);
+		if (n < 0)
+			throw EthernetException("Error sending datagram");
+		if (n == 0)
+			dropped++; // Counts as lost on the other side, newer data follows
+		else
+			sent++;
+		return size;
+	}
+};
+
+/**
+ * Log the datagram counters if they have changed, at most every 10s
+ */
+static void report_datagrams(Logger &Log, const comms::SequenceTracker &seq,
+		const comms::SequenceTracker &frames, const DatagramSink &sink,
+		unsigned long &reported, Timer &tmr) {
+	const comms::SequenceTracker::Stream &in = frames.stream(ID_BULK);
+	unsigned long events = seq.lost() + seq.duplicates() + seq.reordered() +
+			in.lost + in.duplicates + in.reordered + sink.dropped;
+	if (events == reported || tmr.elapsed() < 10000)
+		return;
+	Log("INFO") << "Multicast counters\n\tDatagrams sent: " << sink.sent <<
+			" dropped (socket full): " << sink.dropped << "\n\tDatagrams received: " <<
+			in.received << " lost: " << in.lost << " (" << 100 * in.loss_rate() <<
+			"%) duplicates: " << in.duplicates << " reordered: " << in.reordered <<
+			"\n\t" << seq;
+	reported = events;
+	tmr.reset();
+}
+
+/**
+ * Pass packets between the pipe and the multicast group until an error
+ *
+ * @param Log: Logger for the process
+ * @param pipes: Pipe to the main process
+ * @param sock: Socket which has joined the group
+ * @param backup: File to save the packets received in
+ * @param seq: Loss/reorder counters for the packets received
+ * @param frames: Loss/reorder counters for the datagrams received
+ * @param hb: Pings and clock offset
+ * @param local: Name for packets from this Pi in the log
+ * @param remote: Name for packets from the other Pi in the log
+ */
+static void exchange_multicast(Logger &Log, comms::ShmPipe &pipes,
+		comms::MulticastSocket &sock, comms::BackupLog &backup,
+		comms::SequenceTracker &seq, comms::SequenceTracker &frames, Heartbeat &hb,
+		const std::string &local, const std::string &remote) {
+	comms::Reactor reactor;
+	DatagramSink sink(sock);
+	comms::LargePacket frame;
+	const int max_packets = LARGE_PACKET_MAX_DATA / 3;
+	comms::Packet received[max_packets];
+	comms::Packet to_send[32];
+	unsigned long reported = 0;
+	Timer report_tmr;
+	auto fill = [&]() {
+		int n;
+		while ((n = pipes.binread(to_send, sizeof (to_send))) > 0) {
+			int count = n / sizeof (comms::Packet);
+			for (int i = 0; i < count; i++)
+				Log("DATA (" + local + ")") << to_send[i];
+			bundle_into(sink, to_send, count);
+		}
+		if (n < 0)
+			throw n;
+	};
+	// Pings and pongs go in datagrams of their own
+	auto beat = [&]() {
+		while (hb.due()) {
 			comms::Packet p;
-			Log("INFO") << "Beginning data-sharing loop";
-			while (1) {
-				int n;
-				n = eth_comms.recvPacket(&p);
-				if (n < 0) throw EthernetException("Error receiving packet");
-				else if (n > 0) {
-					Log("DATA (SERVER)") << p;
-					outf << p << std::endl;
-					n = _pipes.binwrite(&p, sizeof (comms::Packet));
-					if (n < 0) throw n;
-				}
+			hb.make(p);
+			if (sock.send(&p, sizeof (p)) < 0)
+				throw EthernetException("Error sending ping");
+			hb.sent(); // Even if the socket was full, as for data
+		}
+	};
+	// As for TCP, datagrams wait in the socket while the pipe is full
+	bool blocked = false;
+	auto receive = [&]() {
+		int size;
+		while (!(blocked = pipes.space() < max_packets) &&
+				(size = sock.recv(&frame, sizeof (frame))) > 0) {
+			if (hb.received(frame, size))
+				continue;
+			comms::byte1_t id;
+			comms::byte2_t index;
+			comms::byte1_t payload[LARGE_PACKET_MAX_DATA];
+			size_t len;
+			if (comms::Protocol::unpackLarge(frame, size, id, index, payload, len) != 0 ||
+					id != ID_BULK) {
+				Log("ERROR") << "Corrupt datagram received";
+				continue;
+			}
+			// Repeats are passed on too (the main process counts them), a
+			// restarted Pi numbers datagrams from 0 again
+			uint32_t number;
+			int gap = frames.add(ID_BULK, index, &number);
+			if (gap < 0 && frames.stream(ID_BULK).highest - number > 1024) {
+				// Far too old to be late, the other Pi has started again
+				Log("INFO") << "Datagrams from " << remote << " numbered from " << index;
+				frames.reset(ID_BULK);
+				gap = frames.add(ID_BULK, index);
+			}
+			if (gap > 0)
+				Log("ERROR") << gap << " datagrams lost before " << index;
+			int n = comms::Protocol::unbundle(payload, len, received, max_packets);
+			for (int i = 0; i < n; i++) {
+				Log("DATA (" + remote + ")") << received[i];
+				backup.add(received[i]);
+				seq.add(received[i]);
+			}
+			int w = pipes.binwriteBatch(received, n);
+			if (w < 0) throw w;
+		}
+		backup.flush(); // One write for the whole batch
+		if (!blocked && size < 0)
+			throw EthernetException("Error receiving datagram");
+		report_datagrams(Log, seq, frames, sink, reported, report_tmr);
+	};
+	reactor.add(sock.fd(), receive);
+	reactor.add(pipes.getReadfd(), fill);
+	fill();
+	while (1) {
+		reactor.run_once(blocked ? 10 : hb.wait_ms());
+		if (blocked)
+			receive();
+		beat();
+	}
+}
 
-				n = _pipes.binread(&p, sizeof (comms::Packet));
-				if (n < 0) throw n;
-				else if (n > 0) {
-					Log("DATA (CLIENT)") << p;
-					n = eth_comms.sendPacket(&p);
-					if (n < 0) throw EthernetException("Error sending packet");
-				}
-				Timer::sleep_ms(1);
+/**
+ * Run the multicast mode for either Pi, only returns by exiting the process
+ *
+ * @param send_port: Port this Pi sends to
+ * @param recv_port: Port the other Pi sends to
+ */
+static void share_multicast(Logger &Log, comms::ShmPipe &pipes, comms::SharedClock &clock,
+		const std::string &filename, const std::string &group, const std::string &iface,
+		int send_port, int recv_port, const std::string &local, const std::string &remote) {
+	comms::SequenceTracker seq;
+	comms::SequenceTracker frames;
+	Heartbeat hb(Log, clock);
+	Backoff backoff(20, 2000);
+	comms::BackupLog backup;
+	open_backup(Log, backup, filename);
+	comms::MulticastSocket sock;
+	while (1) {
+		try {
+			if (sock.open(group, send_port, recv_port, iface) < 0)
+				throw EthernetException("Unable to join multicast group " + group);
+			Log("INFO") << "Joined multicast group " << group << ", sending to port " <<
+					send_port << " and receiving on port " << recv_port;
+			backoff.reset();
+			exchange_multicast(Log, pipes, sock, backup, seq, frames, hb, local, remote);
+		} catch (int e) {
+			// Pipe closed by the main process, which is expected at the end
+			Log("INFO") << "Problem with read/write to pipes (" << e << ")\n\t" <<
+					std::strerror(errno);
+			sock.close();
+			backup.close();
+			pipes.close_pipes();
+			exit(0);
+		} catch (EthernetException e) {
+			// e.g. the network is not up yet, try again
+			Log("ERROR") << e.what();
+			sock.close();
+			Timer::sleep_ms(backoff.next_ms());
+		} catch (...) {
+			Log("FATAL") << "Unexpected error with multicast\n\t" << std::strerror(errno);
+			pipes.close_pipes();
+			exit(-2);
+		}
+	}
+}
+
+void Raspi1::share_data() {
+	if (!_group.empty())
+		share_multicast(Log, _pipes, _clock, _filename, _group, _iface, _port, _port + 1,
+				"CLIENT", "SERVER");
+	comms::LinkWindow window; // Kept over reconnections
+	comms::SequenceTracker seq;
+	Heartbeat hb(Log, _clock);
+	Backoff backoff(20, 2000);
+	comms::BackupLog backup;
+	open_backup(Log, backup, _filename);
+	// Reconnection latency, from losing the connection to having it back
+	Timer down;
+	bool connected_before = false;
+	int attempts = 0;
+	int reconnects = 0;
+	int32_t worst_ms = 0;
+	int64_t total_ms = 0;
+	while (1) {
+		try {
+			attempts++;
+			if (_server == NULL)
+				setup();
+			open_connection(1000);
+			int32_t latency = down.elapsed();
+			if (connected_before) {
+				reconnects++;
+				total_ms += latency;
+				worst_ms = std::max(worst_ms, latency);
+				Log("INFO") << "Reconnected after " << latency << " ms and " << attempts <<
+						" attempts (mean " << total_ms / reconnects << " ms, worst " <<
+						worst_ms << " ms over " << reconnects << " reconnections)";
+			} else {
+				Log("INFO") << "Connected after " << latency << " ms and " << attempts << " attempts";
 			}
+			connected_before = true;
+			attempts = 0;
+			backoff.reset();
+			Log("INFO") << "Beginning data-sharing loop";
+			exchange(Log, _pipes, _sockfd, backup, window, seq, hb, "CLIENT", "SERVER");
 		} catch (int e) {
 			switch (e) {
 				case -1: // Process not forked correctly
@@ -180,6 +767,7 @@ void Raspi1::share_data() {
 				case -3: //
 					Log("ERROR") << "Problem with read/write to pipes\n\t" << std::strerror(errno);
 					close(_sockfd);
+					backup.close();
 					_pipes.close_pipes();
 					exit(e); // This is expected when we want to end the process
 				default:
@@ -190,10 +778,18 @@ void Raspi1::share_data() {
 			}
 			_pipes.close_pipes();
 		} catch (EthernetException e) {
-			Log("ERROR") << "Problem with communication\n\t" << e.what();
-			_pipes.close_pipes();
-			Log("INFO") << "Trying to reconnect";
-			Timer::sleep_ms(5000);
+			// Keep the pipe open, anything sent meanwhile waits in it
+			if (attempts == 0) {
+				Log("ERROR") << "Connection lost\n\t" << e.what();
+				down.reset();
+				Log("INFO") << "Trying to reconnect";
+			} else if (attempts == 1 || attempts % 100 == 0) {
+				Log("ERROR") << "Unable to connect after " << attempts << " attempts\n\t" << e.what();
+			}
+			close(_sockfd);
+			_sockfd = -1;
+			_connected = false;
+			Timer::sleep_ms(backoff.next_ms());
 		} catch (...) {
 			Log("FATAL") << "Unexpected error with client\n\t" << std::strerror(errno);
 			_pipes.close_pipes();
@@ -212,7 +808,7 @@ void Raspi1::run(std::string filename) {
 	 */
 	_filename = filename;
 	Log("INFO") << "Starting data sharing with server";
-	_pipes = comms::Pipe();
+	_pipes = comms::ShmPipe();
 	Log("INFO") << "Forking processes";
 	if ((_pid = _pipes.Fork()) == 0) {
 		// This is the child process.
@@ -241,93 +837,243 @@ bool Raspi1::status() {
 }
 
 void Raspi2::share_data() {
-	while (1) {
-		try {
-			comms::Transceiver eth_comms(_newsockfd);
-			std::ofstream outf;
-			std::stringstream outf_name;
-			outf_name << _filename << "_" << Timer::str_datetime() << ".txt";
-			outf.open(outf_name.str());
-			comms::Packet p;
-			int n;
+	if (!_group.empty())
+		share_multicast(Log, _pipes, _clock, _filename, _group, _iface, _port + 1, _port,
+				"SERVER", "CLIENT");
+	comms::LinkWindow window; // Frames for Pi 1, kept over reconnections
+	comms::SequenceTracker seq;
+	Heartbeat hb(Log, _clock); // With Pi 1 only
+	comms::FanOut monitors; // Every other client gets a copy of the frames
+	std::map<int, std::unique_ptr<comms::Transceiver> > clients;
+	int primary = -1; // Pi 1, the client which acknowledges frames
+	comms::BackupLog backup;
+	open_backup(Log, backup, _filename);
+	const int max_packets = LARGE_PACKET_MAX_DATA / 3;
+	comms::LargePacket frame;
+	comms::Packet received[max_packets];
+	comms::Packet to_send[32];
+	bool writable = true; // Socket to Pi 1 can take more
+	bool blocked = false; // Pipe to the main process has no room for a frame
+	unsigned long reported = 0;
+	Timer report_tmr;
+	try {
+		signal(SIGPIPE, SIG_IGN); // Errors are handled where they happen
+		fcntl(_sockfd, F_SETFL, fcntl(_sockfd, F_GETFL) | O_NONBLOCK);
+		comms::Reactor reactor;
+
+		auto drop = [&](int fd, const char *why) {
+			Log("INFO") << "Client " << fd << " disconnected (" << why << "), " <<
+					clients.size() - 1 << " still connected";
+			reactor.remove(fd);
+			monitors.remove(fd);
+			clients.erase(fd);
+			close(fd);
+			if (fd == primary) {
+				primary = -1;
+				blocked = false;
+			}
+		};
+		auto drop_all = [&](const std::vector<int> &fds, const char *why) {
+			for (size_t i = 0; i < fds.size(); i++)
+				drop(fds[i], why);
+		};
+		// Send any ack, pong or ping and frames to Pi 1 until the socket is full
+		auto flush = [&]() {
+			if (primary < 0 || !writable)
+				return;
+			comms::Transceiver &eth = *clients[primary];
+			if (window.ack_due()) {
+				comms::Packet ack;
+				window.make_ack(ack);
+				int n = eth.sendFrame((comms::LargePacket*) &ack, sizeof (ack));
+				if (n < 0)
+					return drop(primary, "error sending ack");
+				if (n > 0)
+					window.ack_sent();
+			}
+			while (!window.ack_due() && hb.due()) {
+				comms::Packet p;
+				hb.make(p);
+				int n = eth.sendFrame((comms::LargePacket*) &p, sizeof (p));
+				if (n < 0)
+					return drop(primary, "error sending ping");
+				if (n == 0)
+					break;
+				hb.sent();
+			}
+			int size;
+			const comms::LargePacket *f;
+			while (!window.ack_due() && !hb.due() && (f = window.unsent(size)) != NULL) {
+				int n = eth.sendFrame(f, size);
+				if (n < 0)
+					return drop(primary, "error sending packet");
+				if (n == 0)
+					break;
+				window.sent();
+			}
+			if (window.ack_due() || hb.due() || window.unsent(size) != NULL) {
+				writable = false;
+				reactor.want_write(primary, true);
+			}
+		};
+		// Take packets from the pipe into frames for every client
+		auto fill = [&]() {
 			while (1) {
-				int n;
-				n = eth_comms.recvPacket(&p);
-				if (n < 0) throw EthernetException("Error receiving packet");
-				else if (n > 0) {
-					Log("DATA (CLIENT)") << p;
-					outf << p << std::endl;
-					n = _pipes.binwrite(&p, sizeof (comms::Packet));
-					if (n < 0) throw n;
+				// With Pi 1 away, keep the newest frames so the others still
+				// get live data
+				while (primary < 0 && window.room() < 32)
+					window.drop_oldest();
+				if (window.room() <= 0)
+					break;
+				int max = std::min(window.room(), 32);
+				int n = _pipes.binread(to_send, max * sizeof (comms::Packet));
+				if (n < 0)
+					throw n;
+				if (n == 0)
+					break;
+				int count = n / sizeof (comms::Packet);
+				for (int i = 0; i < count; i++)
+					Log("DATA (SERVER)") << to_send[i];
+				uint32_t first = window.next();
+				bundle_into(window, to_send, count);
+				for (uint32_t i = first; i != window.next(); i++) {
+					int size;
+					const comms::LargePacket *f = window.frame(i, size);
+					drop_all(monitors.broadcast(f, size), "too slow");
 				}
-
-				n = _pipes.binread(&p, sizeof (comms::Packet));
-				if (n < 0) throw n;
-				else if (n > 0) {
-					Log("DATA (SERVER)") << p;
-					n = eth_comms.sendPacket(&p);
-					if (n < 0) throw EthernetException("Error sending packet");
+			}
+			for (std::map<int, std::unique_ptr<comms::Transceiver> >::iterator it = clients.begin();
+					it != clients.end(); it++)
+				if (monitors.pending(it->first))
+					reactor.want_write(it->first, true);
+			flush();
+		};
+		// The first ack from a client shows it is Pi 1
+		auto promote = [&](int fd) {
+			if (primary >= 0)
+				drop(primary, "Pi 1 has connected again");
+			primary = fd;
+			monitors.remove(fd);
+			writable = true;
+			Log("INFO") << "Client " << fd << " is Pi 1";
+			if (window.unacked())
+				Log("INFO") << "Sending " << window.unacked() << " frames again";
+			window.rewind();
+		};
+		auto receive = [&](int fd) {
+			comms::Transceiver &eth = *clients[fd];
+			int size = 0;
+			while (!(fd == primary && (blocked = _pipes.space() < max_packets)) &&
+					(size = eth.recvFrame(&frame)) > 0) {
+				if (frame.ID == ID_ACK && size == sizeof (comms::Packet)) {
+					if (fd != primary)
+						promote(fd);
+					if (window.on_ack(*(comms::Packet*) &frame) < 0)
+						Log("ERROR") << "Corrupt ack received";
+					continue;
+				}
+				if (fd != primary)
+					continue; // Other clients only listen
+				if (hb.received(frame, size))
+					continue;
+				int n = unbundle_frame(frame, size, received, max_packets, window);
+				if (n < 0) {
+					Log("ERROR") << "Corrupt frame received";
+					continue;
 				}
-				Timer::sleep_ms(1);
+				for (int i = 0; i < n; i++) {
+					Log("DATA (CLIENT)") << received[i];
+					backup.add(received[i]);
+					seq.add(received[i]);
+				}
+				int w = _pipes.binwriteBatch(received, n);
+				if (w < 0) throw w;
 			}
-		} catch (int e) {
-			switch (e) {
-				case -1: // Process not forked correctly
-					Log("ERROR") << "Problem with ethernet\n\t" << std::strerror(errno);
-					break;
-				case -2: // Pipe unavailable
-				case -3: //
-					Log("ERROR") << "Problem with read/write to pipes\n\t" << std::strerror(errno);
-					close(_newsockfd);
-					close(_sockfd);
-					_pipes.close_pipes();
-					exit(0); // This is expected when we want to end the process
-				default:
-					Log("ERROR") << "Unexpected error code: " << e;
-					close(_newsockfd);
-					close(_sockfd);
-					_pipes.close_pipes();
-					exit(-1);
+			backup.flush(); // One write for the whole batch
+			if (size < 0)
+				return drop(fd, "connection lost");
+			if (fd == primary) {
+				fill(); // Acks may have made room and one may be due
+				report_link(Log, seq, window, reported, report_tmr);
 			}
-			close(_newsockfd);
-			_pipes.close_pipes();
-			Timer::sleep_ms(1000);
-		} catch (EthernetException e) {
-			Log("FATAL") << "Problem with Ethernet communication\n\t" << e.what();
-			close(_newsockfd);
-			_pipes.close_pipes();
-			Timer::sleep_ms(1000);
-			// Allow program to try and reconnect
-		} catch (...) {
-			Log("FATAL") << "Unexpected error with server\n\t" << std::strerror(errno);
-			close(_newsockfd);
-			close(_sockfd);
-			_pipes.close_pipes();
-			exit(-3);
+		};
+		auto send_more = [&](int fd) {
+			if (fd == primary) {
+				writable = true;
+				reactor.want_write(fd, false);
+				fill();
+				return;
+			}
+			int done = monitors.flush(fd);
+			if (done < 0)
+				drop(fd, "error sending packet");
+			else if (done > 0)
+				reactor.want_write(fd, false);
+		};
+		reactor.add(_sockfd, [&]() {
+			int fd;
+			while ((fd = accept4(_sockfd, (struct sockaddr*) & _cli_addr, &_clilen, SOCK_NONBLOCK)) >= 0) {
+				set_keepalive(fd);
+				clients[fd].reset(new comms::Transceiver(fd));
+				monitors.add(fd);
+				reactor.add(fd, [&, fd]() {
+					receive(fd);
+				}, [&, fd]() {
+					send_more(fd);
+				});
+				Log("INFO") << "Client " << fd << " connected from " <<
+						inet_ntoa(_cli_addr.sin_addr) << ", " << clients.size() << " connected";
+			}
+			if (errno != EAGAIN && errno != EWOULDBLOCK)
+				Log("ERROR") << "Problem accepting client\n\t" << std::strerror(errno);
+		});
+		reactor.add(_pipes.getReadfd(), fill);
+		Log("INFO") << "Waiting for clients";
+		fill();
+		while (1) {
+			// Check every 10ms for the main process making room in the pipe,
+			// wake up for pings to Pi 1 unless waiting for the socket
+			reactor.run_once(blocked ? 10 : (primary >= 0 && writable ? hb.wait_ms() : -1));
+			if (blocked && primary >= 0)
+				receive(primary);
+			flush();
 		}
+	} catch (int e) {
+		// Pipe closed by the main process, which is expected at the end
+		Log("INFO") << "Problem with read/write to pipes (" << e << ")\n\t" <<
+				std::strerror(errno);
+		for (std::map<int, std::unique_ptr<comms::Transceiver> >::iterator it = clients.begin();
+				it != clients.end(); it++)
+			close(it->first);
+		close(_sockfd);
+		backup.close();
+		_pipes.close_pipes();
+		exit(0);
+	} catch (...) {
+		Log("FATAL") << "Unexpected error with server\n\t" << std::strerror(errno);
+		close(_sockfd);
+		_pipes.close_pipes();
+		exit(-3);
 	}
 }
 
 void Raspi2::run(std::string filename) {
-	// Fork a process to handle server stuff
+	/*
+	 * Set up the server and fork a process which accepts clients and shares
+	 * data with them. Clients connect (and reconnect) at any time, the main
+	 * process never waits for them.
+	 */
 	_filename = filename;
-	Log("INFO") << "Starting data sharing with client";
+	Log("INFO") << "Starting data sharing with clients";
 	try {
-		setup();
+		if (_group.empty())
+			setup(); // No server for multicast
 	} catch (EthernetException e) {
 		// Log then rethrow for caller to handle
 		Log("ERROR") << "Problem setting up server\n\t" << e.what();
 		throw e;
 	}
 
-	Log("INFO") << "Waiting for client connection";
-	_newsockfd = accept(_sockfd, (struct sockaddr*) & _cli_addr, &_clilen);
-	if (_newsockfd < 0) {
-		Log("ERROR") << "Problem waiting for client connection";
-		throw EthernetException("Error on accept");
-	}
-	Log("INFO") << "Client has established connection";
-
 	Log("INFO") << "Forking processes";
 	if ((_pid = _pipes.Fork()) == 0) {
 		// This is the child process that handles all the requests
@@ -359,18 +1105,10 @@ bool Raspi2::status() {
 int Raspi2::sendMsg(std::string msg) {
 	msg.insert(0, "Pi2: ");
 	msg += "\n";
-	int n = msg.length();
-	int mesg_num = ceil(n / (float) 15);
-	char *buf = new char [17];
 	int sent = 0;
 	comms::Packet p;
-	for (int i = 0; i < n; i += 16) {
-		bzero(buf, 16);
-		std::string data = msg.substr(i, 16);
-		strcpy(buf, data.c_str());
-		int msg_index = (_index++ << 8) | (--mesg_num);
-		comms::Protocol::pack(p, ID_MSG1, msg_index, buf);
+	_messages.begin(msg.data(), msg.length());
+	while (_messages.next(p))
 		sent += sendPacket(p);
-	}
 	return sent;
 }
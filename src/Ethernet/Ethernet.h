@@ -16,7 +16,11 @@
 #include <error.h>  // For errno
 
 #include "comms/pipes.h"
+#include "comms/shm_pipe.h"
 #include "comms/packet.h"
+#include "comms/message.h"
+#include "comms/clock_sync.h"
+#include "timing/timer.h"
 #include "logger/logger.h"
 
 #ifndef ETHERNET_H
@@ -24,13 +28,13 @@
 
 class Server {
 protected:
-	int _sockfd, _newsockfd, _port;
-	pid_t _pid;
+	int _sockfd, _port;
+	pid_t _pid = 0;
 	socklen_t _clilen;
 	struct sockaddr_in _serv_addr, _cli_addr;
 	std::string _filename;
 	Logger Log;
-	comms::Pipe _pipes;
+	comms::ShmPipe _pipes;
 	bool _connected = false;
 
 	/**
@@ -44,8 +48,10 @@ public:
 	 * Constructor for the Server class
 	 *
 	 * @param port: Port for communication with clients
+	 * @param log: Log file name (without .txt)
 	 */
-	Server(const int port) : _port(port), Log("/Docs/Logs/server") {
+	Server(const int port, const std::string log = "/Docs/Logs/server")
+	: _sockfd(-1), _port(port), Log(log) {
 		Log.start_log();
 		Log("INFO") << "Log started by server";
 	}
@@ -53,12 +59,42 @@ public:
 };
 
 class Raspi2 : public Server {
-	uint8_t _index = 0;
+	comms::MsgFragmenter _messages{ID_MSG2};
+	std::string _group; // Multicast group, empty for TCP
+	std::string _iface;
+	comms::SharedClock _clock; // Pi 1's clock against ours, from the child process
 public:
 
 	Raspi2(const int port) : Server(port) {
 	}
 
+	/**
+	 * @return Now in the time base shared by both Pis, which is Pi 1's
+	 * clock (us since 1970). Our own clock until the first pong from Pi 1.
+	 */
+	int64_t shared_time_us() const {
+		return _clock.load().to_remote(Timer::now_us());
+	}
+
+	/**
+	 * @return Latest estimate of Pi 1's clock against ours
+	 */
+	comms::ClockEstimate clock_estimate() const {
+		return _clock.load();
+	}
+
+	/**
+	 * Send over UDP multicast instead of TCP, call before run(). Datagrams
+	 * lost are not sent again. Pi 1 sends to the port and Pi 2 to the port
+	 * after it.
+	 * @param group: Multicast address (e.g. 239.255.31.41)
+	 * @param iface: Address of the interface to use, empty for the default
+	 */
+	void use_multicast(const std::string &group, const std::string &iface = "") {
+		_group = group;
+		_iface = iface;
+	}
+
 	/**
 	 * Checks the status of the child process
 	 * @return true if process is running, false otherwise
@@ -67,7 +103,8 @@ public:
 
 	/**
 	 * Starts the server running as a child process ready for accepting
-	 * connections from a client.
+	 * connections from clients. Pi 1 is the client which acknowledges
+	 * frames, the others (e.g. ground support) get a read-only copy.
 	 * @return Pipe class for communication charing data with child process.
 	 */
 	void run(std::string filename);
@@ -92,14 +129,14 @@ public:
 class Client {
 protected:
 	int _port;
-	pid_t _pid;
+	pid_t _pid = 0;
 	std::string _host_name;
-	int _sockfd;
+	int _sockfd = -1;
 	struct sockaddr_in _serv_addr;
-	struct hostent *_server;
+	struct hostent *_server = NULL;
 	std::string _filename;
 	Logger Log;
-	comms::Pipe _pipes;
+	comms::ShmPipe _pipes;
 	bool _connected = false;
 public:
 
@@ -107,18 +144,22 @@ public:
 	 * Constructor for the Client class
 	 * @param port: Port for connecting to the server
 	 * @param host_name: Name or IP address of the server
+	 * @param log: Log file name (without .txt)
 	 */
-	Client(const int port, const std::string host_name)
-	: _port(port), _host_name(host_name), Log("/Docs/Logs/client") {
+	Client(const int port, const std::string host_name,
+			const std::string log = "/Docs/Logs/client")
+	: _port(port), _host_name(host_name), Log(log) {
 		Log.start_log();
 		Log("INFO") << "Log started by client";
 	}
 
 	/**
-	 * Opens a new connection with the server
-	 * @return 0 = success, otherwise = failure
+	 * Opens a new connection with the server without blocking for longer
+	 * than the timeout. Throws EthernetException on failure.
+	 * @param timeout_ms: Longest time to wait for the server to answer
+	 * @return 0 = success
 	 */
-	int open_connection();
+	int open_connection(int timeout_ms = 1000);
 
 	/**
 	 * Closes connection with the server
@@ -128,7 +169,7 @@ public:
 
 protected:
 	/**
-	 * Called by constructor. Sets up basic variables needed for the client
+	 * Looks up the address of the server
 	 * @return 0 = success, otherwise = failure
 	 */
 	int setup();
@@ -138,11 +179,41 @@ protected:
 };
 
 class Raspi1 : public Client {
+	std::string _group; // Multicast group, empty for TCP
+	std::string _iface;
+	comms::SharedClock _clock; // Pi 2's clock against ours, from the child process
 public:
 
 	Raspi1(const int port, const std::string host_name) : Client(port, host_name) {
 	}
 
+	/**
+	 * @return Now in the time base shared by both Pis, which is our clock
+	 * (us since 1970)
+	 */
+	int64_t shared_time_us() const {
+		return Timer::now_us();
+	}
+
+	/**
+	 * @return Latest estimate of Pi 2's clock against ours
+	 */
+	comms::ClockEstimate clock_estimate() const {
+		return _clock.load();
+	}
+
+	/**
+	 * Send over UDP multicast instead of TCP, call before run(). Datagrams
+	 * lost are not sent again. Pi 1 sends to the port and Pi 2 to the port
+	 * after it.
+	 * @param group: Multicast address (e.g. 239.255.31.41)
+	 * @param iface: Address of the interface to use, empty for the default
+	 */
+	void use_multicast(const std::string &group, const std::string &iface = "") {
+		_group = group;
+		_iface = iface;
+	}
+
 	void run(std::string filename);
 
 	bool status();
@@ -162,6 +233,12 @@ public:
 	}
 };
 
+/**
+ * Make the kernel notice quickly when the other end of a connection has gone
+ * @param fd: Connected socket
+ */
+void set_keepalive(int fd);
+
 class EthernetException {
 public:
 
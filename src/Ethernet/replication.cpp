@@ -0,0 +1,431 @@
+/**
+ * REXUS PIOneERS - Pi_1
+ * replication.cpp
+ * Purpose: Function implementations for copying files between the Pis
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <sys/sendfile.h>
+#include <sys/syscall.h>
+#include <sys/resource.h>
+#include <netinet/in.h>
+#include <netinet/ip.h>
+
+#include <algorithm>
+#include <sstream>
+
+#include "replication.h"
+#include "timing/timer.h"
+#include "timing/backoff.h"
+
+// Message types
+#define REPL_FILE 1 // Header then name, answered with the offset to start at
+#define REPL_DONE 2 // All files sent
+#define REPL_GET 3 // Send your files
+
+// Largest piece of a file sent or received in one call
+#define REPL_CHUNK (64 * 1024)
+
+// Not in glibc, from linux/ioprio.h
+#define IOPRIO_CLASS_SHIFT 13
+#define IOPRIO_CLASS_IDLE 3
+#define IOPRIO_WHO_PROCESS 1
+
+void lower_priority() {
+	setpriority(PRIO_PROCESS, 0, 19);
+	// Idle class: the disk is only used when nothing else wants it
+	syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, IOPRIO_CLASS_IDLE << IOPRIO_CLASS_SHIFT);
+}
+
+/**
+ * Create a directory and any parents missing
+ */
+static void make_dirs(const std::string &path) {
+	for (size_t i = 1; i <= path.size(); i++)
+		if (i == path.size() || path[i] == '/')
+			mkdir(path.substr(0, i).c_str(), 0755);
+}
+
+/**
+ * @return true if a name from the other Pi stays inside the directory
+ */
+static bool safe_name(const std::string &name) {
+	if (name.empty() || name[0] == '/')
+		return false;
+	std::stringstream ss(name);
+	std::string part;
+	while (std::getline(ss, part, '/'))
+		if (part == "..")
+			return false;
+	return true;
+}
+
+// Manifest
+
+void Manifest::load(const std::string &path) {
+	_files.clear();
+	std::ifstream inf(path);
+	uint64_t size;
+	std::string name;
+	while (inf >> size && std::getline(inf >> std::ws, name))
+		_files[name] = size;
+	if (_outf.is_open())
+		_outf.close();
+	_outf.open(path, std::ofstream::app);
+}
+
+uint64_t Manifest::size(const std::string &name) const {
+	std::map<std::string, uint64_t>::const_iterator it = _files.find(name);
+	return it == _files.end() ? 0 : it->second;
+}
+
+void Manifest::record(const std::string &name, uint64_t size) {
+	_files[name] = size;
+	_outf << size << " " << name << std::endl;
+}
+
+// FileSync
+
+FileSync::FileSync(int fd, Logger &Log, const std::vector<ReplicaSource> &sources,
+		const std::string &dest, int settle_ms, uint64_t max_rate)
+: _fd(fd), Log(Log), _sources(sources), _dest(dest), _settle_ms(settle_ms),
+_max_rate(max_rate) {
+	make_dirs(_dest);
+	_received.load(_dest + "/manifest.txt");
+	_sent.load(_dest + "_sent.txt");
+}
+
+void FileSync::read_all(void *buf, size_t len) {
+	char *p = (char*) buf;
+	while (len > 0) {
+		ssize_t n = read(_fd, p, len);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n == 0)
+			errno = ECONNRESET;
+		if (n <= 0)
+			throw EthernetException("Replication connection lost");
+		p += n;
+		len -= n;
+	}
+}
+
+void FileSync::write_all(const void *buf, size_t len) {
+	const char *p = (const char*) buf;
+	while (len > 0) {
+		ssize_t n = send(_fd, p, len, MSG_NOSIGNAL);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			throw EthernetException("Replication connection lost");
+		p += n;
+		len -= n;
+	}
+}
+
+int FileSync::send_files() {
+	struct File {
+		std::string path;
+		std::string name;
+		uint64_t size;
+
+		bool operator<(const File &f) const {
+			return name < f.name;
+		}
+	};
+	// Find files which are complete and have grown since last confirmed
+	std::vector<File> files;
+	time_t settled = time(NULL) - _settle_ms / 1000;
+	for (size_t i = 0; i < _sources.size(); i++) {
+		DIR *dir = opendir(_sources[i].dir.c_str());
+		if (dir == NULL)
+			continue;
+		struct dirent *entry;
+		while ((entry = readdir(dir)) != NULL) {
+			if (entry->d_name[0] == '.')
+				continue;
+			File f;
+			f.path = _sources[i].dir + "/" + entry->d_name;
+			f.name = _sources[i].name + "/" + entry->d_name;
+			struct stat st;
+			if (stat(f.path.c_str(), &st) < 0 || !S_ISREG(st.st_mode) ||
+					st.st_mtime > settled)
+				continue;
+			f.size = st.st_size;
+			if (f.size != _sent.size(f.name))
+				files.push_back(f);
+		}
+		closedir(dir);
+	}
+	// Oldest first, names include the date and a count
+	std::sort(files.begin(), files.end());
+	for (size_t i = 0; i < files.size(); i++)
+		send_file(files[i].path, files[i].name, files[i].size);
+	Header done = {REPL_DONE, 0, 0};
+	write_all(&done, sizeof (done));
+	return files.size();
+}
+
+void FileSync::send_file(const std::string &path, const std::string &name, uint64_t size) {
+	int fd = open(path.c_str(), O_RDONLY);
+	if (fd < 0) {
+		Log("ERROR") << "Unable to open \"" << path << "\" to send\n\t" << std::strerror(errno);
+		return;
+	}
+	Header h = {REPL_FILE, (uint32_t) name.size(), size};
+	write_all(&h, sizeof (h));
+	write_all(name.data(), name.size());
+	uint64_t start;
+	read_all(&start, sizeof (start));
+	off_t offset = start;
+	Timer tmr;
+	try {
+		while ((uint64_t) offset < size) {
+			size_t chunk = std::min((uint64_t) REPL_CHUNK, size - offset);
+			ssize_t n = sendfile(_fd, fd, &offset, chunk);
+			if (n < 0 && errno == EINTR)
+				continue;
+			if (n <= 0) {
+				if (n == 0)
+					errno = EIO; // File shorter than when offered
+				throw EthernetException("Error sending \"" + name + "\"");
+			}
+			_bytes_sent += n;
+			// Keep to the rate by waiting for the time the data should take
+			if (_max_rate) {
+				int32_t due = (offset - start) * 1000 / _max_rate;
+				if (due > tmr.elapsed())
+					Timer::sleep_ms(due - tmr.elapsed());
+			}
+		}
+	} catch (EthernetException e) {
+		close(fd);
+		throw e;
+	}
+	close(fd);
+	uint64_t confirmed;
+	read_all(&confirmed, sizeof (confirmed));
+	if (confirmed == size)
+		_sent.record(name, size);
+	Log("INFO") << "Sent \"" << name << "\" (" << size - start << " of " << size <<
+			" bytes) in " << tmr.elapsed() << " ms";
+}
+
+void FileSync::request() {
+	Header get = {REPL_GET, 0, 0};
+	write_all(&get, sizeof (get));
+}
+
+int FileSync::receive_files() {
+	int count = 0;
+	Header h;
+	while (1) {
+		read_all(&h, sizeof (h));
+		if (h.type == REPL_DONE)
+			return count;
+		if (h.type != REPL_FILE) {
+			errno = EPROTO;
+			throw EthernetException("Unexpected replication message");
+		}
+		receive_file(h);
+		count++;
+	}
+}
+
+void FileSync::receive_file(const Header &h) {
+	if (h.name_len > 1024) {
+		errno = EPROTO;
+		throw EthernetException("Replication file name too long");
+	}
+	std::string name(h.name_len, '\0');
+	read_all(&name[0], h.name_len);
+	if (!safe_name(name)) {
+		errno = EPROTO;
+		throw EthernetException("Bad replication file name \"" + name + "\"");
+	}
+	std::string path = _dest + "/" + name;
+	make_dirs(path.substr(0, path.rfind('/')));
+	int fd = open(path.c_str(), O_WRONLY | O_CREAT, 0644);
+	if (fd < 0)
+		throw EthernetException("Unable to open \"" + path + "\"");
+	// Carry on from what is already here unless the file has been replaced
+	struct stat st;
+	fstat(fd, &st);
+	uint64_t start = st.st_size;
+	if (start > h.size) {
+		ftruncate(fd, 0);
+		start = 0;
+	}
+	int pipefd[2];
+	if (pipe(pipefd) < 0) {
+		close(fd);
+		throw EthernetException("Unable to create pipe for splice");
+	}
+	try {
+		write_all(&start, sizeof (start));
+		// Socket to pipe to file without copying through user space
+		loff_t offset = start;
+		while ((uint64_t) offset < h.size) {
+			size_t chunk = std::min((uint64_t) REPL_CHUNK, h.size - offset);
+			ssize_t n = splice(_fd, NULL, pipefd[1], NULL, chunk, SPLICE_F_MOVE);
+			if (n < 0 && errno == EINTR)
+				continue;
+			if (n == 0)
+				errno = ECONNRESET;
+			if (n <= 0)
+				throw EthernetException("Error receiving \"" + name + "\"");
+			while (n > 0) {
+				ssize_t w = splice(pipefd[0], NULL, fd, &offset, n, SPLICE_F_MOVE);
+				if (w < 0 && errno == EINTR)
+					continue;
+				if (w <= 0)
+					throw EthernetException("Error writing \"" + path + "\"");
+				n -= w;
+				_bytes_received += w;
+			}
+		}
+		fdatasync(fd);
+		_received.record(name, h.size);
+		write_all(&h.size, sizeof (h.size));
+	} catch (EthernetException e) {
+		close(pipefd[0]);
+		close(pipefd[1]);
+		close(fd);
+		throw e;
+	}
+	close(pipefd[0]);
+	close(pipefd[1]);
+	close(fd);
+	Log("INFO") << "Received \"" << name << "\" (" << h.size - start << " of " <<
+			h.size << " bytes)";
+}
+
+void FileSync::serve() {
+	Header h;
+	while (1) {
+		read_all(&h, sizeof (h));
+		switch (h.type) {
+			case REPL_FILE:
+				receive_file(h);
+				break;
+			case REPL_DONE:
+				break;
+			case REPL_GET:
+				send_files();
+				break;
+			default:
+				errno = EPROTO;
+				throw EthernetException("Unexpected replication message");
+		}
+	}
+}
+
+/**
+ * Mark a socket's traffic as bulk so the network queue puts the packet
+ * link first
+ */
+static void set_bulk(int fd) {
+	int tos = IPTOS_THROUGHPUT;
+	setsockopt(fd, IPPROTO_IP, IP_TOS, &tos, sizeof (tos));
+}
+
+// ReplicationServer
+
+void ReplicationServer::run() {
+	Log("INFO") << "Starting file replication server";
+	setup();
+	if ((_pid = fork()) == 0) {
+		Log.child_log();
+		lower_priority();
+		while (1) {
+			int fd = accept(_sockfd, (struct sockaddr*) &_cli_addr, &_clilen);
+			if (fd < 0) {
+				if (errno != EINTR)
+					Log("ERROR") << "Problem accepting client\n\t" << std::strerror(errno);
+				Timer::sleep_ms(100);
+				continue;
+			}
+			Log("INFO") << "Replication client connected";
+			set_keepalive(fd);
+			set_bulk(fd);
+			try {
+				FileSync sync(fd, Log, _sources, _dest, 10000, _max_rate);
+				sync.serve();
+			} catch (EthernetException e) {
+				Log("INFO") << "Replication client disconnected\n\t" << e.what();
+			}
+			close(fd);
+		}
+	}
+}
+
+bool ReplicationServer::status() {
+	return _pid > 0 && waitpid(_pid, NULL, WNOHANG) == 0;
+}
+
+void ReplicationServer::end() {
+	if (_pid > 0) {
+		kill(_pid, SIGTERM);
+		waitpid(_pid, NULL, 0);
+		_pid = 0;
+	}
+}
+
+// ReplicationClient
+
+void ReplicationClient::run() {
+	Log("INFO") << "Starting file replication client";
+	if ((_pid = fork()) == 0) {
+		Log.child_log();
+		lower_priority();
+		Backoff backoff(1000, 30000);
+		while (1) {
+			try {
+				if (_server == NULL)
+					setup();
+				open_connection(1000);
+				// Blocking from here, the process has nothing else to do
+				fcntl(_sockfd, F_SETFL, fcntl(_sockfd, F_GETFL) & ~O_NONBLOCK);
+				set_bulk(_sockfd);
+				backoff.reset();
+				FileSync sync(_sockfd, Log, _sources, _dest, 10000, _max_rate);
+				while (1) {
+					int sent = sync.send_files();
+					sync.request();
+					int received = sync.receive_files();
+					if (sent || received)
+						Log("INFO") << "Replication: " << sent << " files sent, " <<
+							received << " received (" << sync.bytes_sent() << " and " <<
+							sync.bytes_received() << " bytes this connection)";
+					Timer::sleep_ms(_scan_ms);
+				}
+			} catch (EthernetException e) {
+				Log("INFO") << "Replication connection failed\n\t" << e.what();
+				close(_sockfd);
+				_sockfd = -1;
+				Timer::sleep_ms(backoff.next_ms());
+			}
+		}
+	}
+}
+
+bool ReplicationClient::status() {
+	return _pid > 0 && waitpid(_pid, NULL, WNOHANG) == 0;
+}
+
+void ReplicationClient::end() {
+	if (_pid > 0) {
+		kill(_pid, SIGTERM);
+		waitpid(_pid, NULL, 0);
+		_pid = 0;
+	}
+}
@@ -0,0 +1,235 @@
+/**
+ * REXUS PIOneERS - Pi_1
+ * replication.h
+ * Purpose: Class definitions for copying completed data files and video
+ *			segments between the Pis in the background, so each Pi holds a
+ *			copy of the other's data. Runs over its own TCP connection at
+ *			low CPU and I/O priority so the live packet link is never held up.
+ *
+ * Pi 1 connects to Pi 2 (as for the packet link) and then, over and over,
+ * sends its new files and asks for Pi 2's. A file is offered with its name
+ * and size, the receiver answers with how much of it it already has and only
+ * the rest is sent (with sendfile, received with splice) so copies resume
+ * after the connection is lost or either Pi reboots. Each side keeps a
+ * manifest of the files the other has confirmed and the files received.
+ */
+
+#ifndef REPLICATION_H
+#define REPLICATION_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <map>
+#include <fstream>
+
+#include "Ethernet.h"
+#include "logger/logger.h"
+
+/**
+ * A directory whose completed files are copied to the other Pi
+ */
+struct ReplicaSource {
+	std::string dir; // e.g. "Docs/Video"
+	std::string name; // Name on the other Pi, e.g. "Video"
+};
+
+/**
+ * Sizes of files known to be complete on the other side (or here). Kept in a
+ * text file with one "size name" line per update, the last line for a name
+ * is the one that counts.
+ */
+class Manifest {
+public:
+
+	Manifest() {
+	}
+
+	/**
+	 * Read the manifest (if it exists) and open it for adding to
+	 * @param path: Manifest file
+	 */
+	void load(const std::string &path);
+
+	/**
+	 * @return Size recorded for a file, 0 if it is not in the manifest
+	 */
+	uint64_t size(const std::string &name) const;
+
+	/**
+	 * Record the size of a file now complete
+	 */
+	void record(const std::string &name, uint64_t size);
+
+	int count() const {
+		return _files.size();
+	}
+
+private:
+	std::map<std::string, uint64_t> _files;
+	std::ofstream _outf;
+};
+
+/**
+ * Both ends of the replication protocol on a connected (blocking) socket.
+ * All functions throw EthernetException if the connection fails.
+ */
+class FileSync {
+public:
+
+	/**
+	 * @param fd: Connected socket
+	 * @param Log: Logger for the process
+	 * @param sources: Directories to send files from
+	 * @param dest: Directory for files received
+	 * @param settle_ms: Time since a file last changed before it counts as
+	 * complete
+	 * @param max_rate: Most bytes sent per second, 0 for no limit
+	 */
+	FileSync(int fd, Logger &Log, const std::vector<ReplicaSource> &sources,
+			const std::string &dest, int settle_ms = 10000, uint64_t max_rate = 0);
+
+	/**
+	 * Send every complete file the other side does not have all of
+	 * @return Number of files sent
+	 */
+	int send_files();
+
+	/**
+	 * Ask the other side to send its files
+	 */
+	void request();
+
+	/**
+	 * Receive files until the other side has sent all of its files
+	 * @return Number of files received
+	 */
+	int receive_files();
+
+	/**
+	 * Answer the other side (for the server) until the connection is lost
+	 */
+	void serve();
+
+	/**
+	 * @return Bytes of file data sent since the start
+	 */
+	uint64_t bytes_sent() const {
+		return _bytes_sent;
+	}
+
+	/**
+	 * @return Bytes of file data received since the start
+	 */
+	uint64_t bytes_received() const {
+		return _bytes_received;
+	}
+
+private:
+	struct Header {
+		uint32_t type;
+		uint32_t name_len;
+		uint64_t size;
+	};
+
+	void read_all(void *buf, size_t len);
+	void write_all(const void *buf, size_t len);
+	void send_file(const std::string &path, const std::string &name, uint64_t size);
+	void receive_file(const Header &h);
+
+	int _fd;
+	Logger &Log;
+	std::vector<ReplicaSource> _sources;
+	std::string _dest;
+	int _settle_ms;
+	uint64_t _max_rate;
+	Manifest _sent; // Files the other side has confirmed
+	Manifest _received;
+	uint64_t _bytes_sent = 0;
+	uint64_t _bytes_received = 0;
+};
+
+/**
+ * Lower the priority of the calling process so its disk and CPU use only
+ * take what the rest of the experiment leaves
+ */
+void lower_priority();
+
+/**
+ * Pi 2's end: accepts Pi 1 and answers it from a child process
+ */
+class ReplicationServer : public Server {
+public:
+
+	/**
+	 * @param port: Port for the replication connection
+	 * @param sources: Directories to send files from
+	 * @param dest: Directory for files received
+	 * @param max_rate: Most bytes sent per second, 0 for no limit
+	 */
+	ReplicationServer(const int port, const std::vector<ReplicaSource> &sources,
+			const std::string &dest, uint64_t max_rate = 4000000)
+	: Server(port, "/Docs/Logs/replication_server"), _sources(sources), _dest(dest),
+	_max_rate(max_rate) {
+	}
+
+	/**
+	 * Set up the server and start the child process
+	 */
+	void run();
+
+	bool status();
+
+	/**
+	 * Stop the child process
+	 */
+	void end();
+
+private:
+	std::vector<ReplicaSource> _sources;
+	std::string _dest;
+	uint64_t _max_rate;
+};
+
+/**
+ * Pi 1's end: keeps connecting to Pi 2 and exchanging files from a child
+ * process
+ */
+class ReplicationClient : public Client {
+public:
+
+	/**
+	 * @param port: Port for the replication connection
+	 * @param host_name: Name or IP address of Pi 2
+	 * @param sources: Directories to send files from
+	 * @param dest: Directory for files received
+	 * @param scan_ms: Time between looking for new files
+	 * @param max_rate: Most bytes sent per second, 0 for no limit
+	 */
+	ReplicationClient(const int port, const std::string host_name,
+			const std::vector<ReplicaSource> &sources, const std::string &dest,
+			int scan_ms = 5000, uint64_t max_rate = 4000000)
+	: Client(port, host_name, "/Docs/Logs/replication_client"), _sources(sources),
+	_dest(dest), _scan_ms(scan_ms), _max_rate(max_rate) {
+	}
+
+	/**
+	 * Start the child process
+	 */
+	void run();
+
+	bool status();
+
+	/**
+	 * Stop the child process
+	 */
+	void end();
+
+private:
+	std::vector<ReplicaSource> _sources;
+	std::string _dest;
+	int _scan_ms;
+	uint64_t _max_rate;
+};
+
+#endif /* REPLICATION_H */
@@ -4,6 +4,7 @@
 
 #include "UART/UART.h"
 #include "comms/pipes.h"
+#include "comms/shm_pipe.h"
 #include "comms/packet.h"
 #include "timing/Timer.h"
 
@@ -17,7 +18,7 @@
 int main() {
 	system("mkdir /Docs/Logs");
 	ImP IMP(230400);
-	comms::Pipe pipes = IMP.startDataCollection("test");
+	comms::ShmPipe pipes = IMP.startDataCollection("test");
 	int n;
 	comms::Packet p;
 	while (0) {
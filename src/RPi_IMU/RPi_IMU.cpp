@@ -20,6 +20,7 @@
 
 // For communication and data packing
 #include "comms/pipes.h"
+#include "comms/shm_pipe.h"
 #include "comms/transceiver.h"
 #include "comms/packet.h"
 #include "comms/protocol.h"
@@ -305,19 +306,19 @@ void RPi_IMU::resetRegisters() {
 	writeReg(MAG_ADDRESS, CTRL_REG4_M, 0);
 }
 
-comms::Pipe RPi_IMU::startDataCollection(char* filename) {
+comms::ShmPipe RPi_IMU::startDataCollection(char* filename) {
 	Log("INFO") << "Starting data collection";
 	try {
-		_pipes = comms::Pipe();
+		_pipes = comms::ShmPipe();
 		Log("INFO") << "Forking processes...";
 		if ((_pid = _pipes.Fork()) == 0) {
 			// This is the child process and controls data collection
 			Log.child_log();
-			comms::Packet p1;
-			comms::Packet p2;
+			comms::Packet p[2]; // Both packets for a sample go in one write
 			comms::byte1_t data[22];
 			int intv = 100;
 			Timer measurement_time;
+			uint32_t sample = 0; // Sent as the packet index, wraps every 65536
 			std::string measurement_start = measurement_time.str_datetime();
 			// Infinite loop for taking measurements
 			Log("INFO") << "Starting loop for taking measurements";
@@ -350,17 +351,18 @@ comms::Pipe RPi_IMU::startDataCollection(char* filename) {
 							data[16] << "," << data[17] << "," <<
 							data[18] << "," << data[19] << "," <<
 							data[20] << "," << data[21] << std::endl;
-					comms::byte1_t id1 = ID_DATA1;
-					comms::byte1_t id2 = ID_DATA2;
-					comms::byte2_t index = (5 * j) + i;
-					comms::Protocol::pack(p1, id1, index, data);
-					comms::Protocol::pack(p2, id2, index, data + 12);
-					Log("DATA (IMU)") << p1;
-					Log("DATA (IMU)") << p2;
-
-					if (_pipes.binwrite(&p1, sizeof (p1)) < 0)
-						throw -2;
-					if (_pipes.binwrite(&p2, sizeof (p2)) < 0)
+					comms::ImuAccGyr acc_gyr;
+					comms::ImuMagTime mag_time;
+					memcpy(&acc_gyr, data, sizeof (acc_gyr));
+					memcpy(mag_time.mag, data + 12, sizeof (mag_time.mag));
+					mag_time.set_time(time);
+					comms::byte2_t index = sample++;
+					comms::Protocol::pack<ID_DATA1>(p[0], index, acc_gyr);
+					comms::Protocol::pack<ID_DATA2>(p[1], index, mag_time);
+					Log("DATA (IMU)") << p[0];
+					Log("DATA (IMU)") << p[1];
+
+					if (_pipes.binwriteBatch(p, 2) < 0)
 						throw -2;
 					Log("INFO") << "Packets sent to main process";
 					while (tmr.elapsed() < intv)
@@ -19,6 +19,7 @@
 
 #include "LSM9DS1.h"   //Stores addresses for the BerryIMU
 #include "comms/pipes.h"
+#include "comms/shm_pipe.h"
 #include "comms/packet.h"
 
 #include "logger/logger.h"
@@ -30,7 +31,7 @@ class RPi_IMU {
 	int i2c_file = 0;
 	int _pid; //Id of the background process
 	bool _bus_active = false;
-	comms::Pipe _pipes;
+	comms::ShmPipe _pipes;
 	Logger Log;
 
 public:
@@ -146,7 +147,7 @@ public:
 	 */
 	void readRegisters(comms::byte1_t *data);
 
-	comms::Pipe startDataCollection(char* filename);
+	comms::ShmPipe startDataCollection(char* filename);
 
 	bool status();
 
@@ -11,24 +11,31 @@
 #include <stdio.h>
 #include <unistd.h>  //Used for UART
 #include <fcntl.h>  //Used for UART
-#include <termios.h> //Used for UART
 // For multiprocessing
 #include <signal.h>
 #include <sys/wait.h>
 #include <stdlib.h>
 
-#include <fstream>
 #include <string>
 #include <sstream>
-#include <iomanip>
 
 #include <math.h>
+#include <poll.h>
+#include <errno.h>
+#include <cstring>
+#include <algorithm>
 
 #include "UART.h"
+#include "baud.h"
+#include "imp_pipeline.h"
+#include "imp_file.h"
 #include "comms/packet.h"
 #include "comms/pipes.h"
+#include "comms/shm_pipe.h"
 #include "comms/transceiver.h"
 #include "comms/protocol.h"
+#include "comms/reactor.h"
+#include "comms/tx_scheduler.h"
 
 #include "timing/timer.h"
 
@@ -37,43 +44,14 @@
 
 void UART::setupUART() {
 	//Open the UART in non-blocking read/write mode
-	uart_filestream = open("/dev/serial0", O_RDWR | O_NOCTTY);
+	uart_filestream = open(_device.c_str(), O_RDWR | O_NOCTTY);
 	if (uart_filestream == -1) {
 		//throw UARTException("ERROR opening serial port");
 		return;
 	}
-	speed_t f_baud;
-	switch (_baudrate) {
-		case 9600:
-			f_baud = B9600;
-			break;
-		case 19200:
-			f_baud = B19200;
-			break;
-		case 38400:
-			f_baud = B38400;
-			break;
-		case 57600:
-			f_baud = B57600;
-			break;
-		case 115200:
-			f_baud = B115200;
-			break;
-		case 230400:
-			f_baud = B230400;
-			break;
-		default:
-			throw UARTException("ERROR baud rate not defined");
-	}
-	//Configure the UART
-	struct termios options;
-	tcgetattr(uart_filestream, &options);
-	options.c_cflag = f_baud | CS8 | CLOCAL | CREAD;
-	options.c_iflag = IGNPAR;
-	options.c_oflag = 0;
-	options.c_lflag = 0;
-	tcflush(uart_filestream, TCIFLUSH);
-	tcsetattr(uart_filestream, TCSANOW, &options);
+	// Any rate, e.g. 921600 for the ImP (see baud.h)
+	if (setup_serial(uart_filestream, _baudrate) < 0)
+		throw UARTException("ERROR unable to set baud rate");
 }
 
 UART::~UART() {
@@ -82,31 +60,98 @@ UART::~UART() {
 
 void RXSM::buffer() {
 	try {
-		_pipes = comms::Pipe();
+		_pipes = comms::ShmPipe();
 		if ((_pid = _pipes.Fork()) == 0) {
 			// This is the child process
 			Log.child_log();
-			comms::Packet p;
-			int n;
+			comms::Reactor reactor;
+			comms::TxScheduler scheduler(_baudrate);
+			comms::Packet to_rxsm[32];
+			comms::Packet from_rxsm[32];
+			bool writable = true;
+			unsigned long reported = 0;
+			Timer report_tmr;
+			// Queue everything from the main process for the RXSM
+			auto fill = [&]() {
+				int n;
+				while ((n = _pipes.binread(to_rxsm, sizeof (to_rxsm))) > 0) {
+					int count = n / sizeof (comms::Packet);
+					for (int i = 0; i < count; i++)
+						scheduler.push(to_rxsm[i]);
+				}
+				if (n < 0)
+					throw n;
+			};
+			reactor.add(_pipes.getReadfd(), fill);
+			fill(); // Anything sent before the reactor was waiting
+			// And everything from the RXSM to the main process
+			if (uart_filestream >= 0) {
+				reactor.add(uart_filestream, [&]() {
+					int n;
+					while ((n = comms::Transceiver::recvPackets(from_rxsm, 32)) > 0) {
+						for (int i = 0; i < n; i++)
+							Log("RECEIVED") << from_rxsm[i];
+						_pipes.binwriteBatch(from_rxsm, n);
+					}
+				}, [&]() {
+					writable = true;
+					reactor.want_write(uart_filestream, false);
+				});
+			} else {
+				Log("ERROR") << "UART not open, nothing will be received from RXSM";
+			}
 			while (1) {
-				n = _pipes.binread(&p, sizeof (p));
-				if (n > 0)
-					sendPacket(p);
-
-				n = recvPacket(p);
-				if (n > 0)
-					_pipes.binwrite(&p, sizeof (p));
-				Timer::sleep_ms(1);
+				// Send as much as the baud rate allows in priority order
+				if (writable) {
+					int n = scheduler.next(to_rxsm, 32, comms::TxScheduler::now());
+					if (n > 0) {
+						int sent = comms::Transceiver::sendPackets(to_rxsm, n);
+						if (sent < 0) {
+							Log("ERROR") << "Packets not sent\n\t" << std::strerror(errno);
+						} else {
+							for (int i = 0; i < sent; i++)
+								Log("SENT") << to_rxsm[i];
+							if (sent < n) {
+								// Wait for the UART to drain before trying again
+								scheduler.requeue(to_rxsm + sent, n - sent);
+								writable = false;
+								reactor.want_write(uart_filestream, true);
+							}
+						}
+					}
+				}
+				unsigned long dropped = scheduler.dropped(comms::TxScheduler::CONTROL) +
+						scheduler.dropped(comms::TxScheduler::STATUS) +
+						scheduler.dropped(comms::TxScheduler::BULK);
+				if (dropped != reported && report_tmr.elapsed() > 5000) {
+					Log("ERROR") << "Downlink queues full, dropped (control/status/bulk): " <<
+							scheduler.dropped(comms::TxScheduler::CONTROL) << "/" <<
+							scheduler.dropped(comms::TxScheduler::STATUS) << "/" <<
+							scheduler.dropped(comms::TxScheduler::BULK);
+					reported = dropped;
+					report_tmr.reset();
+				}
+				reactor.run_once(writable ? scheduler.wait_ms(comms::TxScheduler::now()) : -1);
 			}
 		} else {
 			// This is the parent process
 			return;
 		}
+	} catch (int e) {
+		Log("INFO") << "Pipe closed by main process (" << e << ")";
+		Log("INFO") << "Shutting down communication with RXSM";
+		_pipes.close_pipes();
+		exit(0);
 	} catch (comms::PipeException e) {
 		Log("FATAL") << "Failed to read or write to pipe\n\t" << e.what();
 		Log("INFO") << "Shutting down communication with RXSM";
 		_pipes.close_pipes();
 		exit(-1);
+	} catch (comms::ReactorException e) {
+		Log("FATAL") << "Problem with event loop\n\t" << e.what();
+		Log("INFO") << "Shutting down communication with RXSM";
+		_pipes.close_pipes();
+		exit(-1);
 	} catch (...) {
 		Log("FATAL") << "Unknown exception with RXSM\n\t" << std::strerror(errno);
 		Log("INFO") << "Shutting down communication with RXSM";
@@ -129,7 +174,9 @@ int RXSM::sendPacket(comms::Packet &p) {
 
 	if (n > 0)
 		Log("SENT") << p;
-	else if (n < 0)
+	else if (n == 0)
+		Log("ERROR") << "Pipe to RXSM process full, packet dropped";
+	else
 		Log("ERROR") << "Packet not sent\n\t" << std::strerror(errno);
 	return n;
 }
@@ -141,29 +188,29 @@ int RXSM::recvPacket(comms::Packet &p) {
 	else
 		n = comms::Transceiver::recvPacket(&p);
 
-	if (n > 0)
+	if (n > 0) {
 		Log("RECEIVED") << p;
-	else if (n < 0)
+		int gap = _sequence.add(p);
+		if (gap > 0)
+			Log("ERROR") << gap << " packets missing from the ground\n\t" << _sequence;
+		else if (gap == -1)
+			Log("ERROR") << "Duplicate packet from the ground";
+		else if (gap == -2)
+			Log("ERROR") << "Packet from the ground out of order";
+	} else if (n < 0) {
 		Log("ERROR") << "Problem getting data\n\t" << std::strerror(errno);
+	}
 	return n;
 }
 
 int RXSM::sendMsg(std::string msg) {
 	msg.insert(0, "Pi1: ");
 	msg += "\n";
-	int n = msg.length();
-	int mesg_num = ceil(n / (float) 15);
-	char *buf = new char [17];
 	int sent = 0;
 	comms::Packet p;
-	for (int i = 0; i < n; i += 16) {
-		bzero(buf, 16);
-		std::string data = msg.substr(i, 16);
-		strcpy(buf, data.c_str());
-		int msg_index = (_index++ << 8) | (--mesg_num);
-		comms::Protocol::pack(p, ID_MSG1, msg_index, buf);
+	_messages.begin(msg.data(), msg.length());
+	while (_messages.next(p))
 		sent += sendPacket(p);
-	}
 	return sent;
 }
 
@@ -183,94 +230,202 @@ bool RXSM::status() {
 		return false;
 }
 
-comms::Pipe ImP::startDataCollection(const std::string filename) {
+// Shortest primary frame: the 26 bytes passed on in ID_DATA3/4 and the zero
+#define IMP_PRIMARY_MIN 27
+// Longest secondary frame read in one go, longer ones are saved in pieces
+#define FRAME_MAX 4096
+
+FrameReader::FrameReader(int fd) : _fd(fd) {
+	fcntl(_fd, F_SETFL, fcntl(_fd, F_GETFL) | O_NONBLOCK);
+}
+
+int FrameReader::next(comms::byte1_t *frame, int max, int timeout_ms, int min_bytes) {
+	Timer tmr;
+	if (max > BUF_SIZE)
+		max = BUF_SIZE;
+	int scan = _head;
+	while (1) {
+		// A whole frame (or as much as fits) already here?
+		int end = -1;
+		for (; scan < _tail; scan++) {
+			if (_buf[scan] == 0 || scan - _head + 1 >= max) {
+				end = scan;
+				break;
+			}
+		}
+		if (end >= 0) {
+			int len = end - _head + 1;
+			memcpy(frame, _buf + _head, len);
+			_head = end + 1;
+			return len;
+		}
+		// Make room for more
+		if (_head > 0) {
+			memmove(_buf, _buf + _head, _tail - _head);
+			_tail -= _head;
+			scan -= _head;
+			_head = 0;
+		}
+		int left = timeout_ms - tmr.elapsed();
+		bool last = left <= 0; // Still take anything already waiting
+		int wakeup = std::min(std::max(min_bytes - _tail, 1), 255);
+		if (wakeup != _wakeup && set_wakeup_bytes(_fd, wakeup) == 0)
+			_wakeup = wakeup;
+		struct pollfd fds[1];
+		fds[0].fd = _fd;
+		fds[0].events = POLLIN;
+		if (poll(fds, 1, last ? 0 : left) < 0)
+			return (errno == EINTR) ? 0 : -1; // A signal ends the wait early
+		// Even after a timeout, take anything short of the wake up level
+		int n = read(_fd, _buf + _tail, BUF_SIZE - _tail);
+		_reads++;
+		if (n > 0)
+			_tail += n;
+		else if (n < 0 && errno != EAGAIN && errno != EINTR)
+			return -1;
+		else if (last)
+			return 0;
+	}
+}
+
+// Set when stopDataCollection() sends SIGTERM, so the ImP process can close
+// its data file before it exits
+static volatile sig_atomic_t imp_stop = 0;
+
+static void on_imp_stop(int) {
+	imp_stop = 1;
+}
+
+comms::ShmPipe ImP::startDataCollection(const std::string filename) {
 	/*
 	 * Sends request to the ImP to begin sending data. Returns the file stream
 	 * to the main program and continually writes the data to this stream.
 	 */
 	Log("INFO") << "Starting ImP and IMU data collection";
 	try {
-		_pipes = comms::Pipe();
+		_pipes = comms::ShmPipe();
 		if ((_pid = _pipes.Fork()) == 0) {
 			// This is the child process
 			Log.child_log();
-			// Infinite loop for data collection
+			// No SA_RESTART, so SIGTERM also ends the wait for the ImP
+			struct sigaction stop_action;
+			memset(&stop_action, 0, sizeof (stop_action));
+			stop_action.sa_handler = on_imp_stop;
+			sigaction(SIGTERM, &stop_action, NULL);
+			// Loop for data collection until stopped
 			comms::Transceiver ImP_comms(uart_filestream);
-			// Send initial start command
-			ImP_comms.sendBytes("C", 1);
-			Log("DATA (SENT") << "C";
+			FrameReader reader(uart_filestream);
+			ImPPipeline pipeline(_outstanding, _interval_ms);
 			std::string measurement_start = Timer::str_datetime();
 			Timer m_tmr; // Gives timing of all measurements
-			int32_t m_time = 0;
-			int err;
-			for (int j = 0;; j++) {
-				std::ofstream outf;
-				std::stringstream unique_file;
-				unique_file << filename << "_" << measurement_start << "_"
-						<< std::setfill('0') << std::setw(4) << j << ".txt";
-				Log("INFO") << "Starting new data file \"" << unique_file.str() << "\"";
-				outf.open(unique_file.str());
-				// Take five measurements then change the file
-				int intv = 200;
-				for (int i = 0; i < 5; i++) {
-					Timer tmr;
-					char buf[256];
-					int buf_ind = 0;
-					while ((buf_ind < 255) && (tmr.elapsed() < 2*intv)) {
-						if (ImP_comms.recvBytes(buf + buf_ind, 1)) {
-							if (buf[buf_ind-1] == 0)
-								break;
-							buf_ind++;
-						} else {
-							Timer::sleep_ms(1);
-						}
-					}
-					int stuffed = buf[0];
-					int carry;
-					while ((stuffed < 255) && (carry = buf[stuffed]) != 0) {
-						buf[stuffed] = 0;
-						stuffed += carry;
-					}
-					for (int k = 0; k < buf_ind; k++) {
-						outf << (int)buf[k] << " ";
-					}
-					Log("INFO") << "Recevied primary data";
-					comms::Packet p1;
-					comms::Packet p2;
-					comms::Protocol::pack(p1, ID_DATA3, i+5*j, buf);
-					comms::Protocol::pack(p2, ID_DATA4, i+5*j, (buf + 12));
-					Log("DATA(ImP)") << p1;
-					Log("DATA(ImP)") << p2;
-					_pipes.binwrite(&p1, sizeof(comms::Packet));
-					_pipes.binwrite(&p2, sizeof(comms::Packet));
-					Log("INFO") << "Data sent to main process";
-
-					//Now handle all the other numbers coming in
-					int total = 0;
-					comms::byte1_t char_buf = 'a';
-					while (tmr.elapsed() < 2*intv) {
-						if (ImP_comms.recvBytes(&char_buf, 1)) {
-							outf << (int)char_buf << " ";
-							total++;
-						} else {
-							Timer::sleep_ms(50);
-							Log("INFO") << "No data-" << tmr.elapsed();
-						}
-						if (char_buf == 0) {
-							outf << std::endl;
-							break;
+			Timer report_tmr;
+			uint32_t frame = 0; // Sent as the packet index, wraps every 65536
+			bool started = false;
+			// "C" starts the ImP, then "N" asks for each measurement
+			auto request = [&]() {
+				for (int n = pipeline.due(m_tmr.elapsed()); n > 0; n--) {
+					const char *cmd = started ? "N" : "C";
+					ImP_comms.sendBytes(cmd, 1);
+					Log("DATA (SENT)") << cmd;
+					pipeline.requested(m_tmr.elapsed());
+					started = true;
+				}
+			};
+			// Frames are saved as received, see imp_file.h
+			ImpFile data_file;
+			if (data_file.open(filename + "_" + measurement_start) < 0)
+				Log("ERROR") << "Unable to open ImP data file\n\t" << std::strerror(errno);
+			else
+				Log("INFO") << "Starting new data file \"" << data_file.path() << "\"";
+			uint32_t segment = data_file.segment();
+			unsigned long unsaved = 0;
+			auto save = [&](comms::byte1_t kind, const comms::byte1_t *frame, int len) {
+				if (data_file.add(kind, frame, len) < 0) {
+					unsaved++;
+				} else if (data_file.segment() != segment) {
+					segment = data_file.segment();
+					Log("INFO") << "Starting new data file \"" << data_file.path() << "\"";
+				}
+			};
+			comms::byte1_t buf[FRAME_MAX];
+			bool whole = true; // Last frame read ended with its zero
+			while (!imp_stop) {
+				request();
+				int wait = pipeline.wait_ms(m_tmr.elapsed());
+				bool primary = whole && pipeline.expecting() == ImPPipeline::PRIMARY;
+				int len = reader.next(buf, sizeof (buf), (wait < 0) ? 1000 : wait,
+						primary ? IMP_PRIMARY_MIN : 1);
+				if (len < 0)
+					throw UARTException("ERROR reading from ImP");
+				if (len == 0) {
+					data_file.flush();
+					if (pipeline.timed_out(m_tmr.elapsed()))
+						Log("ERROR") << "No answer from ImP, requesting again (" <<
+								pipeline.timeouts() << " times so far)";
+					continue;
+				}
+				bool first_piece = whole;
+				whole = (buf[len - 1] == 0);
+				comms::byte1_t kind = (pipeline.expecting() == ImPPipeline::PRIMARY) ?
+						IMP_FRAME_PRIMARY : IMP_FRAME_SECONDARY;
+				if (!whole) {
+					// Part of a long frame, save it as it comes
+					save(kind | IMP_FRAME_PIECE, buf, len);
+					continue;
+				}
+				save(kind, buf, len);
+				if (pipeline.received(m_tmr.elapsed()) == ImPPipeline::PRIMARY) {
+					// Keep the ImP busy while this measurement is dealt with
+					request();
+					if (len < IMP_PRIMARY_MIN)
+						memset(buf + len, 0, IMP_PRIMARY_MIN - len);
+					if (first_piece) {
+						int stuffed = buf[0];
+						int carry;
+						while ((stuffed < len) && (carry = buf[stuffed]) != 0) {
+							buf[stuffed] = 0;
+							stuffed += carry;
 						}
 					}
-					Log("INFO") << "Received secondary data (" << total << ")";
-					ImP_comms.sendBytes("N",1);
-					while (tmr.elapsed() < intv)
-						Timer::sleep_ms(1);
+					comms::Packet p[2];
+					comms::ImpData1 first;
+					comms::ImpData2 second;
+					memcpy(first.frame, buf, sizeof (first.frame));
+					memcpy(second.frame, buf + 12, sizeof (second.frame));
+					comms::Protocol::pack<ID_DATA3>(p[0], frame, first);
+					comms::Protocol::pack<ID_DATA4>(p[1], frame, second);
+					frame++;
+					Log("DATA(ImP)") << p[0];
+					Log("DATA(ImP)") << p[1];
+					_pipes.binwriteBatch(p, 2);
+				} else {
+					// Measurement complete, one write for both frames
+					data_file.flush();
+				}
+				if (report_tmr.elapsed() >= 10000) {
+					Log("INFO") << "ImP measurements: " << pipeline.completed() << " at " <<
+							pipeline.rate_hz(m_tmr.elapsed()) << " Hz, request to answer " <<
+							pipeline.latency_ms() << " ms on average, " << pipeline.in_flight() <<
+							" requests outstanding, " << pipeline.timeouts() << " timeouts, " <<
+							data_file.records() << " frames saved, " << unsaved << " not saved";
+					report_tmr.reset();
 				}
-				outf.close();
 			}
+			// Cut the last segment down to the frames in it
+			data_file.close();
+			Log("INFO") << "ImP process stopped, " << data_file.records() << " frames saved";
+			_pipes.close_pipes();
+			close(uart_filestream);
+			exit(0);
 		} else {
 			return _pipes;
 		}
+	} catch (UARTException e) {
+		Log("FATAL") << e.what();
+		Log("INFO") << "Ending the process";
+		_pipes.close_pipes();
+		close(uart_filestream);
+		exit(-1);
 	} catch (int e) {
 		Log("FATAL") << "Unable to read/write to pipes(" << e << ")\n\t" << std::strerror(errno);
 		Log("INFO") << "Ending the process";
@@ -11,7 +11,10 @@
 #include <string>
 #include <error.h>
 #include "comms/pipes.h"
+#include "comms/shm_pipe.h"
 #include "comms/transceiver.h"
+#include "comms/message.h"
+#include "comms/sequence.h"
 
 #include "logger/logger.h"
 
@@ -21,14 +24,19 @@
 class UART {
 protected:
 	int uart_filestream;
-
-private:
 	int _baudrate;
+	std::string _device;
 
 public:
 
-	UART(int baudrate) {
+	/**
+	 * @param baudrate: Any rate the UART can get close to (see baud.h)
+	 * @param device: Serial port, e.g. a pty from tools/rxsm_sim or
+	 * tools/imp_sim to run without the hardware
+	 */
+	UART(int baudrate, const std::string &device = "/dev/serial0") {
 		_baudrate = baudrate;
+		_device = device;
 		setupUART();
 	}
 
@@ -42,13 +50,15 @@ public:
 
 class RXSM : public UART, public comms::Transceiver {
 	Logger Log;
-	int _index = 0;
-	comms::Pipe _pipes;
+	comms::MsgFragmenter _messages{ID_MSG1};
+	comms::SequenceTracker _sequence; // Packets received from the ground
+	comms::ShmPipe _pipes;
 	int _pid = 0;
 
 public:
 
-	RXSM(int baudrate = 38400) : UART(baudrate), comms::Transceiver(uart_filestream), Log("/Docs/Logs/RXSM") {
+	RXSM(int baudrate = 38400, const std::string &device = "/dev/serial0")
+	: UART(baudrate, device), comms::Transceiver(uart_filestream), Log("/Docs/Logs/RXSM") {
 		Log.start_log();
 		Log("INFO") << "Creating RXSM object";
 		return;
@@ -60,6 +70,10 @@ public:
 
 	int recvPacket(comms::Packet &p);
 
+	const comms::SequenceTracker &sequence() const {
+		return _sequence;
+	}
+
 	bool status();
 
 	~RXSM() {
@@ -72,14 +86,72 @@ public:
 
 };
 
+/**
+ * Reads zero terminated frames (as the ImP sends) from a serial port in as
+ * few read() calls as possible. Waits in poll() with a deadline and has the
+ * kernel hold off waking it until most of a frame has arrived, so there are
+ * no sleeps and no reads of single bytes.
+ */
+class FrameReader {
+public:
+
+	/**
+	 * @param fd: Serial port, made non-blocking
+	 */
+	FrameReader(int fd);
+
+	/**
+	 * Get the next frame
+	 * @param frame: Set to the frame, including the zero at the end. A frame
+	 * longer than max is returned in pieces.
+	 * @param max: Size of frame
+	 * @param timeout_ms: Longest time to wait
+	 * @param min_bytes: Shortest the frame can be, the kernel only wakes us
+	 * once this much has arrived
+	 * @return Length of the frame, 0 if the timeout passed or a signal
+	 * arrived first (anything received so far is kept for next time), -1 on
+	 * error
+	 */
+	int next(comms::byte1_t *frame, int max, int timeout_ms, int min_bytes = 1);
+
+	/**
+	 * @return Number of read() calls made
+	 */
+	unsigned long reads() const {
+		return _reads;
+	}
+
+private:
+	static const int BUF_SIZE = 4096;
+	int _fd;
+	comms::byte1_t _buf[BUF_SIZE];
+	int _head = 0; // Start of the next frame
+	int _tail = 0; // End of the data received
+	int _wakeup = 0; // VMIN set on the port
+	unsigned long _reads = 0;
+};
+
 class ImP : public UART {
 	Logger Log;
-	comms::Pipe _pipes;
+	comms::ShmPipe _pipes;
 	int _pid;
+	int _outstanding;
+	int _interval_ms;
 
 public:
 
-	ImP(int baudrate = 38400) : UART(baudrate), Log("/Docs/Logs/ImP") {
+	/**
+	 * @param baudrate: Baud rate of the ImP
+	 * @param outstanding: Most requests sent to the ImP before it answers
+	 * (see imp_pipeline.h)
+	 * @param interval_ms: Shortest time between measurements, 0 for as fast
+	 * as the ImP answers
+	 * @param device: Serial port the ImP is on
+	 */
+	ImP(int baudrate = 38400, int outstanding = 1, int interval_ms = 0,
+			const std::string &device = "/dev/serial0")
+	: UART(baudrate, device), Log("/Docs/Logs/ImP"), _outstanding(outstanding),
+	_interval_ms(interval_ms) {
 		Log.start_log();
 		return;
 	}
@@ -88,10 +160,11 @@ public:
 	 * Collect and save data from the ImP. Returned pipe receives all data from
 	 * the ImP as well.
 	 *
-	 * @param filename: Place to save data
+	 * @param filename: Place to save data, segments are named
+	 * <filename>_<date>_0000.imp and so on (see imp_file.h)
 	 * @return Pipe for sending and receiving data.
 	 */
-	comms::Pipe startDataCollection(const std::string filename);
+	comms::ShmPipe startDataCollection(const std::string filename);
 
 	bool status();
 
@@ -0,0 +1,43 @@
+/**
+ * REXUS PIOneERS - Pi_1
+ * baud.cpp
+ * Purpose: Implementation of setting up a serial port at any baud rate
+ */
+
+#include <sys/ioctl.h>
+#include <asm/termbits.h> // termios2, not compatible with <termios.h>
+
+#include "baud.h"
+
+int setup_serial(int fd, int baudrate) {
+	if (baudrate <= 0)
+		return -1;
+	struct termios2 options;
+	if (ioctl(fd, TCGETS2, &options) < 0)
+		return -1;
+	options.c_cflag = BOTHER | CS8 | CLOCAL | CREAD;
+	options.c_iflag = IGNPAR;
+	options.c_oflag = 0;
+	options.c_lflag = 0;
+	options.c_ispeed = baudrate;
+	options.c_ospeed = baudrate;
+	if (ioctl(fd, TCFLSH, TCIFLUSH) < 0)
+		return -1;
+	if (ioctl(fd, TCSETS2, &options) < 0)
+		return -1;
+	// The driver picks the nearest rate its clock allows
+	if (ioctl(fd, TCGETS2, &options) < 0)
+		return -1;
+	return options.c_ospeed;
+}
+
+int set_wakeup_bytes(int fd, int bytes) {
+	if (bytes < 1 || bytes > 255)
+		return -1;
+	struct termios2 options;
+	if (ioctl(fd, TCGETS2, &options) < 0)
+		return -1;
+	options.c_cc[VMIN] = bytes;
+	options.c_cc[VTIME] = 0; // poll() ignores VMIN otherwise
+	return ioctl(fd, TCSETS2, &options) < 0 ? -1 : 0;
+}
@@ -0,0 +1,36 @@
+/**
+ * REXUS PIOneERS - Pi_1
+ * baud.h
+ * Purpose: Function definitions for setting up a serial port at any baud
+ *			rate, not just the ones with a Bxxx constant (e.g. 460800, 921600
+ *			or 1000000 for the ImP).
+ *
+ * Uses termios2 with BOTHER, which needs the kernel's own termios headers.
+ * These clash with <termios.h> so this is a translation unit of its own.
+ */
+
+#ifndef BAUD_H
+#define BAUD_H
+
+/**
+ * Put a serial port in raw 8N1 mode (no flow control, no echo, no line
+ * editing) at the baud rate given and throw away anything already received
+ *
+ * @param fd: Open serial port (or pty)
+ * @param baudrate: Bits per second, any value the UART can get close to
+ * @return Baud rate the driver reports it is using, -1 on failure
+ */
+int setup_serial(int fd, int baudrate);
+
+/**
+ * Set how many bytes must be waiting before poll() reports a serial port
+ * readable (VMIN, with VTIME 0), so a frame can be picked up with one
+ * wake up and one read() instead of a byte at a time
+ *
+ * @param fd: Serial port set up by setup_serial()
+ * @param bytes: 1 to 255
+ * @return 0 = success, -1 on failure
+ */
+int set_wakeup_bytes(int fd, int bytes);
+
+#endif /* BAUD_H */
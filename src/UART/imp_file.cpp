@@ -0,0 +1,226 @@
+/**
+ * REXUS PIOneERS - Pi_1
+ * imp_file.cpp
+ * Purpose: Function implementations for the ImpFile and ImpFileReader
+ *			classes
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <string.h>
+#include <cstddef>
+
+#include "imp_file.h"
+#include "comms/protocol.h"
+
+// Bytes of records collected before they are written out
+#define IMP_FILE_BUFFER (64 * 1024)
+
+/**
+ * @param record: Header followed by the frame
+ * @return CRC for the record
+ */
+static comms::byte2_t record_crc(const comms::byte1_t *record, size_t len) {
+	size_t start = offsetof(ImpRecordHeader, length);
+	return comms::Protocol::crc16Gen(record + start, len - start, crc_poly);
+}
+
+ImpFile::ImpFile(uint32_t segment_size, uint32_t index_entries, int sync_ms)
+: _segment_size(segment_size), _index_entries(index_entries), _sync_ms(sync_ms) {
+	_data_offset = sizeof (ImpFileHeader) + index_entries * sizeof (uint32_t);
+	_buf.reserve(IMP_FILE_BUFFER);
+}
+
+int ImpFile::open(const std::string &base) {
+	close();
+	_base = base;
+	_records = 0;
+	return open_segment(0);
+}
+
+int ImpFile::open_segment(uint32_t segment) {
+	char name[16];
+	snprintf(name, sizeof (name), "_%04u.imp", segment);
+	_path = _base + name;
+	// Written under a hidden name until closed, so replication (which skips
+	// dot files) never copies a segment still being filled
+	size_t slash = _path.rfind('/');
+	size_t file = (slash == std::string::npos) ? 0 : slash + 1;
+	_part = _path.substr(0, file) + "." + _path.substr(file);
+	_segment = segment;
+	_end = _data_offset;
+	_entries = 0;
+	_first_entry = 0;
+	_buf.clear();
+	_index.clear();
+	_fd = ::open(_part.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (_fd < 0)
+		return -1;
+	// Allocate the whole segment now, the index has to read as zeros
+	if (posix_fallocate(_fd, 0, _segment_size) != 0 && ftruncate(_fd, _segment_size) != 0) {
+		discard();
+		return -1;
+	}
+	ImpFileHeader h;
+	memset(&h, 0, sizeof (h));
+	memcpy(h.magic, IMP_FILE_MAGIC, sizeof (h.magic));
+	h.version = IMP_FILE_VERSION;
+	h.header_size = sizeof (h);
+	h.start_us = Timer::now_us();
+	h.segment = segment;
+	h.index_entries = _index_entries;
+	h.data_offset = _data_offset;
+	if (pwrite(_fd, &h, sizeof (h), 0) != sizeof (h)) {
+		discard();
+		return -1;
+	}
+	_synced.reset();
+	return 0;
+}
+
+int ImpFile::add(comms::byte1_t kind, const comms::byte1_t *frame, int len) {
+	size_t size = sizeof (ImpRecordHeader) + len;
+	if (len < 1 || len > 0xFFFF || _data_offset + size > _segment_size) {
+		errno = EINVAL;
+		return -1;
+	}
+	if (_fd < 0)
+		return -1;
+	if (_end + _buf.size() + size > _segment_size || _entries == _index_entries) {
+		// Segment full, carry on in the next
+		uint32_t next = _segment + 1;
+		close();
+		if (open_segment(next) < 0)
+			return -1;
+	} else if (_buf.size() + size > IMP_FILE_BUFFER && write_out() < 0) {
+		return -1;
+	}
+	ImpRecordHeader h;
+	h.marker = IMP_RECORD_MARKER;
+	h.crc = 0;
+	h.length = len;
+	h.kind = kind;
+	h.reserved = 0;
+	h.time_us = Timer::now_us();
+	size_t at = _buf.size();
+	_buf.resize(at + size);
+	memcpy(&_buf[at], &h, sizeof (h));
+	memcpy(&_buf[at + sizeof (h)], frame, len);
+	h.crc = record_crc(&_buf[at], size);
+	memcpy(&_buf[at + offsetof(ImpRecordHeader, crc)], &h.crc, sizeof (h.crc));
+	_index.push_back(_end + at);
+	_entries++;
+	_records++;
+	return 0;
+}
+
+int ImpFile::write_out() {
+	if (_buf.empty())
+		return 0;
+	// Records first, so an index entry never points at nothing
+	size_t done = 0;
+	while (done < _buf.size()) {
+		ssize_t n = pwrite(_fd, &_buf[done], _buf.size() - done, _end + done);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			break;
+		done += n;
+	}
+	size_t index_size = _index.size() * sizeof (uint32_t);
+	off_t index_at = sizeof (ImpFileHeader) + _first_entry * sizeof (uint32_t);
+	bool failed = done < _buf.size() ||
+			pwrite(_fd, _index.data(), index_size, index_at) != (ssize_t) index_size;
+	// Drop what could not be written rather than grow forever
+	_end += _buf.size();
+	_first_entry = _entries;
+	_buf.clear();
+	_index.clear();
+	return failed ? -1 : 0;
+}
+
+int ImpFile::flush() {
+	if (_fd < 0)
+		return -1;
+	if (write_out() < 0)
+		return -1;
+	if (_sync_ms >= 0 && _synced.elapsed() >= _sync_ms) {
+		_synced.reset();
+		return fdatasync(_fd);
+	}
+	return 0;
+}
+
+void ImpFile::close() {
+	if (_fd < 0)
+		return;
+	write_out();
+	if (ftruncate(_fd, _end) == 0)
+		fdatasync(_fd);
+	::close(_fd);
+	_fd = -1;
+	rename(_part.c_str(), _path.c_str());
+}
+
+void ImpFile::discard() {
+	::close(_fd);
+	_fd = -1;
+	unlink(_part.c_str());
+}
+
+int ImpFileReader::open(const std::string &path) {
+	close();
+	_fd = ::open(path.c_str(), O_RDONLY);
+	if (_fd < 0)
+		return -1;
+	_offsets.clear();
+	_next = 0;
+	_damaged = 0;
+	if (pread(_fd, &_header, sizeof (_header), 0) != sizeof (_header) ||
+			memcmp(_header.magic, IMP_FILE_MAGIC, sizeof (_header.magic)) != 0 ||
+			_header.header_size != sizeof (_header) ||
+			_header.data_offset < sizeof (_header) + _header.index_entries * sizeof (uint32_t)) {
+		close();
+		errno = EINVAL;
+		return -1;
+	}
+	// Entries not written are 0, e.g. after the end or where a write failed
+	std::vector<uint32_t> index(_header.index_entries);
+	ssize_t n = pread(_fd, index.data(), index.size() * sizeof (uint32_t), sizeof (_header));
+	size_t entries = (n > 0) ? n / sizeof (uint32_t) : 0;
+	for (size_t i = 0; i < entries; i++)
+		if (index[i] != 0)
+			_offsets.push_back(index[i]);
+	return 0;
+}
+
+int ImpFileReader::read(size_t i, ImpRecordHeader &h, comms::byte1_t *frame) {
+	if (_fd < 0 || i >= _offsets.size())
+		return -1;
+	if (pread(_fd, &h, sizeof (h), _offsets[i]) != sizeof (h) || h.marker != IMP_RECORD_MARKER)
+		return -1;
+	std::vector<comms::byte1_t> record(sizeof (h) + h.length);
+	if (pread(_fd, record.data(), record.size(), _offsets[i]) != (ssize_t) record.size() ||
+			record_crc(record.data(), record.size()) != h.crc)
+		return -1;
+	memcpy(frame, &record[sizeof (h)], h.length);
+	return h.length;
+}
+
+int ImpFileReader::next(ImpRecordHeader &h, comms::byte1_t *frame) {
+	while (_next < _offsets.size()) {
+		int len = read(_next++, h, frame);
+		if (len >= 0)
+			return len;
+		_damaged++;
+	}
+	return 0;
+}
+
+void ImpFileReader::close() {
+	if (_fd >= 0)
+		::close(_fd);
+	_fd = -1;
+}
@@ -0,0 +1,218 @@
+/**
+ * REXUS PIOneERS - Pi_1
+ * imp_file.h
+ * Purpose: Class definitions for saving the frames received from the ImP in
+ *			binary segment files. Each frame is stored exactly as received
+ *			with the time it arrived and a checksum, so nothing has to be
+ *			formatted in the acquisition loop (see tools/imp_to_csv.cpp).
+ *
+ * Segment layout: an ImpFileHeader, an index of the file offset of every
+ * record (0 for records not written, which readers skip) and then the
+ * records, each an ImpRecordHeader followed by the frame. A segment is
+ * allocated at its full size when it is opened so writing never has to grow
+ * the file. When a segment or its index is full the next one is started,
+ * named <base>_0000.imp, <base>_0001.imp, ... At about 5 kB/s from the ImP a
+ * 4 MiB segment lasts around a quarter of an hour.
+ *
+ * Records and their index entries are collected in a buffer and written with
+ * one call each per flush; fdatasync is called at most once per sync period.
+ * A segment is written as .<name> (hidden from replication, which would
+ * otherwise copy the unwritten end) and on close the unused end is cut off
+ * and it is renamed. After a crash the hidden segment can still be read.
+ */
+
+#ifndef IMP_FILE_H
+#define IMP_FILE_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "comms/packet.h"
+#include "timing/timer.h"
+
+#define IMP_FILE_MAGIC "PIIM"
+#define IMP_FILE_VERSION 1
+#define IMP_RECORD_MARKER 0x5AA5
+
+// Kinds of frame
+#define IMP_FRAME_PRIMARY 0x01
+#define IMP_FRAME_SECONDARY 0x02
+#define IMP_FRAME_PIECE 0x80 // Set if the frame carries on in the next record
+
+#pragma pack(push, 1)
+
+struct ImpFileHeader {
+	char magic[4]; // IMP_FILE_MAGIC
+	comms::byte2_t version;
+	comms::byte2_t header_size;
+	int64_t start_us; // Unix time the segment was opened in us
+	uint32_t segment; // Number of the segment from 0
+	uint32_t index_entries; // Size of the index
+	uint32_t data_offset; // Offset of the first record
+	comms::byte1_t reserved[36];
+};
+
+struct ImpRecordHeader {
+	comms::byte2_t marker; // IMP_RECORD_MARKER
+	comms::byte2_t crc; // CRC16 of the rest of the header and the frame
+	comms::byte2_t length; // Bytes in the frame
+	comms::byte1_t kind; // IMP_FRAME_...
+	comms::byte1_t reserved;
+	int64_t time_us; // Unix time the frame arrived in us
+};
+
+#pragma pack(pop)
+
+class ImpFile {
+public:
+
+	/**
+	 * @param segment_size: Bytes allocated for each segment
+	 * @param index_entries: Most records in a segment
+	 * @param sync_ms: Least time between calls to fdatasync, -1 never
+	 */
+	ImpFile(uint32_t segment_size = 4 * 1024 * 1024, uint32_t index_entries = 32768,
+			int sync_ms = 1000);
+
+	~ImpFile() {
+		close();
+	}
+
+	/**
+	 * Start the first segment
+	 * @param base: Path of the segments without _0000.imp
+	 * @return 0 = success, -1 = failure (errno is set)
+	 */
+	int open(const std::string &base);
+
+	/**
+	 * Add a frame, starting the next segment if this one is full
+	 * @param kind: IMP_FRAME_PRIMARY or IMP_FRAME_SECONDARY, with
+	 * IMP_FRAME_PIECE for all but the last piece of a long frame
+	 * @return 0 = success, -1 if writing failed or the frame can never fit
+	 */
+	int add(comms::byte1_t kind, const comms::byte1_t *frame, int len);
+
+	/**
+	 * Write out the buffer, e.g. after each measurement. Also syncs the
+	 * segment if the sync period has passed.
+	 * @return 0 = success, -1 = failure
+	 */
+	int flush();
+
+	/**
+	 * Write out the buffer, sync, cut off the unused end of the segment and
+	 * give it its final name
+	 */
+	void close();
+
+	bool is_open() const {
+		return _fd >= 0;
+	}
+
+	/**
+	 * @return Number of the segment being written
+	 */
+	uint32_t segment() const {
+		return _segment;
+	}
+
+	/**
+	 * @return Path the segment being written will have once closed
+	 */
+	const std::string &path() const {
+		return _path;
+	}
+
+	/**
+	 * @return Frames saved in all segments
+	 */
+	unsigned long records() const {
+		return _records;
+	}
+
+private:
+	int open_segment(uint32_t segment);
+	void discard();
+	int write_out();
+
+	int _fd = -1;
+	std::string _base;
+	std::string _path;
+	std::string _part; // Name while it is written
+	uint32_t _segment_size;
+	uint32_t _index_entries;
+	uint32_t _data_offset;
+	int _sync_ms;
+	uint32_t _segment = 0;
+	uint32_t _end = 0; // Offset the buffer goes at
+	uint32_t _entries = 0; // Index entries in this segment, including buffered
+	uint32_t _first_entry = 0; // First index entry in the buffer
+	std::vector<comms::byte1_t> _buf;
+	std::vector<uint32_t> _index; // Entries in the buffer
+	Timer _synced;
+	unsigned long _records = 0;
+};
+
+class ImpFileReader {
+public:
+
+	ImpFileReader() {
+	}
+
+	~ImpFileReader() {
+		close();
+	}
+
+	/**
+	 * Open a segment and read its index
+	 * @return 0 = success, -1 if the file cannot be opened or is not an ImP
+	 * segment
+	 */
+	int open(const std::string &path);
+
+	const ImpFileHeader &header() const {
+		return _header;
+	}
+
+	/**
+	 * @return Number of records in the index (entries not written are left
+	 * out)
+	 */
+	size_t frames() const {
+		return _offsets.size();
+	}
+
+	/**
+	 * Read any record through the index
+	 * @param frame: Buffer for at least 65535 bytes
+	 * @return Length of the frame, -1 if the record is damaged
+	 */
+	int read(size_t i, ImpRecordHeader &h, comms::byte1_t *frame);
+
+	/**
+	 * Read the next good record, skipping damaged ones
+	 * @param frame: Buffer for at least 65535 bytes
+	 * @return Length of the frame, 0 at the end of the segment
+	 */
+	int next(ImpRecordHeader &h, comms::byte1_t *frame);
+
+	/**
+	 * @return Records skipped because they were damaged
+	 */
+	unsigned long damaged() const {
+		return _damaged;
+	}
+
+	void close();
+
+private:
+	int _fd = -1;
+	ImpFileHeader _header;
+	std::vector<uint32_t> _offsets;
+	size_t _next = 0;
+	unsigned long _damaged = 0;
+};
+
+#endif /* IMP_FILE_H */
@@ -0,0 +1,80 @@
+/**
+ * REXUS PIOneERS - Pi_1
+ * imp_pipeline.cpp
+ * Purpose: Function implementations for the ImPPipeline class
+ */
+
+#include <algorithm>
+
+#include "imp_pipeline.h"
+
+ImPPipeline::ImPPipeline(int outstanding, int interval_ms, int timeout_ms)
+: _outstanding(std::max(outstanding, 1)), _interval_ms(interval_ms), _timeout_ms(timeout_ms) {
+}
+
+int ImPPipeline::due(int32_t now) const {
+	int free = _outstanding - (int) _sent.size();
+	if (free <= 0)
+		return 0;
+	if (_interval_ms > 0 && _any_sent)
+		return (now - _last_request >= _interval_ms) ? 1 : 0;
+	return free;
+}
+
+void ImPPipeline::requested(int32_t now) {
+	if (_sent.empty())
+		_last_activity = now; // The timeout starts from the first request
+	_sent.push_back(now);
+	_last_request = now;
+	if (!_any_sent)
+		_rate_start = now;
+	_any_sent = true;
+}
+
+ImPPipeline::Frame ImPPipeline::received(int32_t now) {
+	Frame f = _expect;
+	_last_activity = now;
+	if (f == PRIMARY) {
+		if (!_sent.empty()) {
+			_latency_total += now - _sent.front();
+			_answered++;
+			_sent.pop_front();
+		}
+		_expect = SECONDARY;
+	} else {
+		_completed++;
+		_rate_count++;
+		_expect = PRIMARY;
+	}
+	return f;
+}
+
+int ImPPipeline::wait_ms(int32_t now) const {
+	if (due(now) > 0)
+		return 0;
+	int wait = -1;
+	if (!_sent.empty() || _expect == SECONDARY)
+		wait = std::max(0, _last_activity + _timeout_ms - now);
+	if (_interval_ms > 0 && (int) _sent.size() < _outstanding) {
+		int next = std::max(0, _last_request + _interval_ms - now);
+		wait = (wait < 0) ? next : std::min(wait, next);
+	}
+	return wait;
+}
+
+bool ImPPipeline::timed_out(int32_t now) {
+	if ((_sent.empty() && _expect == PRIMARY) || now - _last_activity < _timeout_ms)
+		return false;
+	_sent.clear();
+	_expect = PRIMARY;
+	_timeouts++;
+	_last_activity = now;
+	return true;
+}
+
+double ImPPipeline::rate_hz(int32_t now) {
+	double rate = (now > _rate_start) ? 1000.0 * _rate_count / (now - _rate_start) : 0;
+	_rate_count = 0;
+	_rate_start = now;
+	return rate;
+}
@@ -0,0 +1,123 @@
+/**
+ * REXUS PIOneERS - Pi_1
+ * imp_pipeline.h
+ * Purpose: Class definition for keeping requests to the ImP in flight while
+ *			earlier measurements are still arriving or being saved, so the
+ *			sample rate is set by the instrument and the baud rate rather
+ *			than by how long our loop takes.
+ *
+ * Each request ("C" to start, then "N") is answered with a primary frame and
+ * then a secondary frame, both zero terminated. The next request is sent as
+ * soon as a primary frame arrives, so the ImP measures while the secondary
+ * frame is received and the last measurement is passed on and saved. Up to
+ * a set number of requests are kept outstanding. If nothing arrives before
+ * the timeout the requests are taken as lost and sent again.
+ *
+ * Times are in ms from any fixed point (e.g. a Timer started with the loop).
+ */
+
+#ifndef IMP_PIPELINE_H
+#define IMP_PIPELINE_H
+
+#include <stdint.h>
+#include <deque>
+
+class ImPPipeline {
+public:
+
+	enum Frame {
+		PRIMARY, SECONDARY
+	};
+
+	/**
+	 * @param outstanding: Most requests sent and not yet answered
+	 * @param interval_ms: Shortest time between requests, 0 for as fast as
+	 * the ImP answers
+	 * @param timeout_ms: Time without a frame before requests are sent again
+	 */
+	ImPPipeline(int outstanding = 1, int interval_ms = 0, int timeout_ms = 400);
+
+	/**
+	 * @return Number of requests to send now
+	 */
+	int due(int32_t now) const;
+
+	/**
+	 * Record a request as sent
+	 */
+	void requested(int32_t now);
+
+	/**
+	 * @return Kind of frame expected next
+	 */
+	Frame expecting() const {
+		return _expect;
+	}
+
+	/**
+	 * Record a whole frame received
+	 * @return Kind of frame it was, a primary frame frees a request
+	 */
+	Frame received(int32_t now);
+
+	/**
+	 * @return Time until something has to be done (a request is due or the
+	 * timeout passes), -1 for nothing
+	 */
+	int wait_ms(int32_t now) const;
+
+	/**
+	 * Check for the ImP not answering, forgets the outstanding requests so
+	 * new ones are due
+	 * @return true if the timeout has passed
+	 */
+	bool timed_out(int32_t now);
+
+	int in_flight() const {
+		return _sent.size();
+	}
+
+	// Counters
+
+	/**
+	 * @return Measurements completed (primary and secondary frames)
+	 */
+	unsigned long completed() const {
+		return _completed;
+	}
+
+	unsigned long timeouts() const {
+		return _timeouts;
+	}
+
+	/**
+	 * @return Mean time from a request to its primary frame, in ms
+	 */
+	double latency_ms() const {
+		return _answered ? (double) _latency_total / _answered : 0;
+	}
+
+	/**
+	 * @return Measurements per second since the last call, the rate the
+	 * ImP and the link achieve
+	 */
+	double rate_hz(int32_t now);
+
+private:
+	int _outstanding;
+	int _interval_ms;
+	int _timeout_ms;
+	Frame _expect = PRIMARY;
+	std::deque<int32_t> _sent; // Times of the requests not yet answered
+	bool _any_sent = false;
+	int32_t _last_request = 0;
+	int32_t _last_activity = 0;
+	unsigned long _completed = 0;
+	unsigned long _timeouts = 0;
+	unsigned long _answered = 0;
+	int64_t _latency_total = 0;
+	unsigned long _rate_count = 0;
+	int32_t _rate_start = 0;
+};
+
+#endif /* IMP_PIPELINE_H */
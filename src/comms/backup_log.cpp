@@ -0,0 +1,186 @@
+/**
+ * REXUS PIOneERS - Pi_1
+ * backup_log.cpp
+ * Purpose: Function implementations for the BackupLog and BackupReader
+ *			classes
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <chrono>
+
+#include "backup_log.h"
+#include "protocol.h"
+
+namespace comms {
+
+	byte2_t backup_crc(const BackupRecord &r) {
+		return Protocol::crc16Gen((const byte1_t*) &r.time_ms,
+				sizeof (r) - offsetof(BackupRecord, time_ms), crc_poly);
+	}
+
+	BackupLog::BackupLog(size_t buffer_size, int sync_ms)
+	: _buf(buffer_size - buffer_size % sizeof (BackupRecord)), _sync_ms(sync_ms) {
+	}
+
+	int BackupLog::open(const std::string &path) {
+		close();
+		_fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_APPEND, 0644);
+		if (_fd < 0)
+			return -1;
+		_start.reset();
+		_synced.reset();
+		_offset_ms = 0;
+		uint64_t now_us = std::chrono::duration_cast<std::chrono::microseconds>(
+				std::chrono::system_clock::now().time_since_epoch()).count();
+		BackupHeader h;
+		struct stat st;
+		if (fstat(_fd, &st) == 0 && st.st_size > 0) {
+			// Times carry on from the start given in the header already there
+			if (pread(_fd, &h, sizeof (h), 0) == sizeof (h) && now_us > h.start_us)
+				_offset_ms = (now_us - h.start_us) / 1000;
+			return 0;
+		}
+		memset(&h, 0, sizeof (h));
+		memcpy(h.magic, BACKUP_MAGIC, sizeof (h.magic));
+		h.version = BACKUP_VERSION;
+		h.record_size = sizeof (BackupRecord);
+		h.start_us = now_us;
+		if (write(_fd, &h, sizeof (h)) != sizeof (h)) {
+			close();
+			return -1;
+		}
+		return 0;
+	}
+
+	int BackupLog::add(const Packet &p) {
+		if (_fd < 0)
+			return -1;
+		if (_used + sizeof (BackupRecord) > _buf.size() && write_out() < 0)
+			return -1;
+		BackupRecord r;
+		r.marker = BACKUP_MARKER;
+		r.time_ms = _offset_ms + _start.elapsed();
+		r.packet = p;
+		r.crc = backup_crc(r);
+		memcpy(&_buf[_used], &r, sizeof (r));
+		_used += sizeof (r);
+		_records++;
+		return 0;
+	}
+
+	int BackupLog::write_out() {
+		size_t done = 0;
+		while (done < _used) {
+			ssize_t n = write(_fd, &_buf[done], _used - done);
+			if (n < 0 && errno == EINTR)
+				continue;
+			if (n <= 0) {
+				// Drop what could not be written rather than grow forever
+				_used = 0;
+				return -1;
+			}
+			done += n;
+		}
+		_used = 0;
+		return 0;
+	}
+
+	int BackupLog::flush() {
+		if (_fd < 0)
+			return -1;
+		if (write_out() < 0)
+			return -1;
+		if (_sync_ms >= 0 && _synced.elapsed() >= _sync_ms) {
+			_synced.reset();
+			return fdatasync(_fd);
+		}
+		return 0;
+	}
+
+	int BackupLog::sync() {
+		if (_fd < 0)
+			return -1;
+		if (write_out() < 0)
+			return -1;
+		_synced.reset();
+		return fdatasync(_fd);
+	}
+
+	void BackupLog::close() {
+		if (_fd < 0)
+			return;
+		sync();
+		::close(_fd);
+		_fd = -1;
+	}
+
+	int BackupReader::open(const std::string &path) {
+		close();
+		_fd = ::open(path.c_str(), O_RDONLY);
+		if (_fd < 0)
+			return -1;
+		_buf.resize(64 * 1024);
+		_pos = _end = 0;
+		_skipped = 0;
+		if (!fill(sizeof (BackupHeader))) {
+			close();
+			errno = EINVAL;
+			return -1;
+		}
+		memcpy(&_header, &_buf[_pos], sizeof (_header));
+		if (memcmp(_header.magic, BACKUP_MAGIC, sizeof (_header.magic)) != 0 ||
+				_header.record_size != sizeof (BackupRecord)) {
+			close();
+			errno = EINVAL;
+			return -1;
+		}
+		_pos += sizeof (_header);
+		return 0;
+	}
+
+	bool BackupReader::fill(size_t need) {
+		if (_end - _pos >= need)
+			return true;
+		// Move what is left to the start and read more after it
+		memmove(&_buf[0], &_buf[_pos], _end - _pos);
+		_end -= _pos;
+		_pos = 0;
+		while (_end < need) {
+			ssize_t n = read(_fd, &_buf[_end], _buf.size() - _end);
+			if (n < 0 && errno == EINTR)
+				continue;
+			if (n <= 0)
+				return false;
+			_end += n;
+		}
+		return true;
+	}
+
+	int BackupReader::next(BackupRecord &r) {
+		if (_fd < 0)
+			return 0;
+		while (fill(sizeof (r))) {
+			memcpy(&r, &_buf[_pos], sizeof (r));
+			if (r.marker == BACKUP_MARKER && r.crc == backup_crc(r)) {
+				_pos += sizeof (r);
+				return 1;
+			}
+			// Damaged, look for the next record one byte on
+			_pos++;
+			_skipped++;
+		}
+		_skipped += _end - _pos;
+		_pos = _end;
+		return 0;
+	}
+
+	void BackupReader::close() {
+		if (_fd >= 0)
+			::close(_fd);
+		_fd = -1;
+	}
+}
@@ -0,0 +1,163 @@
+/**
+ * REXUS PIOneERS - Pi_1
+ * backup_log.h
+ * Purpose: Class definitions for the binary backup of packets received from
+ *			the other Pi. Each packet is stored exactly as received with the
+ *			time it arrived and a checksum for the record, so the file can be
+ *			decoded without losing anything (see tools/backup_to_csv.cpp).
+ *
+ * File layout: a BackupHeader followed by BackupRecords, all 32 bytes. A
+ * record starts with BACKUP_MARKER so a reader can find the next good record
+ * after a damaged one. Records are collected in a buffer and written with
+ * one call per batch; fdatasync is called at most once per sync period.
+ */
+
+#ifndef BACKUP_LOG_H
+#define BACKUP_LOG_H
+
+#include <stdint.h>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include "packet.h"
+#include "timing/timer.h"
+
+#define BACKUP_MAGIC "PIBK"
+#define BACKUP_VERSION 1
+#define BACKUP_MARKER 0xA55A
+
+namespace comms {
+
+#pragma pack(push, 1)
+
+	struct BackupHeader {
+		char magic[4]; // BACKUP_MAGIC
+		byte2_t version;
+		byte2_t record_size;
+		uint64_t start_us; // Unix time of the start of the file in us
+		byte1_t reserved[16];
+	};
+
+	struct BackupRecord {
+		byte2_t marker; // BACKUP_MARKER
+		byte2_t crc; // CRC16 of the rest of the record
+		uint32_t time_ms; // Time received since the start of the file
+		Packet packet; // As received
+	};
+
+#pragma pack(pop)
+
+	class BackupLog {
+	public:
+
+		/**
+		 * @param buffer_size: Bytes collected before writing to the file
+		 * @param sync_ms: Least time between calls to fdatasync, -1 never
+		 */
+		BackupLog(size_t buffer_size = 64 * 1024, int sync_ms = 1000);
+
+		~BackupLog() {
+			close();
+		}
+
+		/**
+		 * Start a new file (or add to an existing one)
+		 * @return 0 = success, -1 = failure (errno is set)
+		 */
+		int open(const std::string &path);
+
+		/**
+		 * Add a packet, the buffer is written out when full
+		 * @return 0 = success, -1 if writing to the file failed
+		 */
+		int add(const Packet &p);
+
+		/**
+		 * Write out the buffer, e.g. after each batch of packets. Also syncs
+		 * the file if the sync period has passed.
+		 * @return 0 = success, -1 = failure
+		 */
+		int flush();
+
+		/**
+		 * Write out the buffer and sync the file now
+		 */
+		int sync();
+
+		void close();
+
+		bool is_open() const {
+			return _fd >= 0;
+		}
+
+		unsigned long records() const {
+			return _records;
+		}
+
+	private:
+		int write_out();
+
+		int _fd = -1;
+		std::vector<byte1_t> _buf;
+		size_t _used = 0;
+		int _sync_ms;
+		Timer _start; // Since opened
+		uint32_t _offset_ms = 0; // Time from the start of the file to opening it
+		Timer _synced; // Since the last fdatasync
+		unsigned long _records = 0;
+	};
+
+	class BackupReader {
+	public:
+
+		BackupReader() {
+		}
+
+		~BackupReader() {
+			close();
+		}
+
+		/**
+		 * @return 0 = success, -1 if the file cannot be opened or is not a
+		 * backup log
+		 */
+		int open(const std::string &path);
+
+		/**
+		 * Read the next good record, skipping damaged ones
+		 * @return 1 if a record was read, 0 at the end of the file
+		 */
+		int next(BackupRecord &r);
+
+		const BackupHeader &header() const {
+			return _header;
+		}
+
+		/**
+		 * @return Bytes skipped over looking for good records
+		 */
+		unsigned long skipped() const {
+			return _skipped;
+		}
+
+		void close();
+
+	private:
+		bool fill(size_t need);
+
+		int _fd = -1;
+		BackupHeader _header;
+		std::vector<byte1_t> _buf;
+		size_t _pos = 0;
+		size_t _end = 0;
+		unsigned long _skipped = 0;
+	};
+
+	/**
+	 * @return CRC for a record
+	 */
+	byte2_t backup_crc(const BackupRecord &r);
+}
+
+#endif /* BACKUP_LOG_H */
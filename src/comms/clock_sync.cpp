@@ -0,0 +1,171 @@
+/**
+ * REXUS PIOneERS - Pi_1
+ * clock_sync.cpp
+ * Purpose: Function implementations for the ClockSync and SharedClock classes
+ */
+
+#include <atomic>
+#include <cstring>
+#include <new>
+#include <sys/mman.h>
+
+#include "clock_sync.h"
+#include "protocol.h"
+#include "pipes.h"
+
+// Pongs for pings older than this are ignored
+#define MAX_RTT_US 10000000
+// A chosen offset further than this from the fit means the other clock was
+// set (e.g. by NTP) and the fit starts again
+#define CLOCK_STEP_US 100000
+// Time the chosen offsets must cover before the drift is fitted
+#define MIN_FIT_SPAN_US 30000000
+
+namespace comms {
+
+	std::ostream& operator<<(std::ostream &os, const ClockEstimate &e) {
+		if (e.samples == 0)
+			return os << "no estimate";
+		return os << "offset " << e.offset_us << " us (+-" << e.rtt_us / 2 << " us) at " <<
+				e.ref_us << " drift " << e.drift * 1e6 << " ppm from " << e.samples << " pongs";
+	}
+
+	ClockSync::ClockSync(int filter, int history) : _filter(filter), _history(history) {
+	}
+
+	void ClockSync::make_ping(Packet &p, int64_t now_us) {
+		LinkPing ping;
+		ping.sent_us = now_us;
+		Protocol::pack<ID_PING>(p, (byte2_t) _pings++, ping);
+	}
+
+	int ClockSync::make_pong(const Packet &ping, Packet &pong, int64_t received_us,
+			int64_t now_us) {
+		Packet copy = ping;
+		byte2_t index;
+		LinkPing in;
+		if (Protocol::unpack<ID_PING>(copy, index, in))
+			return -1;
+		LinkPong out;
+		out.ping_us = (uint32_t) in.sent_us;
+		out.hold_us = (uint32_t) (now_us - received_us);
+		out.received_us = received_us;
+		Protocol::pack<ID_PONG>(pong, index, out);
+		return 0;
+	}
+
+	int ClockSync::on_pong(const Packet &p, int64_t now_us) {
+		Packet copy = p;
+		byte2_t index;
+		LinkPong pong;
+		if (Protocol::unpack<ID_PONG>(copy, index, pong))
+			return -1;
+		// Only the low bits of the send time come back, the rest are ours
+		int64_t t1 = now_us - (uint32_t) ((uint32_t) now_us - pong.ping_us);
+		int64_t t2 = pong.received_us;
+		int64_t t3 = t2 + pong.hold_us;
+		int64_t t4 = now_us;
+		int64_t rtt = (t4 - t1) - (t3 - t2);
+		if (rtt < 0 || t4 - t1 > MAX_RTT_US)
+			return 0; // Stale, or our clock was set since the ping
+		Sample s;
+		s.at_us = t1 + (t4 - t1) / 2;
+		s.offset_us = ((t2 - t1) + (t3 - t4)) / 2;
+		s.rtt_us = (int32_t) rtt;
+		_last_rtt = s.rtt_us;
+		_recent.push_back(s);
+		if ((int) _recent.size() > _filter)
+			_recent.erase(_recent.begin());
+		_estimate.samples++;
+		// Clock filter: use the sample with the shortest round trip, once
+		const Sample *best = &_recent[0];
+		for (size_t i = 1; i < _recent.size(); i++)
+			if (_recent[i].rtt_us < best->rtt_us)
+				best = &_recent[i];
+		if (!_chosen.empty() && best->at_us <= _chosen.back().at_us)
+			return 0;
+		if (!_chosen.empty()) {
+			int64_t error = best->offset_us - (_estimate.to_remote(best->at_us) - best->at_us);
+			int64_t limit = CLOCK_STEP_US + best->rtt_us / 2;
+			if (error > limit || error < -limit) {
+				_steps++;
+				_chosen.clear();
+			}
+		}
+		_chosen.push_back(*best);
+		if ((int) _chosen.size() > _history)
+			_chosen.erase(_chosen.begin());
+		fit();
+		return 1;
+	}
+
+	void ClockSync::fit() {
+		const Sample &last = _chosen.back();
+		_estimate.ref_us = last.at_us;
+		_estimate.offset_us = last.offset_us;
+		_estimate.rtt_us = last.rtt_us;
+		_estimate.drift = 0;
+		size_t n = _chosen.size();
+		if (n < 4 || last.at_us - _chosen[0].at_us < MIN_FIT_SPAN_US)
+			return;
+		// Least squares, relative to the last sample to keep the numbers small
+		double sx = 0, sy = 0, sxx = 0, sxy = 0;
+		for (size_t i = 0; i < n; i++) {
+			double x = _chosen[i].at_us - last.at_us;
+			double y = _chosen[i].offset_us - last.offset_us;
+			sx += x;
+			sy += y;
+			sxx += x * x;
+			sxy += x * y;
+		}
+		double d = n * sxx - sx * sx;
+		if (d <= 0)
+			return;
+		double slope = (n * sxy - sx * sy) / d;
+		double intercept = (sy - slope * sx) / n;
+		_estimate.drift = slope;
+		_estimate.offset_us = last.offset_us + (int64_t) intercept;
+	}
+
+	/*
+	 * Sequence lock: the writer makes version odd while it changes the
+	 * estimate, the reader tries again if version was odd or changed.
+	 */
+	struct SharedClock::Slot {
+		std::atomic<uint32_t> version;
+		ClockEstimate estimate;
+	};
+
+	SharedClock::SharedClock() {
+		void *mem = mmap(NULL, sizeof (Slot), PROT_READ | PROT_WRITE,
+				MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+		if (mem == MAP_FAILED)
+			throw PipeException("Failed to map shared memory");
+		_slot = new (mem) Slot();
+		_slot->version.store(0);
+	}
+
+	SharedClock::~SharedClock() {
+		munmap(_slot, sizeof (Slot));
+	}
+
+	void SharedClock::store(const ClockEstimate &e) {
+		uint32_t v = _slot->version.load(std::memory_order_relaxed);
+		_slot->version.store(v + 1, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+		memcpy((void*) &_slot->estimate, &e, sizeof (e));
+		_slot->version.store(v + 2, std::memory_order_release);
+	}
+
+	ClockEstimate SharedClock::load() const {
+		ClockEstimate e;
+		uint32_t before, after;
+		do {
+			before = _slot->version.load(std::memory_order_acquire);
+			memcpy((void*) &e, (const void*) &_slot->estimate, sizeof (e));
+			std::atomic_thread_fence(std::memory_order_acquire);
+			after = _slot->version.load(std::memory_order_relaxed);
+		} while ((before & 1) || before != after);
+		return e;
+	}
+}
@@ -0,0 +1,167 @@
+/**
+ * REXUS PIOneERS - Pi_1
+ * clock_sync.h
+ * Purpose: Class definitions for measuring the round trip time of the
+ *			Ethernet link and estimating the difference between the clocks
+ *			of the two Pis, so data from both can be put on one time base.
+ *
+ * Each side sends an ID_PING packet (LinkPing) every second with the time it
+ * was sent (t1). The other side answers straight away with an ID_PONG
+ * (LinkPong) holding when the ping arrived (t2) and how long it was held
+ * before the answer was sent (t3 - t2). When the pong arrives (t4), as for
+ * NTP:
+ *
+ *   round trip = (t4 - t1) - (t3 - t2)
+ *   offset     = ((t2 - t1) + (t3 - t4)) / 2
+ *
+ * The offset is the other clock minus ours and is wrong by at most half the
+ * round trip, so of the last few samples only the one with the shortest round
+ * trip is used (the others waited behind data in the socket). Drift is the
+ * slope of a straight line fitted to the chosen offsets over the last few
+ * minutes.
+ *
+ * Times are microseconds since 1970 from the system clock (Timer::now_us()).
+ */
+
+#ifndef CLOCK_SYNC_H
+#define CLOCK_SYNC_H
+
+#include <stdint.h>
+#include <vector>
+#include <ostream>
+
+#include "packet.h"
+
+namespace comms {
+
+	struct ClockEstimate {
+		uint32_t samples = 0; // Pongs received, 0 if there is no estimate
+		int64_t ref_us = 0; // Our time the offset was measured at
+		int64_t offset_us = 0; // Other clock minus ours at ref_us
+		double drift = 0; // Change in the offset per unit time (1e-6 = 1 ppm)
+		int32_t rtt_us = 0; // Round trip of the sample used, offset is within half this
+
+		/**
+		 * @param local_us: Time on our clock
+		 * @return The same time on the other clock, local_us if there is no
+		 * estimate yet
+		 */
+		int64_t to_remote(int64_t local_us) const {
+			return local_us + offset_us + (int64_t) (drift * (local_us - ref_us));
+		}
+
+		/**
+		 * @param remote_us: Time on the other clock
+		 * @return The same time on our clock
+		 */
+		int64_t to_local(int64_t remote_us) const {
+			return remote_us - offset_us - (int64_t) (drift * (remote_us - offset_us - ref_us));
+		}
+	};
+
+	/**
+	 * Prints the estimate on one line for the log
+	 */
+	std::ostream& operator<<(std::ostream &os, const ClockEstimate &e);
+
+	class ClockSync {
+	public:
+
+		/**
+		 * @param filter: Number of recent samples the shortest round trip is
+		 * chosen from
+		 * @param history: Number of chosen offsets the drift is fitted to
+		 */
+		ClockSync(int filter = 8, int history = 128);
+
+		/**
+		 * Pack an ID_PING packet
+		 * @param now_us: Time it is sent
+		 */
+		void make_ping(Packet &p, int64_t now_us);
+
+		/**
+		 * Pack the ID_PONG answering a ping from the other side
+		 * @param ping: Packed ping as received
+		 * @param received_us: Time the ping arrived
+		 * @param now_us: Time the pong is sent
+		 * @return 0 = success, -1 if ping is corrupt or not a ping
+		 */
+		static int make_pong(const Packet &ping, Packet &pong, int64_t received_us,
+				int64_t now_us);
+
+		/**
+		 * Apply an ID_PONG from the other side
+		 * @param p: Packed pong as received
+		 * @param now_us: Time it arrived
+		 * @return 1 if the estimate changed, 0 if the sample was not used,
+		 * -1 if p is corrupt or not a pong
+		 */
+		int on_pong(const Packet &p, int64_t now_us);
+
+		const ClockEstimate& estimate() const {
+			return _estimate;
+		}
+
+		/**
+		 * @return Round trip of the last pong, -1 if there has not been one
+		 */
+		int32_t last_rtt_us() const {
+			return _last_rtt;
+		}
+
+		/**
+		 * @return Number of times the other clock jumped and the drift fit
+		 * was started again
+		 */
+		unsigned long steps() const {
+			return _steps;
+		}
+
+	private:
+
+		struct Sample {
+			int64_t at_us; // Middle of the round trip on our clock
+			int64_t offset_us;
+			int32_t rtt_us;
+		};
+
+		void fit();
+
+		int _filter;
+		int _history;
+		uint32_t _pings = 0;
+		std::vector<Sample> _recent; // Last _filter samples, oldest first
+		std::vector<Sample> _chosen; // Last _history chosen samples, oldest first
+		ClockEstimate _estimate;
+		int32_t _last_rtt = -1;
+		unsigned long _steps = 0;
+	};
+
+	/**
+	 * An estimate in shared memory, written by the Ethernet process and read
+	 * by the main process. Must be made before forking.
+	 */
+	class SharedClock {
+	public:
+
+		SharedClock();
+		~SharedClock();
+
+		SharedClock(const SharedClock&) = delete;
+		SharedClock& operator=(const SharedClock&) = delete;
+
+		void store(const ClockEstimate &e);
+
+		/**
+		 * @return Latest estimate stored, samples is 0 if there is none
+		 */
+		ClockEstimate load() const;
+
+	private:
+		struct Slot;
+		Slot *_slot;
+	};
+}
+
+#endif /* CLOCK_SYNC_H */
@@ -0,0 +1,123 @@
+/**
+ * REXUS PIOneERS - Pi_1
+ * crc16.h
+ * Purpose: Table driven CRC16 engine. The lookup tables for each generator
+ *			are built by the compiler so there is no start-up cost and no
+ *			bit-by-bit loop on the hot path.
+ */
+
+#ifndef CRC16_H
+#define CRC16_H
+
+#include <cstddef>
+#include <stdint.h>
+
+namespace comms {
+
+	namespace crc16_detail {
+
+		template<size_t... I> struct Indices {
+		};
+
+		template<class A, class B> struct Concat;
+
+		template<size_t... A, size_t... B>
+		struct Concat<Indices<A...>, Indices<B...> > {
+			typedef Indices < A..., (sizeof...(A) + B)... > type;
+		};
+
+		// Builds Indices<0, ..., N-1> with logarithmic template depth
+		template<size_t N> struct MakeIndices {
+			typedef typename Concat<typename MakeIndices<N / 2 > ::type,
+			typename MakeIndices<N - N / 2 > ::type>::type type;
+		};
+
+		template<> struct MakeIndices<0> {
+			typedef Indices<> type;
+		};
+
+		template<> struct MakeIndices<1> {
+			typedef Indices<0> type;
+		};
+
+		/**
+		 * One step of the long division used by Protocol::crc16Gen
+		 */
+		constexpr uint16_t step(uint16_t gen, uint16_t crc) {
+			return (crc & 0x8000) ? (uint16_t) ((crc << 1) ^ gen) : (uint16_t) (crc << 1);
+		}
+
+		constexpr uint16_t shift(uint16_t gen, uint16_t crc, size_t bits) {
+			return bits ? shift(gen, step(gen, crc), bits - 1) : crc;
+		}
+
+		/**
+		 * Entry i of slice k is the remainder of i * x^(16 + 8k) so slice k
+		 * gives the contribution of a byte k positions from the end of a block.
+		 */
+		constexpr uint16_t entry(uint16_t gen, size_t slice, size_t i) {
+			return shift(gen, (uint16_t) (i << 8), 8 * (slice + 1));
+		}
+
+		template<size_t Slices>
+		struct Table {
+			uint16_t v[Slices * 256];
+		};
+
+		template<size_t Slices, size_t... I>
+		constexpr Table<Slices> make_table(uint16_t gen, Indices<I...>) {
+			return Table<Slices>{
+				{ entry(gen, I / 256, I % 256)... }};
+		}
+	}
+
+	/**
+	 * CRC16 with initial value 0x0000, no reflection and no final xor. Gives
+	 * identical results to the bitwise Protocol::crc16Gen for the same
+	 * generator. Blocks of 8 and 4 bytes are processed with slice-by-8 and
+	 * slice-by-4 lookups, the tail one byte at a time.
+	 */
+	template<uint16_t Generator>
+	class CRC16 {
+	public:
+		static const size_t SLICES = 8;
+		typedef crc16_detail::Table<SLICES> table_t;
+		static constexpr table_t table = crc16_detail::make_table<SLICES>(
+				Generator, typename crc16_detail::MakeIndices<SLICES * 256>::type());
+
+		/**
+		 * Calculate the checksum of a buffer
+		 * @param pos: Start of buffer
+		 * @param len: Number of bytes in buffer
+		 * @return CRC of the buffer
+		 */
+		static uint16_t compute(const uint8_t* pos, size_t len) {
+			const uint16_t* t = table.v;
+			uint16_t crc = 0x0000;
+			while (len >= 8) {
+				crc = t[7 * 256 + ((crc >> 8) ^ pos[0])]
+						^ t[6 * 256 + ((crc & 0xFF) ^ pos[1])]
+						^ t[5 * 256 + pos[2]] ^ t[4 * 256 + pos[3]]
+						^ t[3 * 256 + pos[4]] ^ t[2 * 256 + pos[5]]
+						^ t[1 * 256 + pos[6]] ^ t[pos[7]];
+				pos += 8;
+				len -= 8;
+			}
+			if (len >= 4) {
+				crc = t[3 * 256 + ((crc >> 8) ^ pos[0])]
+						^ t[2 * 256 + ((crc & 0xFF) ^ pos[1])]
+						^ t[1 * 256 + pos[2]] ^ t[pos[3]];
+				pos += 4;
+				len -= 4;
+			}
+			while (len--)
+				crc = (uint16_t) (crc << 8) ^ t[(crc >> 8) ^ *pos++];
+			return crc;
+		}
+	};
+
+	template<uint16_t Generator>
+	constexpr typename CRC16<Generator>::table_t CRC16<Generator>::table;
+}
+
+#endif /* CRC16_H */
@@ -0,0 +1,79 @@
+/**
+ * REXUS PIOneERS - Pi_1
+ * fan_out.cpp
+ * Purpose: Function implementations for the FanOut class
+ */
+
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+
+#include "fan_out.h"
+
+namespace comms {
+
+	void FanOut::add(int fd) {
+		_clients[fd] = Buffer();
+	}
+
+	void FanOut::remove(int fd) {
+		_clients.erase(fd);
+	}
+
+	std::vector<int> FanOut::broadcast(const void *data, size_t len) {
+		const byte1_t *bytes = (const byte1_t*) data;
+		std::vector<int> dropped;
+		for (std::map<int, Buffer>::iterator it = _clients.begin(); it != _clients.end(); it++) {
+			Buffer &b = it->second;
+			if (b.data.size() - b.head + len > _limit) {
+				dropped.push_back(it->first);
+				_evicted++;
+				continue;
+			}
+			b.data.insert(b.data.end(), bytes, bytes + len);
+			if (flush(it->first) < 0)
+				dropped.push_back(it->first);
+		}
+		for (size_t i = 0; i < dropped.size(); i++)
+			remove(dropped[i]);
+		return dropped;
+	}
+
+	int FanOut::flush(int fd) {
+		std::map<int, Buffer>::iterator it = _clients.find(fd);
+		if (it == _clients.end())
+			return -1;
+		Buffer &b = it->second;
+		while (b.head < b.data.size()) {
+			// MSG_NOSIGNAL so a client disconnecting cannot kill the process
+			ssize_t n = send(fd, &b.data[b.head], b.data.size() - b.head, MSG_NOSIGNAL);
+			if (n > 0) {
+				b.head += n;
+			} else if (n < 0 && errno == EINTR) {
+				continue;
+			} else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+				break;
+			} else {
+				return -1;
+			}
+		}
+		if (b.head == b.data.size()) {
+			b.data.clear();
+			b.head = 0;
+			return 1;
+		}
+		if (b.head > b.data.size() / 2) {
+			// Drop what has been sent so the buffer does not keep growing
+			b.data.erase(b.data.begin(), b.data.begin() + b.head);
+			b.head = 0;
+		}
+		return 0;
+	}
+
+	size_t FanOut::pending(int fd) const {
+		std::map<int, Buffer>::const_iterator it = _clients.find(fd);
+		if (it == _clients.end())
+			return 0;
+		return it->second.data.size() - it->second.head;
+	}
+}
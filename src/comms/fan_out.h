@@ -0,0 +1,92 @@
+/**
+ * REXUS PIOneERS - Pi_1
+ * fan_out.h
+ * Purpose: Class definition for sending the same stream of frames to any
+ *			number of sockets (e.g. ground support laptops watching live
+ *			data). Each socket has its own output buffer so one slow client
+ *			never holds up the others; a client which falls further behind
+ *			than the buffer limit is dropped.
+ */
+
+#ifndef FAN_OUT_H
+#define FAN_OUT_H
+
+#include <stdint.h>
+#include <cstddef>
+#include <map>
+#include <vector>
+
+#include "packet.h"
+
+namespace comms {
+
+	class FanOut {
+	public:
+
+		/**
+		 * @param limit: Most bytes waiting for one client before it is dropped
+		 */
+		FanOut(size_t limit = 64 * 1024) : _limit(limit) {
+		}
+
+		/**
+		 * Start sending to a (non-blocking) socket
+		 */
+		void add(int fd);
+
+		/**
+		 * Stop sending to a socket and forget anything waiting for it. The
+		 * socket is not closed.
+		 */
+		void remove(int fd);
+
+		bool contains(int fd) const {
+			return _clients.count(fd) > 0;
+		}
+
+		int size() const {
+			return _clients.size();
+		}
+
+		/**
+		 * Queue whole frames for every client and send what the sockets take
+		 * straight away.
+		 * @param data: Frame(s) to send
+		 * @param len: Number of bytes
+		 * @return Clients dropped because they were too far behind or their
+		 * socket failed. They have been removed, the caller closes them.
+		 */
+		std::vector<int> broadcast(const void *data, size_t len);
+
+		/**
+		 * Send as much as the socket takes of what is waiting for a client
+		 * @return 1 if nothing is left waiting, 0 if some is (wait for the
+		 * socket to become writable), -1 if the socket failed
+		 */
+		int flush(int fd);
+
+		/**
+		 * @return Bytes waiting to be sent to a client
+		 */
+		size_t pending(int fd) const;
+
+		/**
+		 * @return Number of clients dropped for being too slow
+		 */
+		unsigned long evicted() const {
+			return _evicted;
+		}
+
+	private:
+
+		struct Buffer {
+			std::vector<byte1_t> data;
+			size_t head = 0; // Bytes at the start already sent
+		};
+		size_t _limit;
+		std::map<int, Buffer> _clients;
+		unsigned long _evicted = 0;
+	};
+}
+
+#endif /* FAN_OUT_H */
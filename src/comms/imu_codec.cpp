@@ -0,0 +1,239 @@
+/**
+ * REXUS PIOneERS - Pi_1
+ * imu_codec.cpp
+ * Purpose: Function declarations for the IMU delta encoder and decoder
+ */
+#include <cstring>
+
+#include "imu_codec.h"
+#include "protocol.h"
+
+namespace comms {
+
+	static const int HEADER_BYTES = 3;
+	static const int PAYLOAD_BITS = (16 - HEADER_BYTES) * 8;
+	static const int MAX_AXIS_BITS = 15; // Must fit in a nibble
+	static const int MAX_TIME_BITS = 31;
+
+	static uint32_t zigzag(int32_t v) {
+		return ((uint32_t) v << 1) ^ (uint32_t) (v >> 31);
+	}
+
+	static int32_t unzigzag(uint32_t v) {
+		return (int32_t) (v >> 1) ^ -(int32_t) (v & 1);
+	}
+
+	// Number of bits needed to hold v
+	static int bit_width(uint32_t v) {
+		int w = 0;
+		while (v) {
+			w++;
+			v >>= 1;
+		}
+		return w;
+	}
+
+	// Bits used by one sample, widths are acc, gyro, mag, time
+	static int sample_bits(const int *w) {
+		return 3 * (w[0] + w[1] + w[2]) + w[3];
+	}
+
+	static void put_bits(byte1_t *buf, int &pos, uint32_t v, int w) {
+		for (int i = 0; i < w; i++, pos++)
+			if ((v >> i) & 1)
+				buf[pos >> 3] |= 1 << (pos & 7);
+	}
+
+	static uint32_t get_bits(const byte1_t *buf, int &pos, int w) {
+		uint32_t v = 0;
+		for (int i = 0; i < w; i++, pos++)
+			if ((buf[pos >> 3] >> (pos & 7)) & 1)
+				v |= 1u << i;
+		return v;
+	}
+
+	void ImuSample::fromRaw(const byte1_t *data) {
+		for (int i = 0; i < 9; i++)
+			axes[i] = (int16_t) (data[2 * i] | (data[2 * i + 1] << 8));
+		time = (int32_t) (((uint32_t) data[18] << 24) | (data[19] << 16) |
+				(data[20] << 8) | data[21]);
+	}
+
+	void ImuSample::fromPayloads(const ImuAccGyr &acc_gyr, const ImuMagTime &mag_time) {
+		memcpy(axes, acc_gyr.acc, sizeof (acc_gyr.acc));
+		memcpy(axes + 3, acc_gyr.gyr, sizeof (acc_gyr.gyr));
+		memcpy(axes + 6, mag_time.mag, sizeof (mag_time.mag));
+		time = mag_time.time();
+	}
+
+	void ImuSample::toPayloads(ImuAccGyr &acc_gyr, ImuMagTime &mag_time) const {
+		memcpy(acc_gyr.acc, axes, sizeof (acc_gyr.acc));
+		memcpy(acc_gyr.gyr, axes + 3, sizeof (acc_gyr.gyr));
+		memcpy(mag_time.mag, axes + 6, sizeof (mag_time.mag));
+		mag_time.set_time(time);
+	}
+
+	void ImuSample::toRaw(byte1_t *data) const {
+		for (int i = 0; i < 9; i++) {
+			data[2 * i] = (byte1_t) (axes[i] & 0xFF);
+			data[2 * i + 1] = (byte1_t) ((axes[i] >> 8) & 0xFF);
+		}
+		data[18] = (byte1_t) (0xFF & time >> 24);
+		data[19] = (byte1_t) (0xFF & time >> 16);
+		data[20] = (byte1_t) (0xFF & time >> 8);
+		data[21] = (byte1_t) (0xFF & time >> 0);
+	}
+
+	int ImuEncoder::encode(const ImuSample &s, Packet *out) {
+		int n_out = 0;
+		uint32_t res[10];
+		int w[4] = {0, 0, 0, 0};
+		int64_t dt = 0;
+		bool key = !_have_prev || _since_key >= _interval;
+		if (!key) {
+			for (int i = 0; i < 9; i++) {
+				res[i] = zigzag((int32_t) s.axes[i] - _prev.axes[i]);
+				int b = bit_width(res[i]);
+				if (b > w[i / 3])
+					w[i / 3] = b;
+			}
+			// Time is sent as the change in time step which is near zero
+			dt = (int64_t) s.time - _prev.time;
+			int64_t r = dt - _prev_dt;
+			if (dt > INT32_MAX || dt < INT32_MIN || r > INT32_MAX || r < INT32_MIN) {
+				key = true;
+			} else {
+				res[9] = zigzag((int32_t) r);
+				w[3] = bit_width(res[9]);
+				key = (w[0] > MAX_AXIS_BITS || w[1] > MAX_AXIS_BITS ||
+						w[2] > MAX_AXIS_BITS || w[3] > MAX_TIME_BITS ||
+						sample_bits(w) > PAYLOAD_BITS);
+			}
+		}
+		if (key) {
+			n_out += flush(out);
+			ImuAccGyr acc_gyr;
+			ImuMagTime mag_time;
+			s.toPayloads(acc_gyr, mag_time);
+			Protocol::pack<ID_DATA1>(out[n_out++], _count, acc_gyr);
+			Protocol::pack<ID_DATA2>(out[n_out++], _count, mag_time);
+			_since_key = 0;
+			_prev_dt = 0;
+		} else {
+			// Widths needed if this sample joins the pending ones
+			int nw[4];
+			for (int i = 0; i < 4; i++)
+				nw[i] = (w[i] > _widths[i]) ? w[i] : _widths[i];
+			if (_n == MAX_SAMPLES || (_n + 1) * sample_bits(nw) > PAYLOAD_BITS) {
+				n_out += flush(out);
+				memcpy(nw, w, sizeof (nw));
+			}
+			if (_n == 0)
+				_first = _count;
+			memcpy(_pending[_n++], res, sizeof (res));
+			memcpy(_widths, nw, sizeof (nw));
+			_since_key++;
+			_prev_dt = (int32_t) dt;
+		}
+		_prev = s;
+		_have_prev = true;
+		_count++;
+		return n_out;
+	}
+
+	int ImuAssembler::add(const Packet &p, ImuSample &s) {
+		Packet copy = p;
+		byte1_t id;
+		byte2_t index;
+		byte1_t data[16];
+		if (Protocol::unpack(copy, id, index, data))
+			return -1;
+		if (id == ID_DATA1) {
+			memcpy(&_half, data, sizeof (_half));
+			_half_index = index;
+			_have_half = true;
+			return 0;
+		}
+		if (id != ID_DATA2)
+			return -1;
+		if (!_have_half || _half_index != index)
+			return 0; // First half missing
+		_have_half = false;
+		ImuMagTime mag_time;
+		memcpy(&mag_time, data, sizeof (mag_time));
+		s.fromPayloads(_half, mag_time);
+		return 1;
+	}
+
+	int ImuEncoder::encode(const Packet &p, Packet *out) {
+		ImuSample s;
+		int n = _halves.add(p, s);
+		if (n <= 0)
+			return n;
+		return encode(s, out);
+	}
+
+	int ImuEncoder::flush(Packet *out) {
+		if (_n == 0)
+			return 0;
+		ImuDelta payload;
+		byte1_t *data = payload.bits;
+		memset(data, 0, sizeof (payload.bits));
+		data[0] = (_n << 4) | _widths[0];
+		data[1] = (_widths[1] << 4) | _widths[2];
+		data[2] = _widths[3];
+		int pos = HEADER_BYTES * 8;
+		for (int k = 0; k < _n; k++) {
+			for (int i = 0; i < 9; i++)
+				put_bits(data, pos, _pending[k][i], _widths[i / 3]);
+			put_bits(data, pos, _pending[k][9], _widths[3]);
+		}
+		Protocol::pack<ID_IMU_DELTA>(*out, _first, payload);
+		_n = 0;
+		memset(_widths, 0, sizeof (_widths));
+		return 1;
+	}
+
+	int ImuDecoder::decode(const Packet &p, ImuSample *out) {
+		int full = _halves.add(p, out[0]);
+		if (full > 0) {
+			_prev = out[0];
+			_prev_dt = 0;
+			_next = _halves.index() + 1;
+			_synced = true;
+			return 1;
+		} else if (full == 0) {
+			return 0;
+		}
+		Packet copy = p;
+		byte1_t id;
+		byte2_t index;
+		byte1_t data[16];
+		if (Protocol::unpack(copy, id, index, data))
+			return -1;
+		if (id != ID_IMU_DELTA)
+			return -1;
+		int n = data[0] >> 4;
+		int w[4] = {data[0] & 0x0F, data[1] >> 4, data[1] & 0x0F, data[2]};
+		if (!_synced || index != _next || w[3] > MAX_TIME_BITS ||
+				n * sample_bits(w) > PAYLOAD_BITS) {
+			// Differences from a sample we do not have, wait for a keyframe
+			_synced = false;
+			_dropped += n;
+			return 0;
+		}
+		int pos = HEADER_BYTES * 8;
+		for (int k = 0; k < n; k++) {
+			ImuSample &s = out[k];
+			for (int i = 0; i < 9; i++)
+				s.axes[i] = (int16_t) (_prev.axes[i] +
+					unzigzag(get_bits(data, pos, w[i / 3])));
+			int64_t dt = (int64_t) _prev_dt + unzigzag(get_bits(data, pos, w[3]));
+			s.time = (int32_t) (_prev.time + dt);
+			_prev_dt = (int32_t) dt;
+			_prev = s;
+		}
+		_next = index + n;
+		return n;
+	}
+}
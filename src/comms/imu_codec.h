@@ -0,0 +1,163 @@
+/**
+ * REXUS PIOneERS - Pi_1
+ * imu_codec.h
+ * Purpose: Compact encoding of IMU samples for the RXSM downlink. Samples
+ *			are sent as differences from the previous sample, bit-packed so
+ *			several samples fit in the 16 bytes of one packet. Every so often
+ *			a full sample (keyframe) is sent as the normal ID_DATA1/ID_DATA2
+ *			pair so the ground can resynchronise after a lost packet.
+ *
+ * Layout of the 16 bytes of an ID_IMU_DELTA packet:
+ * byte 1: number of samples (high nibble), accelerometer bits (low nibble)
+ * byte 2: gyro bits (high nibble), magnetometer bits (low nibble)
+ * byte 3: time bits
+ * byte 4-16: for each sample the 9 axis differences then the change in
+ *		time step, zigzag encoded and packed least significant bit first.
+ * The packet index is the sample number of the first sample in the packet.
+ */
+
+#ifndef IMU_CODEC_H
+#define IMU_CODEC_H
+
+#include <stdint.h>
+
+#include "packet.h"
+#include "payloads.h"
+
+namespace comms {
+
+	struct ImuSample {
+		int16_t axes[9]; // Acc x,y,z then gyro x,y,z then mag x,y,z
+		int32_t time; // Microseconds since the start of measurements
+
+		/**
+		 * Read a sample from the raw data produced by RPi_IMU
+		 * @param data: 18 bytes of register data followed by 4 bytes of time
+		 */
+		void fromRaw(const byte1_t *data);
+
+		/**
+		 * Write a sample in the raw layout used by RPi_IMU
+		 * @param data: 22 bytes to hold the data
+		 */
+		void toRaw(byte1_t *data) const;
+
+		/**
+		 * Read a sample from the payloads of its ID_DATA1 and ID_DATA2 packets
+		 */
+		void fromPayloads(const ImuAccGyr &acc_gyr, const ImuMagTime &mag_time);
+
+		/**
+		 * Split a sample into the payloads of its ID_DATA1 and ID_DATA2 packets
+		 */
+		void toPayloads(ImuAccGyr &acc_gyr, ImuMagTime &mag_time) const;
+	};
+
+	/**
+	 * Joins the ID_DATA1 and ID_DATA2 halves of a sample from RPi_IMU
+	 */
+	class ImuAssembler {
+	public:
+
+		/**
+		 * @param p: Packed packet
+		 * @param s: Set to the sample once both halves have been added
+		 * @return 1 if s holds a sample, 0 if waiting for the other half, -1
+		 * if p is not IMU data
+		 */
+		int add(const Packet &p, ImuSample &s);
+
+		/**
+		 * @return Packet index of the last sample completed
+		 */
+		byte2_t index() const {
+			return _half_index;
+		}
+
+	private:
+		ImuAccGyr _half;
+		byte2_t _half_index;
+		bool _have_half = false;
+	};
+
+	class ImuEncoder {
+	public:
+		static const int MAX_OUT = 3; // Most packets produced by one call
+
+		/**
+		 * @param keyframe_interval: Number of samples between full samples
+		 */
+		ImuEncoder(int keyframe_interval = 32) : _interval(keyframe_interval) {
+		}
+
+		/**
+		 * Add a sample to be sent
+		 * @param s: The sample
+		 * @param out: Array of at least MAX_OUT packets for any completed packets
+		 * @return Number of packets written to out
+		 */
+		int encode(const ImuSample &s, Packet *out);
+
+		/**
+		 * Add an ID_DATA1 or ID_DATA2 packet from the IMU. A sample is encoded
+		 * once both halves with the same index have been seen.
+		 * @param p: Packed packet from the IMU process
+		 * @param out: Array of at least MAX_OUT packets for any completed packets
+		 * @return Number of packets written to out, -1 if p is not IMU data
+		 */
+		int encode(const Packet &p, Packet *out);
+
+		/**
+		 * Pack up any samples waiting for a packet to fill
+		 * @param out: Space for one packet
+		 * @return Number of packets written to out
+		 */
+		int flush(Packet *out);
+
+	private:
+		static const int MAX_SAMPLES = 15;
+		int _interval;
+		int _since_key = 0;
+		bool _have_prev = false;
+		ImuSample _prev;
+		int32_t _prev_dt = 0;
+		uint16_t _count = 0; // Number of the next sample
+		// Samples waiting to be packed
+		uint32_t _pending[MAX_SAMPLES][10];
+		int _n = 0;
+		uint16_t _first;
+		int _widths[4] = {0, 0, 0, 0};
+		ImuAssembler _halves;
+	};
+
+	class ImuDecoder {
+	public:
+		static const int MAX_OUT = 15; // Most samples produced by one call
+
+		/**
+		 * Decode a packet from the downlink
+		 * @param p: Packed packet as received
+		 * @param out: Array of at least MAX_OUT samples
+		 * @return Number of samples written to out, -1 if p is not IMU data
+		 */
+		int decode(const Packet &p, ImuSample *out);
+
+		/**
+		 * @return Number of samples which could not be decoded because an
+		 * earlier packet was lost
+		 */
+		unsigned long dropped() const {
+			return _dropped;
+		}
+
+	private:
+		bool _synced = false;
+		ImuSample _prev;
+		int32_t _prev_dt = 0;
+		uint16_t _next;
+		ImuAssembler _halves;
+		unsigned long _dropped = 0;
+	};
+}
+
+#endif /* IMU_CODEC_H */
@@ -0,0 +1,105 @@
+/**
+ * REXUS PIOneERS - Pi_1
+ * link_window.cpp
+ * Purpose: Function implementations for the LinkWindow class
+ */
+
+#include <unistd.h>
+#include <time.h>
+
+#include "link_window.h"
+#include "protocol.h"
+
+namespace comms {
+
+	LinkWindow::LinkWindow(int capacity) : _slots(capacity), _capacity(capacity) {
+		// Different every time the process starts so the other side can
+		// tell frame numbers have started again
+		struct timespec ts;
+		clock_gettime(CLOCK_REALTIME, &ts);
+		_session = (uint32_t) ts.tv_nsec ^ ((uint32_t) ts.tv_sec << 12) ^
+				((uint32_t) getpid() << 20);
+		if (_session == 0)
+			_session = 1;
+	}
+
+	int LinkWindow::add(const void *data, size_t len) {
+		if (room() <= 0)
+			return -1;
+		Slot &s = _slots[_next % _capacity];
+		int size = Protocol::packLarge(s.frame, ID_BULK, (byte2_t) _next, data, len);
+		if (size < 0)
+			return -2;
+		s.size = size;
+		_next++;
+		return size;
+	}
+
+	const LargePacket *LinkWindow::unsent(int &size) const {
+		if (_sent == _next)
+			return NULL;
+		const Slot &s = _slots[_sent % _capacity];
+		size = s.size;
+		return &s.frame;
+	}
+
+	void LinkWindow::drop_oldest() {
+		if (_base == _next)
+			return;
+		_base++;
+		if ((int32_t) (_sent - _base) < 0)
+			_sent = _base;
+		_dropped++;
+	}
+
+	int LinkWindow::accept(byte2_t index) {
+		_ack_due = true; // Even for a repeat, the ack for it may have been lost
+		if (_peer == 0)
+			_recv_next = index; // No ack seen yet, nothing to check against
+		int32_t delta = (int16_t) (index - (byte2_t) _recv_next);
+		if (delta < 0) {
+			_duplicates++;
+			return -1;
+		}
+		_lost += delta;
+		_recv_next += delta + 1;
+		return delta;
+	}
+
+	void LinkWindow::make_ack(Packet &p) const {
+		LinkAck a;
+		a.session = _session;
+		a.base = _base;
+		a.peer_session = _peer;
+		a.next = _recv_next;
+		Protocol::pack<ID_ACK>(p, 0, a);
+	}
+
+	int LinkWindow::on_ack(const Packet &p) {
+		Packet copy = p;
+		byte2_t index;
+		LinkAck a;
+		if (Protocol::unpack<ID_ACK>(copy, index, a))
+			return -1;
+		// Their sending side
+		if (a.session != _peer) {
+			_peer = a.session;
+			_recv_next = a.base;
+			_ack_due = true;
+		} else if ((int32_t) (a.base - _recv_next) > 0) {
+			// They gave up on frames we never received
+			_lost += a.base - _recv_next;
+			_recv_next = a.base;
+		}
+		// Our sending side
+		if (a.peer_session != _session)
+			return 0; // Acks frames from before we restarted
+		uint32_t released = a.next - _base;
+		if (released == 0 || released > _next - _base)
+			return 0;
+		_base = a.next;
+		if ((int32_t) (_sent - _base) < 0)
+			_sent = _base;
+		return released;
+	}
+}
@@ -0,0 +1,193 @@
+/**
+ * REXUS PIOneERS - Pi_1
+ * link_window.h
+ * Purpose: Class definition for the sliding window which makes sure data on
+ *			the Ethernet link between the Pis survives the connection being
+ *			lost. Every ID_BULK frame sent is kept until the other Pi
+ *			acknowledges it and anything not acknowledged is sent again on
+ *			the next connection. Frames are sent without waiting for acks
+ *			until the window is full.
+ *
+ * Each side sends an ID_ACK packet (LinkAck) when a connection starts and
+ * after receiving frames. It says which session (run of frame numbers) the
+ * side is sending, the oldest frame it still holds, and how far it has got
+ * receiving the other side's frames. Acks are cumulative so a lost ack is
+ * covered by the next one. A new session means the other side restarted
+ * and its frames are numbered from the start again.
+ */
+
+#ifndef LINK_WINDOW_H
+#define LINK_WINDOW_H
+
+#include <stdint.h>
+#include <cstddef>
+#include <vector>
+
+#include "packet.h"
+
+namespace comms {
+
+	class LinkWindow {
+	public:
+
+		/**
+		 * @param capacity: Most frames held waiting for an ack
+		 */
+		LinkWindow(int capacity = 256);
+
+		// Sending
+
+		/**
+		 * @return Number of frames which can be added before the window is full
+		 */
+		int room() const {
+			return _capacity - (int) (_next - _base);
+		}
+
+		/**
+		 * Pack data into the next ID_BULK frame and keep it until acknowledged
+		 * @param data: Bundled packets
+		 * @param len: Bytes of data (at most LARGE_PACKET_MAX_DATA)
+		 * @return Size of the frame, -1 if the window is full, -2 if the data
+		 * is too long
+		 */
+		int add(const void *data, size_t len);
+
+		/**
+		 * @param size: Set to the size of the frame
+		 * @return Next frame to be sent, NULL if all have been sent
+		 */
+		const LargePacket *unsent(int &size) const;
+
+		/**
+		 * Mark the frame from unsent() as sent
+		 */
+		void sent() {
+			_sent++;
+		}
+
+		/**
+		 * Send everything not yet acknowledged again, after reconnecting.
+		 * An ack is due so the other side learns the state of the window
+		 * before the frames arrive.
+		 */
+		void rewind() {
+			_resent += _sent - _base;
+			_sent = _base;
+			_ack_due = true;
+		}
+
+		/**
+		 * @return Number of frames waiting for an ack
+		 */
+		int unacked() const {
+			return _next - _base;
+		}
+
+		/**
+		 * @return Number of the next frame to be added
+		 */
+		uint32_t next() const {
+			return _next;
+		}
+
+		/**
+		 * @param seq: Number of a frame still held
+		 * @param size: Set to the size of the frame
+		 */
+		const LargePacket *frame(uint32_t seq, int &size) const {
+			const Slot &s = _slots[seq % _capacity];
+			size = s.size;
+			return &s.frame;
+		}
+
+		/**
+		 * Give up on the oldest frame to make room, for when nobody is
+		 * receiving. The other side counts it as lost when it next connects.
+		 */
+		void drop_oldest();
+
+		// Receiving
+
+		/**
+		 * Check the index of a received ID_BULK frame
+		 * @return 0 if it is the next frame, >0 the number of frames missed
+		 * before it, -1 if it has been received before and should be ignored
+		 */
+		int accept(byte2_t index);
+
+		// Acknowledging
+
+		/**
+		 * @return true if frames have been received since the last ack sent
+		 */
+		bool ack_due() const {
+			return _ack_due;
+		}
+
+		/**
+		 * Pack an ID_ACK packet with the state of the window
+		 */
+		void make_ack(Packet &p) const;
+
+		/**
+		 * Mark the ack from make_ack() as sent
+		 */
+		void ack_sent() {
+			_ack_due = false;
+		}
+
+		/**
+		 * Apply an ID_ACK packet from the other side
+		 * @param p: Packed packet as received
+		 * @return Number of frames released, -1 if p is corrupt or not an ack
+		 */
+		int on_ack(const Packet &p);
+
+		uint32_t session() const {
+			return _session;
+		}
+
+		// Counters
+
+		unsigned long resent() const {
+			return _resent;
+		}
+
+		unsigned long duplicates() const {
+			return _duplicates;
+		}
+
+		unsigned long lost() const {
+			return _lost;
+		}
+
+		unsigned long dropped() const {
+			return _dropped;
+		}
+
+	private:
+
+		struct Slot {
+			LargePacket frame;
+			int size;
+		};
+		std::vector<Slot> _slots;
+		int _capacity;
+		uint32_t _session;
+		// Sending: frames from _base to _next are held, up to _sent sent
+		uint32_t _base = 0;
+		uint32_t _sent = 0;
+		uint32_t _next = 0;
+		// Receiving
+		uint32_t _peer = 0; // Session of the other side, 0 if not known
+		uint32_t _recv_next = 0; // Next frame expected
+		bool _ack_due = false;
+		unsigned long _resent = 0;
+		unsigned long _duplicates = 0;
+		unsigned long _lost = 0;
+		unsigned long _dropped = 0;
+	};
+}
+
+#endif /* LINK_WINDOW_H */
@@ -0,0 +1,105 @@
+/**
+ * REXUS PIOneERS - Pi_1
+ * message.cpp
+ * Purpose: Function declarations for message fragmentation and reassembly
+ */
+#include <cstring>
+
+#include "message.h"
+#include "protocol.h"
+
+namespace comms {
+
+	int MsgFragmenter::begin(const char *msg, size_t len) {
+		if (len > (size_t) MAX_LEN)
+			len = MAX_LEN;
+		_msg = msg;
+		_len = len;
+		_frag = 0;
+		_total = (len + 15) / 16;
+		if (_total == 0)
+			_total = 1; // Empty message still takes a packet
+		return _total;
+	}
+
+	bool MsgFragmenter::next(Packet &p) {
+		if (_frag >= _total)
+			return false;
+		bool last = (_frag == _total - 1);
+		byte2_t index = (_seq << 8) | (last ? 0x80 : 0) | _frag;
+		size_t off = _frag * 16;
+		size_t n = last ? _len - off : 16;
+		p.sync = 0x00;
+		p.ID = _id;
+		p.index = index;
+		memcpy(p.data, _msg + off, n);
+		memset(p.data + n, '\0', sizeof (p.data) - n);
+		Protocol::seal(p);
+		if (last)
+			_seq++;
+		_frag++;
+		return true;
+	}
+
+	int MsgReassembler::add(const Packet &p, int64_t now_ms, char *out) {
+		Packet copy = p;
+		byte1_t id;
+		byte2_t index;
+		byte1_t data[16];
+		if (Protocol::unpack(copy, id, index, data) || (id != ID_MSG1 && id != ID_MSG2))
+			return -1;
+		uint8_t seq = index >> 8;
+		bool last = index & 0x80;
+		int frag = index & 0x7F;
+
+		// Find the message this belongs to, giving up on any too old
+		Slot *slot = NULL;
+		Slot *oldest = NULL;
+		Slot *free_slot = NULL;
+		for (int i = 0; i < SLOTS; i++) {
+			Slot &s = _slots[i];
+			if (s.used && now_ms - s.started > _timeout) {
+				s.used = false;
+				_lost++;
+			}
+			if (!s.used) {
+				if (!free_slot)
+					free_slot = &s;
+				continue;
+			}
+			if (s.id == id && s.seq == seq)
+				slot = &s;
+			if (!oldest || s.started < oldest->started)
+				oldest = &s;
+		}
+		if (!slot) {
+			slot = free_slot;
+			if (!slot) {
+				slot = oldest;
+				_lost++;
+			}
+			slot->used = true;
+			slot->id = id;
+			slot->seq = seq;
+			slot->started = now_ms;
+			slot->have[0] = slot->have[1] = 0;
+			slot->total = 0;
+		}
+		memcpy(slot->text + frag * 16, data, 16);
+		slot->have[frag >> 6] |= 1ull << (frag & 63);
+		if (last) {
+			slot->total = frag + 1;
+			slot->last_len = strnlen((char*) data, 16);
+		}
+		if (slot->total == 0)
+			return 0;
+		for (int i = 0; i < slot->total; i++)
+			if (!((slot->have[i >> 6] >> (i & 63)) & 1))
+				return 0;
+		int len = (slot->total - 1) * 16 + slot->last_len;
+		memcpy(out, slot->text, len);
+		out[len] = '\0';
+		slot->used = false;
+		return len;
+	}
+}
@@ -0,0 +1,107 @@
+/**
+ * REXUS PIOneERS - Pi_1
+ * message.h
+ * Purpose: Splitting text messages into ID_MSG1/ID_MSG2 packets and putting
+ *			them back together. Neither class allocates memory.
+ *
+ * Index of a message packet:
+ * bits 8-15: Message number (wraps at 256)
+ * bit 7: Set on the last fragment of a message
+ * bits 0-6: Fragment number
+ * Every fragment but the last holds 16 characters, the last is padded with
+ * zeros.
+ */
+
+#ifndef MESSAGE_H
+#define MESSAGE_H
+
+#include <stdint.h>
+#include <cstddef>
+
+#include "packet.h"
+
+namespace comms {
+
+	class MsgFragmenter {
+	public:
+		static const int MAX_FRAGMENTS = 128;
+		static const int MAX_LEN = MAX_FRAGMENTS * 16;
+
+		/**
+		 * @param id: ID_MSG1 or ID_MSG2
+		 */
+		MsgFragmenter(byte1_t id) : _id(id) {
+		}
+
+		/**
+		 * Start sending a message. The text is not copied so must stay
+		 * valid until next() returns false. Longer messages are cut to
+		 * MAX_LEN.
+		 * @return Number of packets the message needs
+		 */
+		int begin(const char *msg, size_t len);
+
+		/**
+		 * Pack the next fragment of the message
+		 * @param p: Packet to fill
+		 * @return false once the whole message has been packed
+		 */
+		bool next(Packet &p);
+
+	private:
+		byte1_t _id;
+		uint8_t _seq = 0;
+		const char *_msg = NULL;
+		size_t _len = 0;
+		int _frag = 0;
+		int _total = 0;
+	};
+
+	class MsgReassembler {
+	public:
+		static const int SLOTS = 4; // Messages which can be in progress at once
+		static const int MAX_LEN = MsgFragmenter::MAX_LEN;
+
+		/**
+		 * @param timeout_ms: Time to wait for missing fragments
+		 */
+		MsgReassembler(int64_t timeout_ms = 10000) : _timeout(timeout_ms) {
+		}
+
+		/**
+		 * Add a packet
+		 * @param p: Packed packet
+		 * @param now_ms: Current time, only used for timeouts
+		 * @param out: Buffer of MAX_LEN + 1 characters for a completed message
+		 * @return Length of the message in out, 0 if no message is complete,
+		 * -1 if p is not a message
+		 */
+		int add(const Packet &p, int64_t now_ms, char *out);
+
+		/**
+		 * @return Number of messages given up on because fragments were missing
+		 */
+		unsigned long lost() const {
+			return _lost;
+		}
+
+	private:
+
+		struct Slot {
+			bool used = false;
+			byte1_t id;
+			uint8_t seq;
+			int64_t started;
+			uint64_t have[2]; // Bit set for each fragment received
+			int total; // Number of fragments, 0 until the last one arrives
+			int last_len;
+			char text[MAX_LEN];
+		};
+
+		Slot _slots[SLOTS];
+		int64_t _timeout;
+		unsigned long _lost = 0;
+	};
+}
+
+#endif /* MESSAGE_H */
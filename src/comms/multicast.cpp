@@ -0,0 +1,95 @@
+/**
+ * REXUS PIOneERS - Pi_1
+ * multicast.cpp
+ * Purpose: Function implementations for the MulticastSocket class
+ */
+
+#include <errno.h>
+#include <unistd.h>
+#include <strings.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+
+#include "multicast.h"
+
+namespace comms {
+
+	int MulticastSocket::open(const std::string &group, int send_port, int recv_port,
+			const std::string &iface) {
+		close();
+		struct in_addr group_addr, iface_addr;
+		if (inet_aton(group.c_str(), &group_addr) == 0) {
+			errno = EINVAL;
+			return -1;
+		}
+		iface_addr.s_addr = htonl(INADDR_ANY);
+		if (!iface.empty() && inet_aton(iface.c_str(), &iface_addr) == 0) {
+			errno = EINVAL;
+			return -1;
+		}
+		_fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+		if (_fd < 0)
+			return -1;
+		int reuse = 1;
+		setsockopt(_fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof (reuse));
+		// Bind to the group so only datagrams for it are received
+		struct sockaddr_in local;
+		bzero(&local, sizeof (local));
+		local.sin_family = AF_INET;
+		local.sin_addr = group_addr;
+		local.sin_port = htons(recv_port);
+		struct ip_mreq mreq;
+		mreq.imr_multiaddr = group_addr;
+		mreq.imr_interface = iface_addr;
+		unsigned char ttl = 1;
+		if (bind(_fd, (struct sockaddr*) &local, sizeof (local)) < 0 ||
+				setsockopt(_fd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof (mreq)) < 0 ||
+				setsockopt(_fd, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof (ttl)) < 0 ||
+				setsockopt(_fd, IPPROTO_IP, IP_MULTICAST_IF, &iface_addr, sizeof (iface_addr)) < 0) {
+			int e = errno;
+			close();
+			errno = e;
+			return -1;
+		}
+		bzero(&_dest, sizeof (_dest));
+		_dest.sin_family = AF_INET;
+		_dest.sin_addr = group_addr;
+		_dest.sin_port = htons(send_port);
+		return 0;
+	}
+
+	int MulticastSocket::send(const void *data, size_t len) {
+		while (1) {
+			ssize_t n = sendto(_fd, data, len, 0, (struct sockaddr*) &_dest, sizeof (_dest));
+			if (n >= 0)
+				return n;
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN || errno == EWOULDBLOCK || errno == ENOBUFS)
+				return 0;
+			return -1;
+		}
+	}
+
+	int MulticastSocket::recv(void *data, size_t len) {
+		while (1) {
+			ssize_t n = ::recv(_fd, data, len, 0);
+			if (n >= 0)
+				return n;
+			if (errno == EINTR)
+				continue;
+			// A datagram refused by the other side shows up as an error on a
+			// later call, it is not a reason to stop
+			if (errno == EAGAIN || errno == EWOULDBLOCK || errno == ECONNREFUSED)
+				return 0;
+			return -1;
+		}
+	}
+
+	void MulticastSocket::close() {
+		if (_fd >= 0)
+			::close(_fd);
+		_fd = -1;
+	}
+}
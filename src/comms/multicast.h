@@ -0,0 +1,70 @@
+/**
+ * REXUS PIOneERS - Pi_1
+ * multicast.h
+ * Purpose: Class definition for a non-blocking UDP multicast socket, used as
+ *			an alternative to the TCP link between the Pis. Each datagram
+ *			stands alone so one lost datagram never holds up later ones,
+ *			which suits telemetry where fresh data is worth more than old.
+ *
+ * Each Pi sends to the group on one port and receives on another so it does
+ * not read back its own datagrams (multicast is looped back to the sender).
+ * The TTL is 1 so datagrams never leave the local network.
+ */
+
+#ifndef MULTICAST_H
+#define MULTICAST_H
+
+#include <cstddef>
+#include <string>
+#include <netinet/in.h>
+
+namespace comms {
+
+	class MulticastSocket {
+	public:
+
+		MulticastSocket() {
+		}
+
+		~MulticastSocket() {
+			close();
+		}
+
+		/**
+		 * Create the socket and join the group
+		 * @param group: Multicast address (e.g. 239.255.31.41)
+		 * @param send_port: Port datagrams are sent to
+		 * @param recv_port: Port datagrams are received on
+		 * @param iface: Address of the interface to use, empty for the default
+		 * @return 0 = success, -1 = failure (errno is set)
+		 */
+		int open(const std::string &group, int send_port, int recv_port,
+				const std::string &iface = "");
+
+		/**
+		 * Send one datagram without blocking
+		 * @return Bytes sent, 0 if the socket buffer is full, -1 on error
+		 */
+		int send(const void *data, size_t len);
+
+		/**
+		 * Receive one datagram without blocking
+		 * @param data: Buffer for the datagram, longer ones are cut short
+		 * @param len: Size of the buffer
+		 * @return Bytes received, 0 if none are waiting, -1 on error
+		 */
+		int recv(void *data, size_t len);
+
+		int fd() const {
+			return _fd;
+		}
+
+		void close();
+
+	private:
+		int _fd = -1;
+		struct sockaddr_in _dest;
+	};
+}
+
+#endif /* MULTICAST_H */
@@ -1,6 +1,10 @@
 #include <cstdint>
 #include <iostream>
+#include <unistd.h>
+#include <poll.h>
+#include <errno.h>
 #include "packet.h"
+#include "payloads.h"
 
 namespace comms {
 
@@ -26,22 +30,37 @@ namespace comms {
 	   Length of actual data in bytes. Return 0 if id invalid.
 	 */
 	size_t lengthByID(byte1_t id) {
-		//Status or message
 		switch (id) {
-			case ID_MSG1:
-			case ID_MSG2:
-			case ID_STATUS1:
-			case ID_STATUS2:
-				return 16;
-			case ID_DATA1:
-			case ID_DATA3:
-				return 12;
-			case ID_DATA4:
-				return 14;
-			case ID_DATA2:
-				return 10;
+#define COMMS_LENGTH_CASE(id, T, size) case id: return Payload<id>::length;
+			COMMS_PAYLOADS(COMMS_LENGTH_CASE)
+#undef COMMS_LENGTH_CASE
 			default:
 				return 0;
 		}
 	}
+
+	int writePackets(int fd, const Packet *p, size_t n) {
+		const byte1_t *buf = (const byte1_t*) p;
+		size_t total = n * sizeof (Packet);
+		size_t done = 0;
+		while (done < total) {
+			ssize_t w = write(fd, buf + done, total - done);
+			if (w >= 0) {
+				done += w;
+			} else if (errno == EINTR) {
+				continue;
+			} else if (errno == EAGAIN && done % sizeof (Packet)) {
+				// Wait for room to finish off the packet we started
+				struct pollfd fds[1];
+				fds[0].fd = fd;
+				fds[0].events = POLLOUT;
+				poll(fds, 1, -1);
+			} else {
+				break;
+			}
+		}
+		if (done == 0 && total > 0)
+			return (errno == EAGAIN) ? 0 : -1;
+		return done / sizeof (Packet);
+	}
 }
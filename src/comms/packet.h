@@ -12,9 +12,17 @@
 #define ID_STATUS2 0b01100000 // Status from Pi 2
 #define ID_DATA1 0b00010000 // Acc/Gyr from Pi 1
 #define ID_DATA2 0b00010001 // Mag/Time from Pi 1
+#define ID_IMU_DELTA 0b00010010 // Delta encoded IMU samples from Pi 1 (see imu_codec.h)
 #define ID_DATA3 0b00100000 // Acc/Gyr from Pi 2
 #define ID_DATA4 0b00100010 //Mag/ImP/Time from Pi 2
 #define ID_CMD 0b11000000 // Command
+#define ID_BULK 0b00110000 // Several packets bundled into one large frame
+#define ID_ACK 0b00110001 // Acknowledges ID_BULK frames on the Ethernet link (see link_window.h)
+#define ID_PING 0b00110010 // Round trip and clock offset between the Pis (see clock_sync.h)
+#define ID_PONG 0b00110011 // Answer to ID_PING
+
+#define LARGE_PACKET_MAX_DATA 248 // Longest COBS run the encoder can handle
+#define LARGE_PACKET_OVERHEAD 9 // Bytes in a large frame besides the data
 
 namespace comms {
 	typedef uint8_t byte1_t;
@@ -43,6 +51,27 @@ namespace comms {
 		byte1_t eop;
 	};
 
+	/*
+	 * Variable length frame for the Ethernet link. Structure is:
+	 * byte 1: Sync Byte (0)
+	 * byte 2: Overhead Byte (for COBS)
+	 * byte 3: ID
+	 * byte 4-5: Index of frame
+	 * byte 6: Length of data (n)
+	 * byte 7-(6+n): Data
+	 * next 2 bytes: Checksum
+	 * last byte: End of Packet (0)
+	 * A frame with 15 bytes of data has exactly the layout of a Packet.
+	 */
+	struct LargePacket {
+		byte1_t sync;
+		byte1_t ohb;
+		byte1_t ID;
+		byte2_t index;
+		byte1_t length;
+		byte1_t data[LARGE_PACKET_MAX_DATA + 3]; // Data, checksum and eop
+	};
+
 #pragma pack(pop)
 
 	std::ostream& operator<<(std::ostream &o, Packet &p);
@@ -55,6 +84,19 @@ namespace comms {
 	   Length of actual data in bytes. Return 0 if id invalid.
 	 */
 	size_t lengthByID(byte1_t id);
+
+	/**
+	   Write a contiguous array of packets with a single write() call. If the
+	   write is cut short part way through a packet the rest of that packet is
+	   still written so the stream never holds half a packet.
+	   @params
+	   fd: file descriptor to write to
+	   p: first packet
+	   n: number of packets
+	   @return
+	   Number of whole packets written, -1 on error.
+	 */
+	int writePackets(int fd, const Packet *p, size_t n);
 }
 
 #endif
@@ -0,0 +1,133 @@
+/**
+ * REXUS PIOneERS - Pi_1
+ * payloads.h
+ * Purpose: Layout of the data carried by each packet ID. Every ID is mapped
+ *			to a packed struct at compile time so Protocol::pack<ID> and
+ *			Protocol::unpack<ID> only accept the right layout and copy a
+ *			known number of bytes. Multi-byte fields are little endian as on
+ *			the Pi (except the IMU time which has always been big endian).
+ *
+ * To add a packet type: define the ID in packet.h, a struct here and add
+ * it to COMMS_PAYLOADS.
+ */
+
+#ifndef PAYLOADS_H
+#define PAYLOADS_H
+
+#include <stdint.h>
+#include <cstddef>
+
+#include "packet.h"
+
+namespace comms {
+
+#pragma pack(push, 1)
+
+	// ID_DATA1: Accelerometer and gyroscope registers from RPi_IMU
+	struct ImuAccGyr {
+		int16_t acc[3];
+		int16_t gyr[3];
+	};
+
+	// ID_DATA2: Magnetometer registers and time of the measurement
+	struct ImuMagTime {
+		int16_t mag[3];
+		byte1_t time_be[4]; // Microseconds, big endian
+
+		int32_t time() const {
+			return (int32_t) (((uint32_t) time_be[0] << 24) | (time_be[1] << 16) |
+					(time_be[2] << 8) | time_be[3]);
+		}
+
+		void set_time(int32_t t) {
+			time_be[0] = (byte1_t) (0xFF & t >> 24);
+			time_be[1] = (byte1_t) (0xFF & t >> 16);
+			time_be[2] = (byte1_t) (0xFF & t >> 8);
+			time_be[3] = (byte1_t) (0xFF & t >> 0);
+		}
+	};
+
+	// ID_DATA3: First part of a frame from the ImP
+	struct ImpData1 {
+		byte1_t frame[12];
+	};
+
+	// ID_DATA4: Rest of a frame from the ImP
+	struct ImpData2 {
+		byte1_t frame[14];
+	};
+
+	// ID_MSG1, ID_MSG2, ID_STATUS1, ID_STATUS2: Text, zero padded
+	struct Text {
+		char text[16];
+	};
+
+	// ID_IMU_DELTA: Delta encoded IMU samples (see imu_codec.h)
+	struct ImuDelta {
+		byte1_t bits[16];
+	};
+
+	// ID_CMD: Command from the ground
+	struct Command {
+		byte1_t cmd;
+		byte1_t arg[15];
+	};
+
+	// ID_ACK: State of the Ethernet link window (see link_window.h)
+	struct LinkAck {
+		uint32_t session; // Identifies the sender's run of frame numbers
+		uint32_t base; // Oldest frame the sender still holds
+		uint32_t peer_session; // Session of the frames being acknowledged
+		uint32_t next; // Every frame before this has been received
+	};
+	// ID_PING: Asks the other Pi for the time (see clock_sync.h)
+	struct LinkPing {
+		int64_t sent_us; // Sender's clock, us since 1970
+	};
+	// ID_PONG: Answers an ID_PING, has the same index
+	struct LinkPong {
+		uint32_t ping_us; // Low 32 bits of the ping's sent_us
+		uint32_t hold_us; // Time from the ping arriving to the pong being sent
+		int64_t received_us; // Time the ping arrived on the answering Pi's clock
+	};
+
+#pragma pack(pop)
+
+	/*
+	 * Every packet ID and the struct it carries. Expanded with X(id, type,
+	 * size), size is checked against the struct.
+	 */
+#define COMMS_PAYLOADS(X) \
+	X(ID_DATA1, ImuAccGyr, 12) \
+	X(ID_DATA2, ImuMagTime, 10) \
+	X(ID_DATA3, ImpData1, 12) \
+	X(ID_DATA4, ImpData2, 14) \
+	X(ID_MSG1, Text, 16) \
+	X(ID_MSG2, Text, 16) \
+	X(ID_STATUS1, Text, 16) \
+	X(ID_STATUS2, Text, 16) \
+	X(ID_IMU_DELTA, ImuDelta, 16) \
+	X(ID_CMD, Command, 16) \
+	X(ID_ACK, LinkAck, 16) \
+	X(ID_PING, LinkPing, 8) \
+	X(ID_PONG, LinkPong, 16)
+
+	/**
+	 * Payload<ID>::type is the struct for a packet ID. Using an ID which
+	 * is not registered fails to compile.
+	 */
+	template<byte1_t ID>
+	struct Payload;
+
+#define COMMS_PAYLOAD_ENTRY(id, T, size) \
+	static_assert(sizeof (T) == size, #T " has the wrong size"); \
+	static_assert(sizeof (T) <= sizeof (((Packet*) 0)->data), #T " does not fit in a packet"); \
+	template<> struct Payload<id> { \
+		typedef T type; \
+		static const size_t length = sizeof (T); \
+	};
+	COMMS_PAYLOADS(COMMS_PAYLOAD_ENTRY)
+#undef COMMS_PAYLOAD_ENTRY
+}
+
+#endif /* PAYLOADS_H */
@@ -56,6 +56,7 @@ namespace comms {
 			else
 				return false;
 		}
+		return false;
 	}
 
 	Pipe::Pipe() {
@@ -108,6 +109,18 @@ namespace comms {
 			return -3; // error writing to pipe
 	}
 
+	int Pipe::binwriteBatch(const Packet* p, size_t n) {
+		int fd = getWritefd();
+		if (fd < 0)
+			return -1; // process not forked
+		if (!poll_write(fd))
+			return 0; // pipe unavailable for write
+		int written = writePackets(fd, p, n);
+		if (written < 0)
+			return -3; // error writing to pipe
+		return written;
+	}
+
 	int Pipe::binread(void* data, int n) {
 		// Reads upto n bytes into the character array, returns number of bytes read
 		int fd = getReadfd();
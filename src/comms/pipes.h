@@ -16,6 +16,8 @@
 #include <stdint.h>
 #include <error.h>  // For errno
 
+#include "packet.h"
+
 namespace comms {
 
 	class Pipe {
@@ -61,6 +63,17 @@ namespace comms {
 		 */
 		int binwrite(const void* data, int n);
 
+		/**
+		 * Writes an array of packets to the pipe with a single system call.
+		 *
+		 * @param p: Array of packets
+		 * @param n: Number of packets in the array
+		 * @return The number of whole packets written or an error code:
+		 * -1: Process not yet forked
+		 * -3: Error while writing
+		 */
+		int binwriteBatch(const Packet* p, size_t n);
+
 		/**
 		 * Read binary data from the pipe.
 		 *
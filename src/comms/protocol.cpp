@@ -1,4 +1,6 @@
 #include "protocol.h"
+#include "crc16.h"
+#include <cstddef>
 #include <iostream>
 
 namespace comms {
@@ -7,6 +9,25 @@ namespace comms {
 		if (pos == NULL)
 			return 0;
 
+		// Use the precomputed tables for all the generators we know about
+		switch (generator) {
+			case CRC16_GEN_BUYPASS:
+				return CRC16<CRC16_GEN_BUYPASS>::compute(pos, len);
+			case CRC16_GEN_XMODEM:
+				return CRC16<CRC16_GEN_XMODEM>::compute(pos, len);
+			case CRC16_GEN_DECTX:
+				return CRC16<CRC16_GEN_DECTX>::compute(pos, len);
+			case CRC16_GEN_T10DIFF:
+				return CRC16<CRC16_GEN_T10DIFF>::compute(pos, len);
+			default:
+				return crc16Bitwise(pos, len, generator);
+		}
+	}
+
+	byte2_t Protocol::crc16Bitwise(const byte1_t* pos, size_t len, byte2_t generator) {
+		if (pos == NULL)
+			return 0;
+
 		byte2_t checksum = 0x0000;
 		int bit_count;
 
@@ -69,29 +90,121 @@ namespace comms {
 
 		memcpy(p.data, p_data, actual_len);
 		memset(p.data + actual_len, '\0', sizeof (p.data) - actual_len);
+		seal(p);
+		return 0;
+	}
 
+	/*
+	 * The CRC and COBS run over several members, so they are given a pointer
+	 * into the whole packet rather than to the first member.
+	 */
+	void Protocol::seal(Packet &p) {
 		//CRC
-		p.checksum = Protocol::crc16Gen(&(p.ID), 19, crc_poly);
+		p.checksum = Protocol::crc16Gen((const byte1_t*) &p + offsetof(Packet, ID), 19, crc_poly);
 		//COBS
-		Protocol::cobsEncode(&(p.ohb), 23, p.sync);
+		Protocol::cobsEncode((byte1_t*) &p + offsetof(Packet, ohb), 23, p.sync);
+	}
 
+	int Protocol::decode(Packet &p) {
+		//COBS decode failure
+		if (!Protocol::cobsDecode((byte1_t*) &p + offsetof(Packet, ohb), 23, p.sync))
+			return -1;
 
+		//CRC mismatch
+		if (Protocol::crc16Gen((const byte1_t*) &p + offsetof(Packet, ID), 19, crc_poly) != p.checksum)
+			return -2;
 		return 0;
 	}
 
 	int Protocol::unpack(Packet &p, byte1_t& id, byte2_t& index, void* p_data) {
+		int err = decode(p);
+		if (err)
+			return err;
+
+		id = p.ID;
+		index = p.index;
+		memcpy(p_data, p.data, sizeof (p.data));
+
+		return 0;
+	}
+
+	int Protocol::packLarge(LargePacket &p, byte1_t id, byte2_t index, const void* p_data, size_t len) {
+		if (len > LARGE_PACKET_MAX_DATA)
+			return -1;
+		p.sync = 0x00;
+		p.ID = id;
+		p.index = index;
+		p.length = len;
+		memcpy(p.data, p_data, len);
+
+		//CRC over ID, index, length and data
+		byte2_t checksum = Protocol::crc16Gen((const byte1_t*) &p + offsetof(LargePacket, ID), len + 4, crc_poly);
+		memcpy(p.data + len, &checksum, sizeof (checksum));
+		//COBS
+		size_t size = len + LARGE_PACKET_OVERHEAD;
+		Protocol::cobsEncode((byte1_t*) &p + offsetof(LargePacket, ohb), size - 1, p.sync);
+
+		return size;
+	}
+
+	int Protocol::unpackLarge(LargePacket &p, size_t size, byte1_t& id, byte2_t& index, void* p_data, size_t& len) {
+		if (size < LARGE_PACKET_OVERHEAD || size > sizeof (LargePacket))
+			return -3;
 		//COBS decode failure
-		if (!Protocol::cobsDecode(&(p.ohb), 23, p.sync))
+		if (!Protocol::cobsDecode((byte1_t*) &p + offsetof(LargePacket, ohb), size - 1, p.sync))
 			return -1;
+		if (p.length != size - LARGE_PACKET_OVERHEAD)
+			return -3;
 
 		//CRC mismatch
-		if (Protocol::crc16Gen(&(p.ID), 19, crc_poly) != p.checksum)
+		byte2_t checksum;
+		memcpy(&checksum, p.data + p.length, sizeof (checksum));
+		if (Protocol::crc16Gen((const byte1_t*) &p + offsetof(LargePacket, ID), p.length + 4, crc_poly) != checksum)
 			return -2;
 
 		id = p.ID;
 		index = p.index;
-		memcpy(p_data, p.data, sizeof (p.data));
+		len = p.length;
+		memcpy(p_data, p.data, len);
 
 		return 0;
 	}
+
+	int Protocol::bundle(byte1_t* buf, size_t len, const Packet &p) {
+		Packet copy = p;
+		byte1_t id;
+		byte2_t index;
+		byte1_t data[sizeof (p.data)];
+		if (Protocol::unpack(copy, id, index, data) != 0)
+			return -1;
+		size_t data_len = lengthByID(id);
+		if (data_len == 0)
+			return -1;
+		if (len + 3 + data_len > LARGE_PACKET_MAX_DATA)
+			return -2;
+		buf[len++] = id;
+		buf[len++] = index & 0xFF;
+		buf[len++] = index >> 8;
+		memcpy(buf + len, data, data_len);
+		return len + data_len;
+	}
+
+	int Protocol::unbundle(const byte1_t* buf, size_t len, Packet* p, int max) {
+		int count = 0;
+		size_t pos = 0;
+		while (pos < len && count < max) {
+			if (pos + 3 > len)
+				return -1;
+			byte1_t id = buf[pos];
+			byte2_t index = buf[pos + 1] | (buf[pos + 2] << 8);
+			size_t data_len = lengthByID(id);
+			if (data_len == 0 || pos + 3 + data_len > len)
+				return -1;
+			byte1_t data[sizeof (p->data)] = {0};
+			memcpy(data, buf + pos + 3, data_len);
+			Protocol::pack(p[count++], id, index, data);
+			pos += 3 + data_len;
+		}
+		return count;
+	}
 }
@@ -3,6 +3,7 @@
 
 #include <cstdio>
 #include "packet.h"
+#include "payloads.h"
 #include <iostream>
 #include <cstring>
 
@@ -20,6 +21,7 @@ namespace comms {
 	public:
 		/**
 		  Generate CRC16 check sequence. Checksum initial value 0x0000. Non-reflected output and input.
+		  Table driven (see crc16.h) for the CRC16_GEN_* generators.
 		  @params
 		  pos: starting position of buffer.
 		  len: total length of buffer. Length should be at least 1 bytes.
@@ -29,6 +31,12 @@ namespace comms {
 		 */
 		static byte2_t crc16Gen(const byte1_t* pos, size_t len, byte2_t generator);
 
+		/**
+		  Bit-by-bit CRC16, used by crc16Gen for generators without a lookup
+		  table. Same parameters and result as crc16Gen.
+		 */
+		static byte2_t crc16Bitwise(const byte1_t* pos, size_t len, byte2_t generator);
+
 		/**
 		  COBS encode. Unencoded data should be placed in range [p+1, p+len-1). *(p+len-1) should be 0.
 		  @params
@@ -78,6 +86,119 @@ namespace comms {
 		   -2: CRC mismatch.
 		 */
 		static int unpack(Packet &p, byte1_t& id, byte2_t& index, void* p_data);
+
+		/**
+			Pack a typed payload (see payloads.h). Only the struct registered
+			for ID is accepted.
+			@params
+			p: address of packet for data to be packed into.
+			index: index of the packet
+			payload: data to send
+		 */
+		template<byte1_t ID>
+		static void pack(Packet &p, byte2_t index, const typename Payload<ID>::type &payload) {
+			p.sync = 0x00;
+			p.ID = ID;
+			p.index = index;
+			memcpy(p.data, &payload, Payload<ID>::length);
+			memset(p.data + Payload<ID>::length, '\0', sizeof (p.data) - Payload<ID>::length);
+			seal(p);
+		}
+
+		/**
+		   Unpack a packet into the payload struct registered for ID.
+		   @params
+		   p: packet to be unpacked
+		   index: the reference packet index.
+		   payload: the reference to the data.
+		   @return
+		   0: Success.
+		   -1: COBS decode failure.
+		   -2: CRC mismatch.
+		   -3: Packet has a different ID.
+		 */
+		template<byte1_t ID>
+		static int unpack(Packet &p, byte2_t& index, typename Payload<ID>::type &payload) {
+			int err = decode(p);
+			if (err)
+				return err;
+			if (p.ID != ID)
+				return -3;
+			index = p.index;
+			memcpy(&payload, p.data, Payload<ID>::length);
+			return 0;
+		}
+
+		/**
+		   Add the checksum and COBS encode a packet whose ID, index and data
+		   have been filled in.
+		 */
+		static void seal(Packet &p);
+
+		/**
+		   COBS decode a packet and check its checksum.
+		   @return
+		   0: Success.
+		   -1: COBS decode failure.
+		   -2: CRC mismatch.
+		 */
+		static int decode(Packet &p);
+
+		/**
+			Pack data into a variable length frame.
+			@params
+			p: frame for data to be packed into.
+			id: id of the frame
+			index: index of the frame
+			p_data: starting position of data buffer.
+			len: number of bytes of data (at most LARGE_PACKET_MAX_DATA)
+			@return
+			>0: Success, total size of the frame in bytes.
+			-1: data too long.
+		 */
+		static int packLarge(LargePacket &p, byte1_t id, byte2_t index, const void* p_data, size_t len);
+
+		/**
+		   Try to unpack a variable length frame.
+		   @params
+		   p: frame to be unpacked
+		   size: total size of the frame in bytes (as received)
+		   id: the reference of ID.
+		   index: the reference frame index.
+		   p_data: buffer of at least LARGE_PACKET_MAX_DATA bytes for the data.
+		   len: the reference of data length.
+		   @return
+		   0: Success.
+		   -1: COBS decode failure.
+		   -2: CRC mismatch.
+		   -3: Size does not match the length field.
+		 */
+		static int unpackLarge(LargePacket &p, size_t size, byte1_t& id, byte2_t& index, void* p_data, size_t& len);
+
+		/**
+		   Append the contents of a packet to the data of an ID_BULK frame.
+		   Only the ID, index and useful data (see lengthByID) are kept.
+		   @params
+		   buf: data of the bulk frame (LARGE_PACKET_MAX_DATA bytes)
+		   len: bytes already used in buf
+		   p: packed packet to add (left unchanged)
+		   @return
+		   New number of bytes used, -1 if the packet is invalid, -2 if it
+		   does not fit.
+		 */
+		static int bundle(byte1_t* buf, size_t len, const Packet &p);
+
+		/**
+		   Split the data of an ID_BULK frame back into packed packets.
+		   @params
+		   buf: data of the bulk frame
+		   len: number of bytes of data
+		   p: array to hold the packets
+		   max: size of the array
+		   @return
+		   Number of packets, -1 if the data is malformed.
+		 */
+		static int unbundle(const byte1_t* buf, size_t len, Packet* p, int max);
 	};
 }
 
@@ -0,0 +1,61 @@
+/**
+ * REXUS PIOneERS - Pi_1
+ * rate_governor.cpp
+ * Purpose: Function declarations for the IMU downlink rate governor
+ */
+#include "rate_governor.h"
+
+namespace comms {
+
+	RateGovernor::RateGovernor(double bytes_per_s, Mode mode, int max_group) {
+		_rate = bytes_per_s / 1e6;
+		// Enough for a keyframe and a delta packet
+		_burst = 3 * sizeof (Packet);
+		_tokens = _burst;
+		_mode = mode;
+		_max_group = max_group;
+	}
+
+	bool RateGovernor::offer(const ImuSample &s, ImuSample &out) {
+		// Sample time goes backwards when the IMU process restarts
+		if (_started && s.time > _last)
+			_tokens += (double) (s.time - _last) * _rate;
+		if (_tokens > _burst)
+			_tokens = _burst;
+		_last = s.time;
+		_started = true;
+
+		if (_mode == AVERAGE) {
+			if (_count == _max_group) {
+				// Too long to be a useful average, start again
+				_dropped += _count;
+				_count = 0;
+			}
+			if (_count == 0) {
+				for (int i = 0; i < 9; i++)
+					_sum[i] = 0;
+				_time_sum = 0;
+			}
+			for (int i = 0; i < 9; i++)
+				_sum[i] += s.axes[i];
+			_time_sum += s.time;
+			_count++;
+		}
+		if (_tokens <= 0) {
+			if (_mode == DECIMATE)
+				_dropped++;
+			return false;
+		}
+		if (_mode == AVERAGE && _count > 1) {
+			for (int i = 0; i < 9; i++)
+				out.axes[i] = (int16_t) (_sum[i] / _count);
+			out.time = (int32_t) (_time_sum / _count);
+			_summarized += _count;
+		} else {
+			out = s;
+		}
+		_count = 0;
+		_forwarded++;
+		return true;
+	}
+}
@@ -0,0 +1,99 @@
+/**
+ * REXUS PIOneERS - Pi_1
+ * rate_governor.h
+ * Purpose: Class definition for the rate governor which keeps the IMU data
+ *			sent to the RXSM within the bytes/s the link can carry. Bytes
+ *			sent on the link are charged to a token bucket and while it is
+ *			empty samples are either dropped (decimation) or averaged into
+ *			the next sample that is sent. Only the downlink is affected,
+ *			data saved locally and sent to Pi 2 stays at the full rate.
+ */
+
+#ifndef RATE_GOVERNOR_H
+#define RATE_GOVERNOR_H
+
+#include <stdint.h>
+
+#include "imu_codec.h"
+
+namespace comms {
+
+	class RateGovernor {
+	public:
+
+		enum Mode {
+			DECIMATE, AVERAGE
+		};
+
+		/**
+		 * @param bytes_per_s: Link budget for everything charged to the governor
+		 * @param mode: What to do with samples which do not fit
+		 * @param max_group: Most samples averaged into one (older ones are
+		 *		  dropped)
+		 */
+		RateGovernor(double bytes_per_s, Mode mode = AVERAGE, int max_group = 32);
+
+		/**
+		 * Offer a sample for the downlink. The sample time is used as the
+		 * clock for the budget.
+		 * @param s: New sample
+		 * @param out: Set to the sample to send (may be an average)
+		 * @return true if out should be sent now
+		 */
+		bool offer(const ImuSample &s, ImuSample &out);
+
+		/**
+		 * Record bytes sent on the link (IMU or anything else sharing it).
+		 * The debt is limited to one burst, so data sent while no samples
+		 * arrive (e.g. while the IMU restarts) only holds the IMU back briefly.
+		 */
+		void charge(size_t bytes) {
+			_tokens -= bytes;
+			if (_tokens < -_burst)
+				_tokens = -_burst;
+		}
+
+		void set_rate(double bytes_per_s) {
+			_rate = bytes_per_s / 1e6;
+		}
+
+		/**
+		 * @return Samples sent (an average counts as one)
+		 */
+		unsigned long forwarded() const {
+			return _forwarded;
+		}
+
+		/**
+		 * @return Samples which were averaged into a sample that was sent
+		 */
+		unsigned long summarized() const {
+			return _summarized;
+		}
+
+		/**
+		 * @return Samples which were not sent in any form
+		 */
+		unsigned long dropped() const {
+			return _dropped;
+		}
+
+	private:
+		double _rate; // Bytes per microsecond
+		double _burst;
+		double _tokens;
+		bool _started = false;
+		int32_t _last;
+		Mode _mode;
+		int _max_group;
+		// Samples held back to be averaged
+		int64_t _sum[9];
+		int64_t _time_sum;
+		int _count = 0;
+		unsigned long _forwarded = 0;
+		unsigned long _summarized = 0;
+		unsigned long _dropped = 0;
+	};
+}
+
+#endif /* RATE_GOVERNOR_H */
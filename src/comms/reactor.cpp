@@ -0,0 +1,83 @@
+/**
+ * REXUS PIOneERS - Pi_1
+ * reactor.cpp
+ * Purpose: Function declarations for the epoll based event loop
+ */
+#include <unistd.h>
+#include <errno.h>
+#include <sys/epoll.h>
+
+#include "reactor.h"
+
+namespace comms {
+
+	Reactor::Reactor() {
+		_epfd = epoll_create1(EPOLL_CLOEXEC);
+		if (_epfd < 0)
+			throw ReactorException("Failed to create epoll instance");
+	}
+
+	void Reactor::add(int fd, Callback on_read, Callback on_write) {
+		struct epoll_event ev;
+		memset(&ev, 0, sizeof (ev));
+		ev.events = EPOLLIN;
+		ev.data.fd = fd;
+		if (epoll_ctl(_epfd, EPOLL_CTL_ADD, fd, &ev) < 0)
+			throw ReactorException("Failed to add file descriptor to epoll");
+		Handler &h = _handlers[fd];
+		h.on_read = on_read;
+		h.on_write = on_write;
+		h.writing = false;
+	}
+
+	void Reactor::want_write(int fd, bool enable) {
+		std::map<int, Handler>::iterator it = _handlers.find(fd);
+		if (it == _handlers.end() || it->second.writing == enable)
+			return;
+		struct epoll_event ev;
+		memset(&ev, 0, sizeof (ev));
+		ev.events = EPOLLIN | (enable ? EPOLLOUT : 0);
+		ev.data.fd = fd;
+		if (epoll_ctl(_epfd, EPOLL_CTL_MOD, fd, &ev) < 0)
+			throw ReactorException("Failed to modify epoll events");
+		it->second.writing = enable;
+	}
+
+	void Reactor::remove(int fd) {
+		if (_handlers.erase(fd))
+			epoll_ctl(_epfd, EPOLL_CTL_DEL, fd, NULL);
+	}
+
+	int Reactor::run_once(int timeout_ms) {
+		const int max_events = 16;
+		struct epoll_event events[max_events];
+		int n = epoll_wait(_epfd, events, max_events, timeout_ms);
+		if (n < 0) {
+			if (errno == EINTR)
+				return 0;
+			throw ReactorException("Error waiting for events");
+		}
+		for (int i = 0; i < n; i++) {
+			int fd = events[i].data.fd;
+			// Look the handler up each time in case a callback removed it
+			std::map<int, Handler>::iterator it = _handlers.find(fd);
+			if (it != _handlers.end() && (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR))) {
+				Callback cb = it->second.on_read;
+				if (cb)
+					cb();
+			}
+			it = _handlers.find(fd);
+			if (it != _handlers.end() && (events[i].events & EPOLLOUT)) {
+				Callback cb = it->second.on_write;
+				if (cb)
+					cb();
+			}
+		}
+		return n;
+	}
+
+	Reactor::~Reactor() {
+		close(_epfd);
+	}
+
+}
@@ -0,0 +1,96 @@
+/**
+ * REXUS PIOneERS - Pi_1
+ * reactor.h
+ * Purpose: Class definition for a small epoll based event loop. File
+ *			descriptors (pipes, UART, sockets) are registered with callbacks
+ *			which are run whenever the descriptor is ready, so the child
+ *			processes can sleep until there is something to do.
+ */
+
+#ifndef REACTOR_H
+#define REACTOR_H
+
+#include <map>
+#include <string>
+#include <cstring>
+#include <functional>
+#include <error.h>  // For errno
+
+namespace comms {
+
+	class Reactor {
+	public:
+		typedef std::function<void() > Callback;
+
+		/**
+		 * Creates the epoll instance
+		 */
+		Reactor();
+
+		/**
+		 * Register a file descriptor. Callbacks should handle all the data
+		 * that is ready as the reactor does not call them again for the same
+		 * data.
+		 *
+		 * @param fd: File descriptor to watch
+		 * @param on_read: Called when fd is readable (or has hung up)
+		 * @param on_write: Called when fd is writable, only while enabled with
+		 *		  want_write()
+		 */
+		void add(int fd, Callback on_read, Callback on_write = Callback());
+
+		/**
+		 * Turn notifications for fd becoming writable on or off
+		 */
+		void want_write(int fd, bool enable);
+
+		/**
+		 * Stop watching a file descriptor. Safe to call from a callback.
+		 */
+		void remove(int fd);
+
+		/**
+		 * Wait for events and dispatch them to their callbacks
+		 *
+		 * @param timeout_ms: Maximum time to wait, -1 to wait forever
+		 * @return Number of events handled (0 on timeout)
+		 */
+		int run_once(int timeout_ms = -1);
+
+		/**
+		 * Closes the epoll instance
+		 */
+		~Reactor();
+
+	private:
+
+		struct Handler {
+			Callback on_read;
+			Callback on_write;
+			bool writing;
+		};
+
+		int _epfd;
+		std::map<int, Handler> _handlers;
+
+		Reactor(const Reactor&);
+		Reactor& operator=(const Reactor&);
+	};
+
+	class ReactorException {
+	public:
+
+		ReactorException(std::string error) {
+			m_error = error + " :" + std::strerror(errno);
+		}
+
+		const char * what() {
+			return m_error.c_str();
+		}
+
+	private:
+		std::string m_error;
+	};
+}
+
+#endif /* REACTOR_H */
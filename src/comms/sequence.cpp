@@ -0,0 +1,113 @@
+/**
+ * REXUS PIOneERS - Pi_1
+ * sequence.cpp
+ * Purpose: Function implementations for the SequenceTracker class
+ */
+
+#include "sequence.h"
+#include "protocol.h"
+
+namespace comms {
+
+	bool SequenceTracker::sequenced(byte1_t id) {
+		switch (id) {
+			case ID_MSG1:
+			case ID_MSG2:
+			case ID_IMU_DELTA:
+			case ID_ACK:
+			case ID_PING:
+			case ID_PONG:
+				return false;
+			default:
+				return true;
+		}
+	}
+
+	int SequenceTracker::add(byte1_t id, byte2_t index, uint32_t *seq) {
+		Stream &s = _streams[id];
+		if (!s.started) {
+			s.started = true;
+			s.highest = index;
+			s.window = 1;
+			s.received++;
+			if (seq)
+				*seq = index;
+			return 0;
+		}
+		// Nearest sequence number with these low 16 bits
+		int32_t delta = (int16_t) (index - (byte2_t) s.highest);
+		if (seq)
+			*seq = s.highest + delta;
+		if (delta > 0) {
+			s.window = (delta >= 64) ? 0 : s.window << delta;
+			s.window |= 1;
+			s.highest += delta;
+			s.received++;
+			s.lost += delta - 1;
+			return delta - 1;
+		}
+		uint32_t back = -delta;
+		if (back > s.highest) {
+			// From before the first packet seen, was never counted as lost
+			s.received++;
+			s.reordered++;
+			return -2;
+		}
+		if (back >= 64 || (s.window >> back) & 1) {
+			// Too old to tell apart from a repeat, assume it is one
+			s.duplicates++;
+			return -1;
+		}
+		s.window |= 1ull << back;
+		s.received++;
+		s.reordered++;
+		s.lost--;
+		return -2;
+	}
+
+	int SequenceTracker::add(const Packet &p) {
+		if (!sequenced(p.ID))
+			return -3;
+		// COBS may have changed the index so it has to be unpacked
+		Packet copy = p;
+		byte1_t id;
+		byte2_t index;
+		byte1_t data[16];
+		if (Protocol::unpack(copy, id, index, data))
+			return -3;
+		return add(id, index);
+	}
+
+	unsigned long SequenceTracker::lost() const {
+		unsigned long total = 0;
+		for (int i = 0; i < 256; i++)
+			total += _streams[i].lost;
+		return total;
+	}
+
+	unsigned long SequenceTracker::duplicates() const {
+		unsigned long total = 0;
+		for (int i = 0; i < 256; i++)
+			total += _streams[i].duplicates;
+		return total;
+	}
+
+	unsigned long SequenceTracker::reordered() const {
+		unsigned long total = 0;
+		for (int i = 0; i < 256; i++)
+			total += _streams[i].reordered;
+		return total;
+	}
+
+	std::ostream& operator<<(std::ostream& o, const SequenceTracker& t) {
+		for (int i = 0; i < 256; i++) {
+			const SequenceTracker::Stream &s = t._streams[i];
+			if (!s.started)
+				continue;
+			o << "[ID " << i << ": received " << s.received << " lost " << s.lost <<
+					" (" << 100 * s.loss_rate() << "%) duplicates " << s.duplicates <<
+					" reordered " << s.reordered << "] ";
+		}
+		return o;
+	}
+}
@@ -0,0 +1,102 @@
+/**
+ * REXUS PIOneERS - Pi_1
+ * sequence.h
+ * Purpose: Class definition for tracking the sequence of packets received
+ *			on a link. The 16 bit packet index of each stream (packet ID) is
+ *			unwrapped to a 32 bit sequence number and packets which are
+ *			missing, repeated or arrive late are counted so the loss rate of
+ *			each link can be measured.
+ *
+ * Only streams where the index counts up by one for each packet can be
+ * tracked: the IMU and ImP data (ID_DATA1-4), status, commands and ID_BULK
+ * frames. Message fragments, delta encoded IMU packets and acks use the index
+ * for other things and are ignored.
+ */
+
+#ifndef SEQUENCE_H
+#define SEQUENCE_H
+
+#include <stdint.h>
+#include <ostream>
+
+#include "packet.h"
+
+namespace comms {
+
+	class SequenceTracker {
+	public:
+
+		struct Stream {
+			bool started = false;
+			uint32_t highest = 0; // Highest sequence number received
+			uint64_t window = 0; // Bit n set if highest - n was received
+			unsigned long received = 0; // Packets received once
+			unsigned long lost = 0; // Not (yet) received
+			unsigned long duplicates = 0;
+			unsigned long reordered = 0; // Received after a later packet
+
+			/**
+			 * @return Fraction of the packets sent which were lost
+			 */
+			double loss_rate() const {
+				unsigned long total = received + lost;
+				return total ? (double) lost / total : 0;
+			}
+		};
+
+		/**
+		 * @return true if packets with this ID have a consecutive index
+		 */
+		static bool sequenced(byte1_t id);
+
+		/**
+		 * Record a packet
+		 * @param id: Stream the packet belongs to
+		 * @param index: Index from the packet
+		 * @param seq: Set to the unwrapped sequence number (if not NULL)
+		 * @return 0 if the next packet in the stream, >0 the number of packets
+		 * missing before this one, -1 if a duplicate, -2 if it arrived late
+		 */
+		int add(byte1_t id, byte2_t index, uint32_t *seq = NULL);
+
+		/**
+		 * Record a packed packet
+		 * @param p: Packet as received
+		 * @return As for add(id, index) or -3 if the packet is corrupt or its
+		 * stream is not tracked
+		 */
+		int add(const Packet &p);
+
+		/**
+		 * Forget a stream, e.g. when its sender starts counting from 0 again
+		 */
+		void reset(byte1_t id) {
+			_streams[id] = Stream();
+		}
+
+		const Stream &stream(byte1_t id) const {
+			return _streams[id];
+		}
+
+		/**
+		 * Totals over all streams
+		 */
+		unsigned long lost() const;
+
+		unsigned long duplicates() const;
+
+		unsigned long reordered() const;
+
+		friend std::ostream& operator<<(std::ostream& o, const SequenceTracker& t);
+
+	private:
+		Stream _streams[256];
+	};
+
+	/**
+	 * Lists the counters of each stream seen, for logging
+	 */
+	std::ostream& operator<<(std::ostream& o, const SequenceTracker& t);
+}
+
+#endif /* SEQUENCE_H */
@@ -0,0 +1,204 @@
+/**
+ * REXUS PIOneERS - Pi_1
+ * shm_pipe.cpp
+ * Purpose: Function declarations for the shared memory pipe class
+ */
+#include <atomic>
+#include <cstring>
+#include <unistd.h>
+#include <poll.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/eventfd.h>
+
+#include "shm_pipe.h"
+#include "pipes.h"
+
+namespace comms {
+
+	/*
+	 * One direction of the pipe, lives in shared memory. head is only
+	 * written by the producer and tail only by the consumer, so no locks are
+	 * needed. The consumer sets waiting before it sleeps on the eventfd and
+	 * the producer only makes a system call to wake it when waiting is set.
+	 */
+	struct ShmPipe::Ring {
+		alignas(64) std::atomic<uint32_t> head;
+		alignas(64) std::atomic<uint32_t> tail;
+		alignas(64) std::atomic<uint32_t> waiting;
+		std::atomic<uint32_t> closed;
+		Packet slots[SLOTS];
+	};
+
+	/*
+	 * Owns the mapping and event file descriptors in this process. Shared by
+	 * all copies of the ShmPipe object.
+	 */
+	struct ShmPipe::Region {
+		Ring *rings = NULL; // rings[0]: parent to child, rings[1]: child to parent
+		int efd[2] = {-1, -1}; // efd[i] signals data in rings[i]
+
+		~Region() {
+			for (int i = 0; i < 2; i++)
+				if (efd[i] >= 0)
+					close(efd[i]);
+			if (rings)
+				munmap(rings, 2 * sizeof (Ring));
+		}
+	};
+
+	static_assert((ShmPipe::SLOTS & (ShmPipe::SLOTS - 1)) == 0,
+			"ShmPipe::SLOTS must be a power of two");
+
+	ShmPipe::ShmPipe() : m_region(new Region) {
+		void *mem = mmap(NULL, 2 * sizeof (Ring), PROT_READ | PROT_WRITE,
+				MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+		if (mem == MAP_FAILED)
+			throw PipeException("Failed to map shared memory");
+		m_region->rings = (Ring*) mem;
+		for (int i = 0; i < 2; i++) {
+			Ring *r = m_region->rings + i;
+			r->head.store(0);
+			r->tail.store(0);
+			// The first write always signals, so a consumer may wait on the
+			// eventfd before it has ever read
+			r->waiting.store(1);
+			r->closed.store(0);
+			m_region->efd[i] = eventfd(0, EFD_NONBLOCK);
+			if (m_region->efd[i] < 0)
+				throw PipeException("Failed to create eventfd");
+		}
+	}
+
+	int ShmPipe::Fork() {
+		return (m_pid = fork());
+	}
+
+	ShmPipe::Ring* ShmPipe::inbound() {
+		return m_region->rings + ((m_pid > 0) ? 1 : 0);
+	}
+
+	ShmPipe::Ring* ShmPipe::outbound() {
+		return m_region->rings + ((m_pid > 0) ? 0 : 1);
+	}
+
+	int ShmPipe::getReadfd() {
+		if (m_pid < 0)
+			return -1;
+		return m_region->efd[(m_pid > 0) ? 1 : 0];
+	}
+
+	int ShmPipe::getWritefd() {
+		if (m_pid < 0)
+			return -1;
+		return m_region->efd[(m_pid > 0) ? 0 : 1];
+	}
+
+	int ShmPipe::binwrite(const void* data, int n) {
+		if (n % sizeof (Packet))
+			return -3; // Only whole packets can be sent
+		int sent = binwriteBatch((const Packet*) data, n / sizeof (Packet));
+		return (sent > 0) ? sent * sizeof (Packet) : sent;
+	}
+
+	int ShmPipe::binwriteBatch(const Packet* p, size_t n) {
+		if (m_pid < 0)
+			return -1; // process not forked
+		int fd = getWritefd();
+		Ring *r = outbound();
+		if (fd < 0 || r->closed.load(std::memory_order_relaxed))
+			return -2; // pipe closed
+		uint32_t head = r->head.load(std::memory_order_relaxed);
+		uint32_t tail = r->tail.load(std::memory_order_acquire);
+		uint32_t count = SLOTS - (head - tail);
+		if (count > n)
+			count = n;
+		for (uint32_t i = 0; i < count; i++)
+			r->slots[(head + i) & (SLOTS - 1)] = p[i];
+		r->head.store(head + count, std::memory_order_release);
+		// Pairs with the fence in binread so a sleeping reader is never missed
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		if (count && r->waiting.load(std::memory_order_relaxed) && r->waiting.exchange(0)) {
+			uint64_t one = 1;
+			write(fd, &one, sizeof (one));
+		}
+		return count;
+	}
+
+	int ShmPipe::space() {
+		if (m_pid < 0)
+			return -1;
+		Ring *r = outbound();
+		uint32_t head = r->head.load(std::memory_order_relaxed);
+		uint32_t tail = r->tail.load(std::memory_order_acquire);
+		return SLOTS - (head - tail);
+	}
+
+	int ShmPipe::binread(void* data, int n) {
+		if (m_pid < 0)
+			return -1; // Process not forked
+		int fd = getReadfd();
+		if (fd < 0)
+			return -2; // pipe closed
+		Ring *r = inbound();
+		Packet *p = (Packet*) data;
+		uint32_t max = n / sizeof (Packet);
+		uint32_t tail = r->tail.load(std::memory_order_relaxed);
+		uint32_t head = r->head.load(std::memory_order_acquire);
+		if (head == tail) {
+			if (r->closed.load())
+				return -2;
+			// Clear old wake ups then tell the writer we need waking
+			uint64_t count;
+			read(fd, &count, sizeof (count));
+			r->waiting.store(1);
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			head = r->head.load(std::memory_order_acquire);
+		}
+		uint32_t count = head - tail;
+		if (count > max)
+			count = max;
+		for (uint32_t i = 0; i < count; i++)
+			p[i] = r->slots[(tail + i) & (SLOTS - 1)];
+		r->tail.store(tail + count, std::memory_order_release);
+		return count * sizeof (Packet);
+	}
+
+	int ShmPipe::waitRead(int timeout_ms) {
+		if (m_pid < 0)
+			return -1;
+		int fd = getReadfd();
+		if (fd < 0)
+			return -2;
+		Ring *r = inbound();
+		if (r->head.load(std::memory_order_acquire) != r->tail.load(std::memory_order_relaxed))
+			return 1;
+		r->waiting.store(1);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		if (r->head.load(std::memory_order_acquire) != r->tail.load(std::memory_order_relaxed))
+			return 1;
+		if (r->closed.load())
+			return -2;
+		struct pollfd fds[1];
+		fds[0].fd = fd;
+		fds[0].events = POLLIN;
+		return poll(fds, 1, timeout_ms);
+	}
+
+	void ShmPipe::close_pipes() {
+		uint64_t one = 1;
+		for (int i = 0; i < 2; i++) {
+			m_region->rings[i].closed.store(1);
+			// Wake the other process so it sees the pipe is closed
+			if (m_region->efd[i] >= 0) {
+				write(m_region->efd[i], &one, sizeof (one));
+				close(m_region->efd[i]);
+				m_region->efd[i] = -1;
+			}
+		}
+	}
+
+	ShmPipe::~ShmPipe() {
+	}
+
+}
@@ -0,0 +1,140 @@
+/**
+ * REXUS PIOneERS - Pi_1
+ * shm_pipe.h
+ * Purpose: Class definition for a shared memory replacement of the Pipe
+ *			class. Packets are passed between the parent and child process
+ *			through a pair of lock-free single producer/single consumer rings
+ *			so sending a packet does not need a system call.
+ *
+ * Unlike a pipe there is no end of file or EPIPE: if the other process dies
+ * without calling close_pipes() this end is never told. The owner has to
+ * watch the other process itself (e.g. waitpid() as in the status() methods
+ * of the classes which fork).
+ */
+
+#ifndef SHM_PIPE_H
+#define SHM_PIPE_H
+
+#include <memory>
+#include <stdint.h>
+
+#include "packet.h"
+
+namespace comms {
+
+	class ShmPipe {
+	public:
+		/**
+		 * Number of packets each direction can hold. Must be a power of two.
+		 */
+		static const uint32_t SLOTS = 1024;
+
+		/**
+		 * Default constructor. Maps the shared memory and creates the event
+		 * file descriptors used for waking the other process.
+		 */
+		ShmPipe();
+
+		/**
+		 * Get the read file descriptor. This is an eventfd which becomes
+		 * readable when packets arrive while the reader is waiting, so it can
+		 * be used with poll() or epoll. Data itself is read with binread().
+		 *
+		 * The reader only counts as waiting before its first binread() and
+		 * after a binread() which returned 0, so once woken it must read
+		 * until it gets 0 before waiting on the fd again.
+		 * @return Read file descriptor based on the process we are in. Returns
+		 * -1 if processes are yet to be forked.
+		 */
+		int getReadfd();
+
+		/**
+		 * Get the write file descriptor (the eventfd used to wake the other
+		 * process).
+		 * @return Write file descriptor based on the process we are in. Returns
+		 * -1 if processes are yet to be forked.
+		 */
+		int getWritefd();
+
+		/**
+		 * Class specific implementation of the fork() system call. Splits the
+		 * processes and assigns each of them a direction of the ring pair.
+		 *
+		 * @return pid of the forked process as with fork(), 0 if we are in the
+		 *		   child process, >0 otherwise
+		 */
+		int Fork();
+
+		/**
+		 * Writes packets to the pipe.
+		 *
+		 * @param data: Buffer array containing whole packets
+		 * @param n: Number of bytes to write (a multiple of sizeof(Packet))
+		 * @return The number of bytes written (0 if the pipe is full) or an
+		 * error code:
+		 * -1: Process not yet forked
+		 * -2: Pipe closed
+		 * -3: n is not a whole number of packets
+		 */
+		int binwrite(const void* data, int n);
+
+		/**
+		 * Writes an array of packets to the pipe.
+		 *
+		 * @param p: Array of packets
+		 * @param n: Number of packets in the array
+		 * @return The number of packets written or an error code as binwrite
+		 */
+		int binwriteBatch(const Packet* p, size_t n);
+
+		/**
+		 * @return Number of packets which can be written before the pipe is
+		 * full, -1 if the process is not yet forked
+		 */
+		int space();
+
+		/**
+		 * Read packets from the pipe. Never blocks.
+		 *
+		 * @param data: Buffer to store the data
+		 * @param n: Maximum number of bytes to read (i.e. size of data buffer)
+		 * @return Number of bytes read, always whole packets (0 if pipe has no
+		 * data for reading) or an error code:
+		 * -1: Process not yet forked
+		 * -2: Pipe closed
+		 */
+		int binread(void* data, int n);
+
+		/**
+		 * Block until there is data to read
+		 *
+		 * @param timeout_ms: Maximum time to wait, -1 to wait forever
+		 * @return >0 if data is ready, 0 on timeout, <0 on error
+		 */
+		int waitRead(int timeout_ms);
+
+		/**
+		 * Marks the pipe as closed for both processes and closes the file
+		 * descriptors
+		 */
+		void close_pipes();
+
+		/**
+		 * Shared memory is released when the last copy is destroyed
+		 */
+		~ShmPipe();
+
+	private:
+		struct Ring;
+		struct Region;
+
+		std::shared_ptr<Region> m_region;
+		int m_pid = -1; // 0 => child, >0 => parent
+
+		Ring* inbound();
+		Ring* outbound();
+	};
+
+}
+
+#endif /* SHM_PIPE_H */
@@ -2,6 +2,7 @@
 #include "transceiver.h"
 #include <unistd.h>
 #include <poll.h>
+#include <errno.h>
 #include "timing/timer.h"
 
 /**
@@ -19,6 +20,7 @@ bool poll_read(const int fd) {
 	// Check if the file descriptor is ready for reading
 	if (poll(fds, 1, timeout))
 		return fds[0].revents & POLLIN;
+	return false;
 }
 
 /**
@@ -41,32 +43,132 @@ bool poll_write(const int fd) {
 		else
 			return false;
 	}
+	return false;
 }
 
 namespace comms {
 
 	int Transceiver::recvPacket(Packet *p, int timeout_ms) {
-		Timer tmr;
-		int n;
+		int n = recvPackets(p, 1, timeout_ms);
+		return (n > 0) ? sizeof (Packet) : n;
+	}
+
+	int Transceiver::recvPackets(Packet *p, int max, int timeout_ms) {
+		int found = extract(p, max);
+		if (found == max)
+			return found;
+		// Only wait for more data when nothing is buffered already
+		int n = fill(found ? 0 : timeout_ms);
+		if (n < 0)
+			return found ? found : -1;
+		return found + extract(p + found, max - found);
+	}
+
+	int Transceiver::fill(int timeout_ms) {
+		// Move any partial frame to the front to make room
+		if (_rx_head > 0) {
+			memmove(_rx_buf, _rx_buf + _rx_head, _rx_tail - _rx_head);
+			_rx_tail -= _rx_head;
+			_rx_head = 0;
+		}
+		if (_rx_tail == RX_BUF_SIZE)
+			return 0;
+		struct pollfd fds[1];
+		fds[0].fd = _fd_recv;
+		fds[0].events = POLLIN;
+		if (poll(fds, 1, timeout_ms) <= 0)
+			return 0;
+		if (!(fds[0].revents & (POLLIN | POLLHUP | POLLERR)))
+			return 0;
+		int n = read(_fd_recv, _rx_buf + _rx_tail, RX_BUF_SIZE - _rx_tail);
+		if (n == 0)
+			return -1; // Other end has closed the connection
+		if (n < 0)
+			return (errno == EINTR || errno == EAGAIN) ? 0 : -1;
+		_rx_tail += n;
+		return n;
+	}
+
+	byte1_t* Transceiver::nextFrame(int &len) {
+		/*
+		 * Every frame on the wire is a zero sync byte, COBS encoded (non-zero)
+		 * bytes and a zero end byte. Search for zeros and take anything with a
+		 * possible frame length between them, anything else is noise.
+		 */
+		const int min_len = LARGE_PACKET_OVERHEAD;
+		const int max_len = sizeof (LargePacket);
 		while (1) {
-			if (poll_read(_fd_recv)) {
-				byte1_t ch = 0;
-				n = read(_fd_recv, &ch, 1);
-				if (n == 1) {
-					n = _checker.push_byte(ch);
-					if (n > 0) {
-						_checker.get_packet(p);
-						return n;
-					}
-				} else {
-					return n;
-				}
+			int avail = _rx_tail - _rx_head;
+			byte1_t *sync = (byte1_t*) memchr(_rx_buf + _rx_head, 0, avail);
+			if (sync == NULL) {
+				_rx_head = _rx_tail = 0;
+				return NULL;
+			}
+			_rx_head = sync - _rx_buf;
+			avail = _rx_tail - _rx_head;
+			byte1_t *eop = (byte1_t*) memchr(sync + 1, 0, avail - 1);
+			if (eop == NULL) {
+				if (avail >= max_len)
+					_rx_head++; // No end of frame where it should be
+				else
+					return NULL; // Wait for the rest of the frame
+			} else if (eop - sync + 1 >= min_len && eop - sync + 1 <= max_len) {
+				len = eop - sync + 1;
+				_rx_head += len;
+				return sync;
 			} else {
-				if (tmr.elapsed() < timeout_ms)
-					return 0;
+				// Wrong length, the end byte could start the next frame
+				_rx_head = eop - _rx_buf;
 			}
 		}
-		return 0;
+	}
+
+	int Transceiver::extract(Packet *p, int max) {
+		int found = 0;
+		int len;
+		byte1_t *frame;
+		while (found < max && (frame = nextFrame(len)) != NULL) {
+			if (len == sizeof (Packet))
+				memcpy(p + found++, frame, len);
+		}
+		return found;
+	}
+
+	int Transceiver::recvFrame(LargePacket *p, int timeout_ms) {
+		int len;
+		byte1_t *frame = nextFrame(len);
+		if (frame == NULL) {
+			if (fill(timeout_ms) < 0)
+				return -1;
+			if ((frame = nextFrame(len)) == NULL)
+				return 0;
+		}
+		memcpy(p, frame, len);
+		return len;
+	}
+
+	int Transceiver::sendFrame(const LargePacket *p, size_t size) {
+		if (!poll_write(_fd_send))
+			return 0;
+		const byte1_t *buf = (const byte1_t*) p;
+		size_t done = 0;
+		while (done < size) {
+			int n = write(_fd_send, buf + done, size - done);
+			if (n >= 0) {
+				done += n;
+			} else if (errno == EINTR) {
+				continue;
+			} else if (errno == EAGAIN && done) {
+				// Never leave half a frame on the link
+				struct pollfd fds[1];
+				fds[0].fd = _fd_send;
+				fds[0].events = POLLOUT;
+				poll(fds, 1, -1);
+			} else {
+				return done ? -1 : ((errno == EAGAIN) ? 0 : -1);
+			}
+		}
+		return size;
 	}
 
 	int Transceiver::sendPacket(Packet *p) {
@@ -77,6 +179,12 @@ namespace comms {
 		return -1;
 	}
 
+	int Transceiver::sendPackets(const Packet *p, size_t n) {
+		if (poll_write(_fd_send))
+			return writePackets(_fd_send, p, n);
+		return 0;
+	}
+
 	int Transceiver::recvBytes(void *data, int max) {
 		if (poll_read(_fd_recv)) {
 			int n = read(_fd_recv, data, max);
@@ -94,24 +202,33 @@ namespace comms {
 	}
 
 	int PacketChecker::push_byte(uint8_t byte) {
-		_buf[_index] = byte;
-		if (byte == 0 && _index != 0) {
-			int rtn = _index;
-			_index = 0;
-			_flag = true;
-			return rtn;
+		if (byte == 0) {
+			int len = _index + 1;
+			// This zero ends the current frame and can also start the next one
+			_buf[_index] = 0;
+			_buf[0] = 0;
+			bool valid = _index > 0 && len >= LARGE_PACKET_OVERHEAD;
+			if (valid) {
+				_len = len;
+				_flag = true;
+			}
+			_index = 1;
+			return valid ? len : 0;
 		}
-		_index++;
-		if (_index == 24) {
-			_index = 0;
-			_flag = true;
-			return 24;
+		if (_index == 0)
+			return 0; // Waiting for a sync byte
+		if (_index == sizeof (_buf) - 1) {
+			_index = 0; // Too long to be a frame
+			return 0;
 		}
+		if (_flag && _index == 1)
+			_flag = false; // The last frame is being overwritten
+		_buf[_index++] = byte;
 		return 0;
 	}
 
 	bool PacketChecker::get_packet(comms::Packet *p) {
-		if (_flag) {
+		if (_flag && _len == sizeof (comms::Packet)) {
 			memcpy(p, _buf, sizeof (comms::Packet));
 			_flag = false;
 			return true;
@@ -119,4 +236,12 @@ namespace comms {
 			return false;
 		}
 	}
+
+	int PacketChecker::get_frame(comms::LargePacket *p) {
+		if (!_flag)
+			return 0;
+		memcpy(p, _buf, _len);
+		_flag = false;
+		return _len;
+	}
 }
@@ -12,9 +12,10 @@
 namespace comms {
 
 	class PacketChecker {
-		uint8_t _buf[24];
+		uint8_t _buf[sizeof (LargePacket)];
 		bool _flag = false;
 		int _index = 0;
+		int _len = 0;
 
 	public:
 
@@ -24,16 +25,25 @@ namespace comms {
 		/**
 		 * Puches the next byte into the checker
 		 * @param byte; the byte to be pushed
-		 * @return 0 when no packet to return, else the length of the packet
+		 * @return 0 when no frame to return, else the length of the frame
+		 * (sizeof(Packet) for a normal packet)
 		 */
 		int push_byte(uint8_t byte);
 
 		/**
 		 * Gets the packet from the buffer
 		 * @param p will hold the packet
-		 * @return false of no packet available yet
+		 * @return false of no packet available yet or the frame is not the
+		 * size of a Packet
 		 */
 		bool get_packet(comms::Packet *p);
+
+		/**
+		 * Gets a frame of any length from the buffer
+		 * @param p will hold the frame
+		 * @return length of the frame, 0 if none available yet
+		 */
+		int get_frame(comms::LargePacket *p);
 	};
 
 	class Transceiver {
@@ -50,11 +60,25 @@ namespace comms {
 		   Try to get a packet from the file descriptor.
 		   @params
 		   p: Packet to be received
+		   timeout_ms: Time to wait for data if none is buffered (0 = don't wait)
+		   @return
+		   >0: Success (size of the packet).
+		   0: No packets available
+		   -1: Error reading or connection closed
+		 */
+		int recvPacket(Packet *p, int timeout_ms = 0);
+
+		/**
+		   Get every complete packet available, reading all pending bytes from
+		   the file descriptor in a single read() call.
+		   @params
+		   p: Array to hold the packets
+		   max: Size of the array
+		   timeout_ms: Time to wait for data if none is buffered (0 = don't wait)
 		   @return
-		   0: Success.
-		   -1: No packets in queue
+		   Number of packets received or -1 on error/connection closed
 		 */
-		int recvPacket(Packet *p, int timeout_ms = 10);
+		int recvPackets(Packet *p, int max, int timeout_ms = 0);
 
 		/**
 		   Push a packet to the send queue
@@ -63,6 +87,39 @@ namespace comms {
 		 */
 		int sendPacket(Packet *p);
 
+		/**
+		   Send several packets with a single system call
+		   @params
+		   p: Array of packets to be sent
+		   n: Number of packets in the array
+		   @return
+		   Number of whole packets sent (0 if unavailable), -1 on error
+		 */
+		int sendPackets(const Packet *p, size_t n);
+
+		/**
+		   Try to get a frame of any length (Packet or LargePacket) from the
+		   file descriptor.
+		   @params
+		   p: Frame to be received
+		   timeout_ms: Time to wait for data if none is buffered (0 = don't wait)
+		   @return
+		   >0: Success (size of the frame in bytes).
+		   0: No frames available
+		   -1: Error reading or connection closed
+		 */
+		int recvFrame(LargePacket *p, int timeout_ms = 0);
+
+		/**
+		   Send a variable length frame
+		   @params
+		   p: Frame to be sent
+		   size: Size of the frame in bytes (as returned by Protocol::packLarge)
+		   @return
+		   size on success, 0 if unavailable, -1 on error
+		 */
+		int sendFrame(const LargePacket *p, size_t size);
+
 		int recvBytes(void* data, int n);
 
 		int sendBytes(const void* data, int n);
@@ -72,7 +129,34 @@ namespace comms {
 		int _fd_recv;
 
 	private:
-		PacketChecker _checker;
+		static const int RX_BUF_SIZE = 4096;
+		// Bytes in [_rx_head, _rx_tail) have been read but not yet framed
+		byte1_t _rx_buf[RX_BUF_SIZE];
+		int _rx_head = 0;
+		int _rx_tail = 0;
+
+		/**
+		 * Read as many bytes as are available into the receive buffer
+		 * @param timeout_ms: Time to wait for the file descriptor to be readable
+		 * @return Number of bytes read or -1 on error/connection closed
+		 */
+		int fill(int timeout_ms);
+
+		/**
+		 * Find the next complete frame in the receive buffer and remove it
+		 * @param len: Set to the length of the frame
+		 * @return Start of the frame (valid until the next fill) or NULL
+		 */
+		byte1_t* nextFrame(int &len);
+
+		/**
+		 * Take complete packets out of the receive buffer. Frames which are
+		 * not the size of a Packet are skipped.
+		 * @param p: Array to hold the packets
+		 * @param max: Size of the array
+		 * @return Number of packets copied into p
+		 */
+		int extract(Packet *p, int max);
 	};
 }
 #endif
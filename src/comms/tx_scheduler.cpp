@@ -0,0 +1,125 @@
+/**
+ * REXUS PIOneERS - Pi_1
+ * tx_scheduler.cpp
+ * Purpose: Function declarations for the transmit scheduler
+ */
+#include <time.h>
+#include <math.h>
+
+#include "tx_scheduler.h"
+
+namespace comms {
+
+	TxScheduler::TxScheduler(int baudrate, int status_weight, int control_len,
+			int status_len, int bulk_len) {
+		// 10 bits on the wire per byte (start, 8 data, stop)
+		_rate = baudrate / 10.0 / 1e6;
+		// Allow a few packets to be queued in the UART so it never idles
+		_burst = 4 * sizeof (Packet);
+		_tokens = _burst;
+		_status_weight = status_weight;
+		_queues[CONTROL].slots.resize(control_len);
+		_queues[STATUS].slots.resize(status_len);
+		_queues[BULK].slots.resize(bulk_len);
+	}
+
+	TxScheduler::Class TxScheduler::classify(const Packet &p) {
+		switch (p.ID) {
+			case ID_STATUS1:
+			case ID_STATUS2:
+			case ID_MSG1:
+			case ID_MSG2:
+				return STATUS;
+			case ID_CMD:
+				return CONTROL;
+			default:
+				return BULK;
+		}
+	}
+
+	bool TxScheduler::push(const Packet &p) {
+		Queue &q = _queues[classify(p)];
+		size_t size = q.slots.size();
+		bool ok = true;
+		if (q.count == size) {
+			// Drop the oldest
+			q.head = (q.head + 1) % size;
+			q.count--;
+			q.dropped++;
+			ok = false;
+		}
+		q.slots[(q.head + q.count) % size] = p;
+		q.count++;
+		return ok;
+	}
+
+	void TxScheduler::refill(uint64_t now_us) {
+		if (now_us > _last) {
+			_tokens += (now_us - _last) * _rate;
+			if (_tokens > _burst)
+				_tokens = _burst;
+		}
+		_last = now_us;
+	}
+
+	int TxScheduler::next(Packet *p, int max, uint64_t now_us) {
+		refill(now_us);
+		int n = 0;
+		while (n < max && _tokens >= sizeof (Packet)) {
+			Queue *q = &_queues[CONTROL];
+			if (q->count == 0) {
+				Queue &status = _queues[STATUS];
+				Queue &bulk = _queues[BULK];
+				if (status.count && (bulk.count == 0 || _status_run < _status_weight)) {
+					q = &status;
+					_status_run++;
+				} else if (bulk.count) {
+					q = &bulk;
+					_status_run = 0;
+				} else {
+					break;
+				}
+			}
+			p[n++] = q->slots[q->head];
+			q->head = (q->head + 1) % q->slots.size();
+			q->count--;
+			q->sent++;
+			_tokens -= sizeof (Packet);
+		}
+		return n;
+	}
+
+	void TxScheduler::requeue(const Packet *p, int n) {
+		for (int i = n - 1; i >= 0; i--) {
+			Queue &q = _queues[classify(p[i])];
+			size_t size = q.slots.size();
+			q.sent--;
+			_tokens += sizeof (Packet);
+			if (q.count == size) {
+				// This is now the oldest packet so it is the one to drop
+				q.dropped++;
+				continue;
+			}
+			q.head = (q.head + size - 1) % size;
+			q.slots[q.head] = p[i];
+			q.count++;
+		}
+		if (_tokens > _burst)
+			_tokens = _burst;
+	}
+
+	int TxScheduler::wait_ms(uint64_t now_us) {
+		if (!_queues[CONTROL].count && !_queues[STATUS].count && !_queues[BULK].count)
+			return -1;
+		refill(now_us);
+		if (_tokens >= sizeof (Packet))
+			return 0;
+		return (int) ceil((sizeof (Packet) - _tokens) / _rate / 1000);
+	}
+
+	uint64_t TxScheduler::now() {
+		struct timespec ts;
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+	}
+}
@@ -0,0 +1,116 @@
+/**
+ * REXUS PIOneERS - Pi_1
+ * tx_scheduler.h
+ * Purpose: Class definition for the transmit scheduler used in front of the
+ *			RXSM downlink. Packets are sorted into bounded queues by type:
+ *			control (commands), status (ID_STATUS*, ID_MSG*) and bulk data.
+ *			Control packets always go first, status and bulk share the rest
+ *			of the link by weight. The whole output is limited to the byte
+ *			rate of the UART so the kernel never holds a backlog which new
+ *			messages would have to wait behind. When a queue is full its
+ *			oldest packet is dropped and counted.
+ */
+
+#ifndef TX_SCHEDULER_H
+#define TX_SCHEDULER_H
+
+#include <stdint.h>
+#include <vector>
+
+#include "packet.h"
+
+namespace comms {
+
+	class TxScheduler {
+	public:
+
+		enum Class {
+			CONTROL = 0, STATUS, BULK, CLASSES
+		};
+
+		/**
+		 * @param baudrate: Baud rate of the link (8N1 framing is assumed)
+		 * @param status_weight: Status packets sent for each bulk packet when
+		 *		  both are waiting
+		 * @param control_len, status_len, bulk_len: Size of each queue
+		 */
+		TxScheduler(int baudrate, int status_weight = 4, int control_len = 16,
+				int status_len = 64, int bulk_len = 256);
+
+		/**
+		 * @return The queue a packet belongs in (packed packets can be used
+		 * as COBS never changes a valid ID)
+		 */
+		static Class classify(const Packet &p);
+
+		/**
+		 * Add a packet to its queue, dropping the oldest packet of the same
+		 * class if the queue is full
+		 * @return false if a packet was dropped
+		 */
+		bool push(const Packet &p);
+
+		/**
+		 * Take the packets which may be sent now without going over the byte
+		 * rate, in priority order
+		 * @param p: Array to hold the packets
+		 * @param max: Size of the array
+		 * @param now_us: Current time from now()
+		 * @return Number of packets written to p
+		 */
+		int next(Packet *p, int max, uint64_t now_us);
+
+		/**
+		 * Return packets from next() which could not be written. They go
+		 * back to the front of their queues and their bytes are refunded.
+		 */
+		void requeue(const Packet *p, int n);
+
+		/**
+		 * @param now_us: Current time from now()
+		 * @return ms until next() will give a packet, 0 if it will now, -1 if
+		 * nothing is queued
+		 */
+		int wait_ms(uint64_t now_us);
+
+		size_t queued(Class c) const {
+			return _queues[c].count;
+		}
+
+		unsigned long dropped(Class c) const {
+			return _queues[c].dropped;
+		}
+
+		unsigned long sent(Class c) const {
+			return _queues[c].sent;
+		}
+
+		/**
+		 * @return Microseconds from a monotonic clock
+		 */
+		static uint64_t now();
+
+	private:
+
+		// Fixed size ring of packets, oldest at head
+		struct Queue {
+			std::vector<Packet> slots;
+			size_t head = 0;
+			size_t count = 0;
+			unsigned long dropped = 0;
+			unsigned long sent = 0;
+		};
+
+		Queue _queues[CLASSES];
+		double _rate; // Bytes per microsecond
+		double _burst; // Most bytes that can be sent at once
+		double _tokens;
+		uint64_t _last = 0;
+		int _status_weight;
+		int _status_run = 0; // Status packets sent since the last bulk packet
+
+		void refill(uint64_t now_us);
+	};
+}
+
+#endif /* TX_SCHEDULER_H */
@@ -20,9 +20,14 @@
 #include "camera/camera.h"
 #include "UART/UART.h"
 #include "Ethernet/Ethernet.h"
+#include "Ethernet/replication.h"
 #include "comms/pipes.h"
+#include "comms/shm_pipe.h"
 #include "comms/protocol.h"
 #include "comms/packet.h"
+#include "comms/imu_codec.h"
+#include "comms/rate_governor.h"
+#include "comms/message.h"
 #include "tests/tests.h"
 
 #include <wiringPi.h>
@@ -85,17 +90,28 @@ int poll_signals(int in1, int in2, int in3) {
 // Global variable for the Camera and IMU
 PiCamera Cam;
 RPi_IMU IMU; //  Not initialised yet to prevent damage during lift off
-comms::Pipe IMU_stream;
+comms::ShmPipe IMU_stream;
 
 // Setup for the UART communications
 int baud = 38400; // TODO find right value for RXSM
-RXSM REXUS(baud);
-comms::Pipe rxsm_stream;
+std::string uart_device = "/dev/serial0"; // Or the pty from tools/rxsm_sim
+RXSM REXUS(baud, uart_device);
+comms::ShmPipe rxsm_stream;
+comms::ImuAssembler imu_halves;
+comms::ImuEncoder imu_encoder; // Packs IMU samples for the downlink
+// Keeps IMU data within the link, a fifth is left for messages
+comms::RateGovernor imu_governor(0.8 * baud / 10);
 
 // Ethernet communication setup and variables (we are acting as client)
 int port_no = 31415; // Random unused port for communication
 std::string server_name = "169.254.86.24";
+std::string multicast_group = ""; // e.g. "239.255.31.41" for UDP instead of TCP
 Raspi1 raspi1(port_no, server_name);
+// Completed data files and video are copied to and from Pi 2 in the background
+std::vector<ReplicaSource> replica_sources = {{"Docs/Data/Pi1", "Data"}, {"Docs/Video", "Video"}};
+ReplicationClient replication(port_no + 2, server_name, replica_sources, "Docs/Replica/Pi2");
+comms::MsgReassembler pi2_messages;
+Timer run_time;
 
 /**
  * Handles any SIGINT signals received by the program (i.e. ctrl^c), making sure
@@ -119,6 +135,55 @@ void signal_handler(int s) {
 	exit(1); // This was an unexpected end so we will exit with an error!
 }
 
+/**
+ * Sends a packet to the RXSM and charges it to the downlink budget
+ * @param p: Packet to send
+ */
+void downlink(comms::Packet &p) {
+	REXUS.sendPacket(p);
+	imu_governor.charge(sizeof (p));
+}
+
+/**
+ * Sends IMU data to the RXSM. Samples are averaged when the link is busy
+ * and delta encoded so more fit through (see comms/imu_codec.h). Full rate
+ * data still goes to Pi 2.
+ * @param p: Packet from the IMU process
+ */
+void downlink_imu(comms::Packet &p) {
+	comms::ImuSample s;
+	int n = imu_halves.add(p, s);
+	if (n < 0)
+		downlink(p); // Not IMU data, send it unchanged
+	if (n <= 0 || !imu_governor.offer(s, s))
+		return;
+	comms::Packet out[comms::ImuEncoder::MAX_OUT];
+	n = imu_encoder.encode(s, out);
+	for (int i = 0; i < n; i++)
+		downlink(out[i]);
+}
+
+/**
+ * Forwards a packet from Pi 2 to the RXSM, logging any message it completes
+ * @param p: Packet from Pi 2
+ */
+void forward_pi2(comms::Packet &p) {
+	Log("DATA (PI2)") << p;
+	char msg[comms::MsgReassembler::MAX_LEN + 1];
+	if (pi2_messages.add(p, run_time.elapsed(), msg) > 0)
+		Log("PI2") << msg;
+	downlink(p);
+}
+
+/**
+ * Log how much IMU data has been reduced to fit the downlink
+ */
+void log_downlink() {
+	Log("INFO") << "IMU downlink- sent: " << imu_governor.forwarded() <<
+			" averaged: " << imu_governor.summarized() <<
+			" dropped: " << imu_governor.dropped();
+}
+
 /**
  * Checks the status of all possible child processes and returns as a
  * string.
@@ -155,7 +220,8 @@ void signal_handler(int s) {
  * @return 0 for success, otherwise for failure
  */
 int SODS_SIGNAL() {
-	Log("INFO") << "SODS signal received";
+	Log("INFO") << "SODS signal received at shared time " << raspi1.shared_time_us() << " us";
+	Log("INFO") << "Clock of Pi 2 against ours: " << raspi1.clock_estimate();
 	std::cout << "SODS received" << std::endl;
 	REXUS.sendMsg("SODS received");
 	if (Cam.status()) {
@@ -169,16 +235,20 @@ int SODS_SIGNAL() {
 	}
 	Log("INFO") << "Ending IMU process";
 	IMU.stopDataCollection();
+	comms::Packet last;
+	if (imu_encoder.flush(&last))
+		REXUS.sendPacket(last);
+	log_downlink();
 	//To make sure motor isn't turning
 	digitalWrite(MOTOR_CW, 0);
 	digitalWrite(MOTOR_ACW, 0);
-	// TODO copy data to a further backup directory
+	// Data files are copied to Pi 2 by the replication process
 	Log("INFO") << "Waiting for power off";
 	comms::Packet p1;
 	while(1) {
 		REXUS.sendMsg("I'm falling...");
-		while (raspi1.recvPacket(p1))
-			REXUS.sendPacket(p1);
+		while (raspi1.recvPacket(p1) > 0)
+			forward_pi2(p1);
 		Timer::sleep_ms(5000);
 	}
 	return 0;
@@ -194,7 +264,7 @@ int SODS_SIGNAL() {
  * @return 0 for success, otherwise  for failure
  */
 int SOE_SIGNAL() {
-	Log("INFO") << "SOE signal received";
+	Log("INFO") << "SOE signal received at shared time " << raspi1.shared_time_us() << " us";
 	REXUS.sendMsg("SOE received");
 	// Setup the IMU and start recording
 	// TODO ensure IMU setup register values are as desired
@@ -249,14 +319,13 @@ int SOE_SIGNAL() {
 			int n = IMU_stream.binread(&p, sizeof (comms::Packet));
 			if (n > 0) {
 				Log("DATA (IMU1)") << p;
-				REXUS.sendPacket(p);
+				downlink_imu(p);
 				raspi1.sendPacket(p);
 				Log("INFO") << "Data sent to Pi2 and RXSM";
 			}
 			n = raspi1.recvPacket(p);
 			if (n > 0) {
-				Log("DATA (PI2)") << p;
-				REXUS.sendPacket(p);
+				forward_pi2(p);
 				Log("INFO") << "Data echod to RXSM";
 			}
 			// TODO what about when there is an error (n < 0)
@@ -278,6 +347,7 @@ int SOE_SIGNAL() {
 			counter = 0;
 			// Send general status update
 			REXUS.sendMsg(status_check());
+			log_downlink();
 			if (!Cam.status()) {
 				Log("ERROR") << "Camera stopped running...restarting";
 				Cam.startVideo("Docs/Video/restart");
@@ -294,15 +364,13 @@ int SOE_SIGNAL() {
 		int n = IMU_stream.binread(&p, sizeof (comms::Packet));
 		if (n > 0) {
 			Log("DATA (IMU1)") << p;
-			REXUS.sendPacket(p);
+			downlink_imu(p);
 			raspi1.sendPacket(p);
 			Log("INFO") << "Data sent to Ethernet Communications";
 		}
 		n = raspi1.recvPacket(p);
-		if (n > 0) {
-			Log("DATA (PI2)") << p;
-			REXUS.sendPacket(p);
-		}
+		if (n > 0)
+			forward_pi2(p);
 		delay(10);
 	}
 	return SODS_SIGNAL();
@@ -314,7 +382,7 @@ int SOE_SIGNAL() {
  * of Experiment' signal (when the nose-cone is ejected)
  */
 int LO_SIGNAL() {
-	Log("INFO") << "LO signal received";
+	Log("INFO") << "LO signal received at shared time " << raspi1.shared_time_us() << " us";
 	REXUS.sendMsg("LO received");
 	Cam.startVideo("Docs/Video/rexus_video");
 	Log("INFO") << "Camera recording";
@@ -340,8 +408,8 @@ int LO_SIGNAL() {
 			}
 		}
 		// Check for packets from pi2
-		while (raspi1.recvPacket(p))
-			REXUS.sendPacket(p);
+		while (raspi1.recvPacket(p) > 0)
+			forward_pi2(p);
 	}
 	return SOE_SIGNAL();
 }
@@ -392,41 +460,23 @@ int main(int argc, char* argv[]) {
 	// Set all IMU sensorts to off
 	IMU.resetRegisters();
 	Log("INFO") << "Powered off all IMU sensors";
-	// Wait for GPIO to go high signalling that Pi2 is ready to communicate
-	Timer tmr;
-	while (tmr.elapsed() < 20000) {
-		if (digitalRead(ALIVE)) {
-			Log("INFO") << "Establishing ethernet connection";
-			raspi1.run("Docs/Data/Pi2/backup");
-			if (raspi1.status()) {
-				Log("INFO") << "Connection successful";
-				REXUS.sendMsg("Ethernet connection successful");
-				break;
-			} else {
-				Log("INFO") << "Connection failed";
-				REXUS.sendMsg("ERROR: Ethernet connection failed");
-				REXUS.sendMsg("Continuing wihout ethernet comms");
-				break;
-			}
-			break;
-		}
-		Timer::sleep_ms(10);
-	}
-	if (tmr.elapsed() >= 20000) {
-		REXUS.sendMsg("ERROR: Timeout waiting for Pi 2");
-		Log("ERROR") << "Timeout waiting for Pi 2";
-		Log("INFO") << "Attempting ethernet connection anyway";
-		raspi1.run("Docs/Data/Pi2/backup");
-		Timer::sleep_ms(5000);
-		if (raspi1.status()) {
-			Log("INFO") << "Ethernet connection successful";
-			REXUS.sendMsg("Ethernet connected");
-		} else {
-			Log("ERROR") << "Unable to establish ethernet connection";
-			REXUS.sendMsg("ERROR: Ethernet failed");
-			REXUS.sendMsg("Continuing without ethernet comms");
-		}
+	// The ethernet process keeps trying to connect in the background so
+	// there is no need to wait for Pi 2 to be ready
+	Log("INFO") << (digitalRead(ALIVE) ? "Pi 2 is ready" : "Pi 2 not ready yet");
+	Log("INFO") << "Starting ethernet process";
+	if (!multicast_group.empty())
+		raspi1.use_multicast(multicast_group);
+	raspi1.run("Docs/Data/Pi2/backup");
+	if (raspi1.status()) {
+		Log("INFO") << "Ethernet process started";
+		REXUS.sendMsg("Ethernet process started");
+	} else {
+		Log("ERROR") << "Unable to start ethernet process";
+		REXUS.sendMsg("ERROR: Ethernet failed");
+		REXUS.sendMsg("Continuing without ethernet comms");
 	}
+	replication.run();
+	Log("INFO") << "Replication process started";
 	Log("INFO") << "Waiting for LO";
 	REXUS.sendMsg("Waiting for LO");
 	// Wait for LO signal
@@ -448,7 +498,7 @@ int main(int argc, char* argv[]) {
 		//Check for packets from Pi2
 		n = raspi1.recvPacket(p);
 		if (n > 0)
-			REXUS.sendPacket(p);
+			forward_pi2(p);
 		// Check for any packets from RXSM
 		n = REXUS.recvPacket(p);
 		if (n > 0) {
@@ -491,16 +541,22 @@ int main(int argc, char* argv[]) {
 					case 5:
 					{
 						Log("INFO") << "Cleaning files";
+						// ImP segments (*.imp) are only written on Pi 2, copies
+						// from replication are kept in Docs/Replica
 						if (data[1] == 0) {
 							//Clean everything
 							system("sudo rm -rf /Docs/Data/Pi1/*.txt");
 							system("sudo rm -rf /Docs/Data/Pi2/*.txt");
+							system("sudo rm -rf /Docs/Data/Pi1/*.bin");
+							system("sudo rm -rf /Docs/Data/Pi2/*.bin");
 							system("sudo rm -rf /Docs/Video/*.h264");
 							system("sudo rm -rf /Docs/Data/Logs/*.txt");
 						} else if (data[1] == 1) {
 							//Clean data
 							system("sudo rm -rf /Docs/Data/Pi1/*.txt");
 							system("sudo rm -rf /Docs/Data/Pi2/*.txt");
+							system("sudo rm -rf /Docs/Data/Pi1/*.bin");
+							system("sudo rm -rf /Docs/Data/Pi2/*.bin");
 						} else if (data[1] == 2) {
 							//Clean video
 							system("sudo rm -rf /Docs/Video/*.h264");
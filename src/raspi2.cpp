@@ -17,7 +17,9 @@
 #include "camera/camera.h"
 #include "UART/UART.h"
 #include "Ethernet/Ethernet.h"
+#include "Ethernet/replication.h"
 #include "comms/pipes.h"
+#include "comms/shm_pipe.h"
 #include "comms/protocol.h"
 #include "comms/packet.h"
 #include "timing/timer.h"
@@ -34,13 +36,22 @@ bool flight_mode = false;
 PiCamera Cam;
 
 // Setup for the UART communications
-int baud = 230400;
-ImP IMP(baud);
-comms::Pipe ImP_stream;
+int baud = 230400; // Any rate the ImP supports, e.g. 921600 (see UART/baud.h)
+// Requests kept in flight and shortest time between measurements (0 for as
+// fast as the ImP answers), see UART/imp_pipeline.h
+int imp_outstanding = 1;
+int imp_interval_ms = 0;
+std::string uart_device = "/dev/serial0"; // Or the pty from tools/imp_sim
+ImP IMP(baud, imp_outstanding, imp_interval_ms, uart_device);
+comms::ShmPipe ImP_stream;
 
 // Ethernet communication setup and variables (we are acting as client)
 int port_no = 31415; // Random unused port for communication
+std::string multicast_group = ""; // e.g. "239.255.31.41" for UDP instead of TCP
 Raspi2 raspi2(port_no);
+// Completed data files and video are copied to and from Pi 1 in the background
+std::vector<ReplicaSource> replica_sources = {{"Docs/Data/Pi2", "Data"}, {"Docs/Video", "Video"}};
+ReplicationServer replication(port_no + 2, replica_sources, "Docs/Replica/Pi1");
 
 /**
  * Checks whether input is activated
@@ -90,7 +101,7 @@ void signal_handler(int s) {
 	}
 	IMP.stopDataCollection();
 	digitalWrite(BURNWIRE, 0);
-	// TODO copy data to a further backup directory
+	// Data files are copied to Pi 1 by the replication process
 	Log("INFO") << "Ending program, Pi rebooting";
 	system("sudo reboot");
 	exit(1); // This was an unexpected end so we will exit with an error!
@@ -124,7 +135,8 @@ int SODS_SIGNAL() {
 	 * When the 'Start of Data Storage' signal is received recording of IMU data
 	 * stops while the camera continues running till power off or storage space is full
 	 */
-	Log("INFO") << "SODS signal received";
+	Log("INFO") << "SODS signal received at shared time " << raspi2.shared_time_us() << " us";
+	Log("INFO") << "Clock of Pi 1 against ours: " << raspi2.clock_estimate();
 	if (Cam.status()) {
 		Log("INFO") << "Camera still running";
 	} else {
@@ -140,7 +152,7 @@ int SODS_SIGNAL() {
 		Timer::sleep_ms(10000);
 		raspi2.sendMsg("Falling");
 	}
-	// TODO copy data to a further backup directory
+	// Data files are copied to Pi 1 by the replication process
 	//Log("INFO") << "Ending program, Pi rebooting";
 	//system("sudo reboot");
 	return 0;
@@ -155,7 +167,7 @@ int SOE_SIGNAL() {
 	 * boom has reached it's full length or something has gone wrong and the
 	 * count of the encoder is sent to ground.
 	 */
-	Log("INFO") << "SOE signal received";
+	Log("INFO") << "SOE signal received at shared time " << raspi2.shared_time_us() << " us";
 	raspi2.sendMsg("Received SOE");
 	// Setup the ImP and start requesting data
 	ImP_stream = IMP.startDataCollection("Docs/Data/Pi2/imu_data");
@@ -227,7 +239,7 @@ int LO_SIGNAL() {
 	 * are set to start recording video and we then wait to receive the 'Start
 	 * of Experiment' signal (when the nose-cone is ejected)
 	 */
-	Log("INFO") << "LO signal received";
+	Log("INFO") << "LO signal received at shared time " << raspi2.shared_time_us() << " us";
 	raspi2.sendMsg("Recevied LO");
 	Cam.startVideo("Docs/Video/rexus_video");
 	Log("INFO") << "Camera started recording video";
@@ -283,18 +295,26 @@ int main() {
 	// Setup Burn Wire
 	pinMode(BURNWIRE, OUTPUT);
 
-	// Setup server and wait for client
+	// Setup server, Pi 1 and any other clients connect in the background
 	digitalWrite(ALIVE, 1);
-	Log("INFO") << "Waiting for connection from client on port " << port_no;
+	Log("INFO") << "Starting server on port " << port_no;
 	try {
+		if (!multicast_group.empty())
+			raspi2.use_multicast(multicast_group);
 		raspi2.run("Docs/Data/Pi1/backup");
-		Log("INFO") << "Connection to Pi1 successfil";
-		raspi2.sendMsg("Connected to Pi1");
+		Log("INFO") << "Server started, accepting clients";
+		raspi2.sendMsg("Server started");
 	} catch (EthernetException e) {
-		Log("FATAL") << "Unable to connect to pi 1\n\t" << e.what();
+		Log("FATAL") << "Unable to start server\n\t" << e.what();
 		Log("INFO") << "Continuing without Ethernet connection";
 
 	}
+	try {
+		replication.run();
+		Log("INFO") << "Replication server started";
+	} catch (EthernetException e) {
+		Log("ERROR") << "Unable to start replication server\n\t" << e.what();
+	}
 	Log("INFO") << "Waiting for LO signal";
 	// Check for LO signal.
 	std::string msg;
@@ -353,12 +373,20 @@ int main() {
 							//Clean everything
 							system("sudo rm -rf /Docs/Data/Pi1/*.txt");
 							system("sudo rm -rf /Docs/Data/Pi2/*.txt");
+							system("sudo rm -rf /Docs/Data/Pi1/*.bin");
+							system("sudo rm -rf /Docs/Data/Pi2/*.bin");
+							system("sudo rm -rf /Docs/Data/Pi2/*.imp");
+							system("sudo rm -rf /Docs/Data/Pi2/.*.imp");
 							system("sudo rm -rf /Docs/Video/*.h264");
 							system("sudo rm -rf /Docs/Data/Logs/*.txt");
 						} else if (data[1] == 1) {
 							//Clean data
 							system("sudo rm -rf /Docs/Data/Pi1/*.txt");
 							system("sudo rm -rf /Docs/Data/Pi2/*.txt");
+							system("sudo rm -rf /Docs/Data/Pi1/*.bin");
+							system("sudo rm -rf /Docs/Data/Pi2/*.bin");
+							system("sudo rm -rf /Docs/Data/Pi2/*.imp");
+							system("sudo rm -rf /Docs/Data/Pi2/.*.imp");
 						} else if (data[1] == 2) {
 							//Clean video
 							system("sudo rm -rf /Docs/Video/*.h264");
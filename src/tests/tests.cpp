@@ -18,6 +18,7 @@
 #include "timing/timer.h"
 
 #include "comms/pipes.h"
+#include "comms/shm_pipe.h"
 #include "comms/packet.h"
 #include "pins1.h"
 #include <iostream>
@@ -51,7 +52,7 @@ namespace tests {
 		// Test multiprocessing
 		IMU.setupGyr();
 		IMU.setupMag();
-		comms::Pipe stream;
+		comms::ShmPipe stream;
 		stream = IMU.startDataCollection("Docs/Data/Pi1/imutest");
 		Timer::sleep_ms(500);
 		comms::Packet p;
@@ -86,7 +87,7 @@ namespace tests {
 	std::string ImP_test() {
 		std::string rtn = "\nTesting ImP...\n";
 		comms::Packet p;
-		comms::Pipe pipe;
+		comms::ShmPipe pipe;
 		ImP imp(38400);
 		pipe = imp.startDataCollection("Docs/Data/Pi2/imptest");
 		Timer::sleep_ms(500);
@@ -0,0 +1,48 @@
+#ifndef BACKOFF_H
+#define BACKOFF_H
+
+#include <algorithm>
+#include <random>
+
+/**
+ * Delays between attempts at something which may keep failing (e.g.
+ * connecting to Pi 2 while it reboots). The delay doubles after every
+ * attempt up to a limit and is randomised between half and all of it so
+ * retries do not fall into step with anything else.
+ */
+class Backoff {
+public:
+
+	/**
+	 * @param min_ms: Delay before the first retry
+	 * @param max_ms: Longest delay
+	 */
+	Backoff(int min_ms = 20, int max_ms = 2000)
+	: _min(min_ms), _max(max_ms), _delay(min_ms), _rng(std::random_device()()) {
+	}
+
+	/**
+	 * @return Time to wait before the next attempt in ms
+	 */
+	int next_ms() {
+		int d = _delay;
+		_delay = std::min(_delay * 2, _max);
+		std::uniform_int_distribution<int> jitter(d / 2, d);
+		return jitter(_rng);
+	}
+
+	/**
+	 * Start again from the shortest delay, after succeeding
+	 */
+	void reset() {
+		_delay = _min;
+	}
+
+private:
+	int _min;
+	int _max;
+	int _delay;
+	std::minstd_rand _rng;
+};
+
+#endif /* BACKOFF_H */
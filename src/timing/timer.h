@@ -38,6 +38,15 @@ public:
 		return ss.str();
 	}
 
+	/**
+	 * @return Time on the system clock in microseconds since 1970, the time
+	 * base for the clock offset between the Pis (see comms/clock_sync.h)
+	 */
+	static int64_t now_us() {
+		return std::chrono::duration_cast<std::chrono::microseconds>(
+				clock_::now().time_since_epoch()).count();
+	}
+
 	int32_t elapsed() const {
 		return (int32_t) std::chrono::duration_cast<millisecs_>(clock_::now() - beg_).count();
 	}
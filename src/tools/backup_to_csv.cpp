@@ -0,0 +1,64 @@
+/**
+ * REXUS PIOneERS - Pi_1
+ * backup_to_csv.cpp
+ * Purpose: Turns a binary backup of the packets received over Ethernet (see
+ * comms/backup_log.h) into CSV, one line per packet. Damaged records are
+ * skipped and counted.
+ *
+ * Usage: backup_to_csv <backup file>
+ * Output columns:
+ *		time_ms,unix_time,id,index,valid,d0,...,d15
+ * time_ms is since the start of the file and valid is 0 if the packet's own
+ * checksum fails, in which case the fields are the bytes as received.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <iostream>
+
+#include "comms/packet.h"
+#include "comms/protocol.h"
+#include "comms/backup_log.h"
+
+int main(int argc, char* argv[]) {
+	if (argc < 2) {
+		std::cerr << "Usage: " << argv[0] << " <backup file>" << std::endl;
+		return 1;
+	}
+	comms::BackupReader reader;
+	if (reader.open(argv[1]) < 0) {
+		perror("Failed to open backup");
+		return 1;
+	}
+	uint64_t start_us = reader.header().start_us;
+	std::cout << "time_ms,unix_time,id,index,valid";
+	for (int i = 0; i < 16; i++)
+		std::cout << ",d" << i;
+	std::cout << "\n";
+	comms::BackupRecord r;
+	unsigned long records = 0;
+	char line[256];
+	while (reader.next(r)) {
+		comms::Packet copy = r.packet;
+		comms::byte1_t id;
+		comms::byte2_t index;
+		comms::byte1_t data[16];
+		bool valid = comms::Protocol::unpack(copy, id, index, data) == 0;
+		if (!valid) {
+			id = r.packet.ID;
+			index = r.packet.index;
+			memcpy(data, r.packet.data, sizeof (data));
+		}
+		uint64_t unix_ms = start_us / 1000 + r.time_ms;
+		int n = snprintf(line, sizeof (line), "%u,%llu.%03u,%u,%u,%d", r.time_ms,
+				(unsigned long long) (unix_ms / 1000), (unsigned) (unix_ms % 1000),
+				id, index, valid);
+		for (int i = 0; i < 16; i++)
+			n += snprintf(line + n, sizeof (line) - n, ",%u", data[i]);
+		std::cout << line << "\n";
+		records++;
+	}
+	std::cerr << "Packets: " << records << std::endl;
+	std::cerr << "Bytes skipped in damaged records: " << reader.skipped() << std::endl;
+	return 0;
+}
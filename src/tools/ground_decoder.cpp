@@ -0,0 +1,88 @@
+/**
+ * REXUS PIOneERS - Pi_1
+ * ground_decoder.cpp
+ * Purpose: Decodes a recording of the RXSM downlink on the ground. IMU data
+ * (full samples and delta encoded packets) is written as CSV, messages and
+ * status packets are printed as text and anything else as raw packets.
+ *
+ * Usage: ground_decoder [capture file]   (reads stdin if no file is given)
+ * Output lines:
+ *		imu,<time us>,<acc x>,<acc y>,<acc z>,<gyr x>,...,<mag z>
+ *		msg,<id>,<text>		(messages put back together from their fragments)
+ *		status,<index>,<text>
+ *		pkt,<packet>
+ */
+
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <iostream>
+
+#include "comms/packet.h"
+#include "comms/protocol.h"
+#include "comms/transceiver.h"
+#include "comms/imu_codec.h"
+#include "comms/message.h"
+
+// Packets take about 6ms at 38400 baud, used as the clock for timeouts
+static const int PACKET_MS = 6;
+
+static void print_packet(comms::Packet &p, comms::ImuDecoder &imu,
+		comms::MsgReassembler &messages, int64_t now_ms) {
+	comms::ImuSample samples[comms::ImuDecoder::MAX_OUT];
+	int n = imu.decode(p, samples);
+	for (int i = 0; i < n; i++) {
+		std::cout << "imu," << samples[i].time;
+		for (int j = 0; j < 9; j++)
+			std::cout << "," << samples[i].axes[j];
+		std::cout << "\n";
+	}
+	if (n >= 0)
+		return;
+	char msg[comms::MsgReassembler::MAX_LEN + 1];
+	n = messages.add(p, now_ms, msg);
+	if (n > 0) {
+		if (msg[n - 1] == '\n')
+			msg[n - 1] = '\0';
+		std::cout << "msg," << (int) p.ID << "," << msg << "\n";
+	}
+	if (n >= 0)
+		return;
+	comms::Packet copy = p;
+	comms::byte1_t id;
+	comms::byte2_t index;
+	comms::byte1_t data[17] = {0};
+	if (comms::Protocol::unpack(copy, id, index, data))
+		return; // Corrupted
+	switch (id) {
+		case ID_STATUS1:
+		case ID_STATUS2:
+			std::cout << "status," << index << "," << (char*) data << "\n";
+			break;
+		default:
+			std::cout << "pkt," << p << "\n";
+	}
+}
+
+int main(int argc, char* argv[]) {
+	int fd = 0;
+	if (argc > 1 && (fd = open(argv[1], O_RDONLY)) < 0) {
+		perror("Failed to open capture");
+		return 1;
+	}
+	comms::PacketChecker checker;
+	comms::ImuDecoder imu;
+	comms::MsgReassembler messages;
+	int64_t packets = 0;
+	comms::Packet p;
+	comms::byte1_t buf[4096];
+	int n;
+	while ((n = read(fd, buf, sizeof (buf))) > 0) {
+		for (int i = 0; i < n; i++)
+			if (checker.push_byte(buf[i]) && checker.get_packet(&p))
+				print_packet(p, imu, messages, PACKET_MS * packets++);
+	}
+	std::cerr << "IMU samples lost with missing packets: " << imu.dropped() << std::endl;
+	std::cerr << "Messages lost with missing packets: " << messages.lost() << std::endl;
+	return 0;
+}
@@ -0,0 +1,189 @@
+/**
+ * REXUS PIOneERS - Pi_1
+ * imp_sim.cpp
+ * Purpose: Stands in for the ImP so raspi2 (or anything using the ImP class)
+ * can be run and load tested without the instrument. Opens a pty and answers
+ * each request ("C" or "N") after the measurement time with a primary frame
+ * (26 bytes, COBS encoded, zero terminated) and then a secondary frame, sent
+ * no faster than the given baud rate.
+ *
+ * Usage: imp_sim [-b baud] [-t measure ms] [-s secondary bytes] [-q queue]
+ *				[-m miss every] [-d seconds] [-l link]
+ *		-b	Rate of the line (default 230400)
+ *		-t	Time to take a measurement (default 25)
+ *		-s	Length of the secondary frame without its zero (default 100)
+ *		-q	Requests held while measuring, more are ignored (default 4)
+ *		-m	Ignore every nth request to test the timeouts (default 0, none)
+ *		-d	Stop after this long (default run until interrupted)
+ *		-l	Make a symlink to the pty here, e.g. /tmp/imp
+ * Give the printed pty (or the link) as the ImP device (uart_device in
+ * raspi2.cpp).
+ *
+ * Output lines:
+ *		port,<path>
+ *		stats,<seconds>,<measurements/s>,<bytes/s>,<requests>,<ignored>
+ * Bytes 0-3 of each primary frame (before encoding) are the measurement
+ * number, least significant first.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <poll.h>
+#include <errno.h>
+#include <algorithm>
+#include <iostream>
+#include <vector>
+
+#include "comms/protocol.h"
+#include "timing/timer.h"
+#include "sim_port.h"
+
+#define PRIMARY_DATA 26
+
+static volatile sig_atomic_t stop = 0;
+
+static void on_signal(int) {
+	stop = 1;
+}
+
+/**
+ * Write a frame no faster than the line allows
+ * @return 0 = success, -1 if the pty failed
+ */
+static int send_paced(int fd, LinePacer &pacer, const comms::byte1_t *buf, int len) {
+	while (len > 0 && !stop) {
+		int wait = pacer.wait_ms();
+		if (wait > 0)
+			Timer::sleep_ms(wait);
+		int n = write(fd, buf, std::min(len, pacer.chunk()));
+		if (n < 0 && errno != EINTR)
+			return -1;
+		if (n <= 0)
+			continue;
+		pacer.used(n);
+		buf += n;
+		len -= n;
+	}
+	return 0;
+}
+
+int main(int argc, char* argv[]) {
+	int baudrate = 230400;
+	int measure_ms = 25;
+	int secondary = 100;
+	int queue_max = 4;
+	int miss_every = 0;
+	int duration_s = 0;
+	std::string link;
+	int opt;
+	while ((opt = getopt(argc, argv, "b:t:s:q:m:d:l:")) != -1) {
+		switch (opt) {
+			case 'b': baudrate = atoi(optarg);
+				break;
+			case 't': measure_ms = atoi(optarg);
+				break;
+			case 's': secondary = atoi(optarg);
+				break;
+			case 'q': queue_max = atoi(optarg);
+				break;
+			case 'm': miss_every = atoi(optarg);
+				break;
+			case 'd': duration_s = atoi(optarg);
+				break;
+			case 'l': link = optarg;
+				break;
+			default:
+				std::cerr << "Usage: " << argv[0] << " [-b baud] [-t measure ms]"
+						" [-s secondary bytes] [-q queue] [-m miss every] [-d seconds]"
+						" [-l link]" << std::endl;
+				return 1;
+		}
+	}
+	if (baudrate <= 0 || secondary < 0 || queue_max < 1) {
+		std::cerr << "Baud rate and queue must be positive" << std::endl;
+		return 1;
+	}
+	SimPort port(baudrate, link);
+	if (port.fd() < 0) {
+		perror("Failed to open pty");
+		return 1;
+	}
+	signal(SIGINT, on_signal);
+	signal(SIGTERM, on_signal);
+	std::cout << "port," << port.path() << std::endl;
+
+	// The secondary frame never changes, any bytes but zero
+	std::vector<comms::byte1_t> second(secondary + 1);
+	for (int i = 0; i < secondary; i++)
+		second[i] = i % 255 + 1;
+	second[secondary] = 0;
+	LinePacer pacer(baudrate);
+	Timer run;
+	int queued = 0; // Requests waiting to be measured
+	bool measuring = false;
+	int32_t done_at = 0;
+	int32_t next_report = 1000;
+	uint32_t measurement = 0;
+	unsigned long requests = 0, ignored = 0;
+	unsigned long measurements = 0, bytes = 0; // Since the last report
+	while (!stop && (duration_s == 0 || run.elapsed() < duration_s * 1000)) {
+		int32_t now = run.elapsed();
+		if (now >= next_report) {
+			std::cout << "stats," << now / 1000 << "," << measurements << "," << bytes <<
+					"," << requests << "," << ignored << std::endl;
+			measurements = bytes = 0;
+			next_report += 1000;
+		}
+		if (!measuring && queued > 0) {
+			queued--;
+			measuring = true;
+			done_at = now + measure_ms;
+		}
+		if (measuring && now >= done_at) {
+			comms::byte1_t first[PRIMARY_DATA + 2] = {0};
+			for (int i = 0; i < 4; i++)
+				first[i + 1] = measurement >> (8 * i);
+			for (int i = 4; i < PRIMARY_DATA; i++)
+				first[i + 1] = measurement * 7 + i;
+			comms::Protocol::cobsEncode(first, sizeof (first), 0);
+			if (send_paced(port.fd(), pacer, first, sizeof (first)) ||
+					send_paced(port.fd(), pacer, second.data(), second.size())) {
+				perror("Failed to write to pty");
+				break;
+			}
+			measurement++;
+			measurements++;
+			bytes += sizeof (first) + second.size();
+			measuring = false;
+			continue;
+		}
+		int wait = next_report - now;
+		if (measuring)
+			wait = std::min(wait, done_at - now);
+		struct pollfd fds[1];
+		fds[0].fd = port.fd();
+		fds[0].events = POLLIN;
+		if (poll(fds, 1, std::max(wait, 0)) <= 0)
+			continue;
+		char buf[256];
+		int n = read(port.fd(), buf, sizeof (buf));
+		if (n < 0 && errno != EINTR && errno != EAGAIN) {
+			perror("Failed to read from pty");
+			break;
+		}
+		for (int i = 0; i < n; i++) {
+			if (buf[i] != 'C' && buf[i] != 'N')
+				continue;
+			requests++;
+			if (queued >= queue_max || (miss_every > 0 && requests % miss_every == 0))
+				ignored++;
+			else
+				queued++;
+		}
+	}
+	std::cerr << "Measurements sent: " << measurement << ", requests ignored: " <<
+			ignored << std::endl;
+	return 0;
+}
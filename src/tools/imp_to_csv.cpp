@@ -0,0 +1,70 @@
+/**
+ * REXUS PIOneERS - Pi_1
+ * imp_to_csv.cpp
+ * Purpose: Turns the binary segments of frames saved from the ImP (see
+ * UART/imp_file.h) into CSV, one line per frame. Long frames saved in pieces
+ * are put back together and damaged records are skipped and counted.
+ *
+ * Usage: imp_to_csv <segment file>...   (give the segments in order)
+ * Output columns:
+ *		unix_time,measurement,kind,length,bytes
+ * kind is primary or secondary, measurement counts the primary frames from
+ * the first segment and bytes are the frame as received, in decimal and
+ * separated by spaces.
+ */
+
+#include <stdio.h>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "UART/imp_file.h"
+
+int main(int argc, char* argv[]) {
+	if (argc < 2) {
+		std::cerr << "Usage: " << argv[0] << " <segment file>..." << std::endl;
+		return 1;
+	}
+	std::cout << "unix_time,measurement,kind,length,bytes\n";
+	std::vector<comms::byte1_t> frame(0x10000);
+	std::vector<comms::byte1_t> whole; // Pieces of a long frame so far
+	unsigned long frames = 0, damaged = 0;
+	long measurement = -1;
+	int64_t first_us = 0;
+	std::string line;
+	char field[64];
+	for (int f = 1; f < argc; f++) {
+		ImpFileReader reader;
+		if (reader.open(argv[f]) < 0) {
+			perror(argv[f]);
+			continue;
+		}
+		ImpRecordHeader h;
+		int len;
+		while ((len = reader.next(h, frame.data())) > 0) {
+			if (whole.empty())
+				first_us = h.time_us;
+			whole.insert(whole.end(), frame.begin(), frame.begin() + len);
+			if (h.kind & IMP_FRAME_PIECE)
+				continue;
+			bool primary = (h.kind & ~IMP_FRAME_PIECE) == IMP_FRAME_PRIMARY;
+			if (primary)
+				measurement++;
+			snprintf(field, sizeof (field), "%lld.%06lld,%ld,%s,%zu,",
+					(long long) (first_us / 1000000), (long long) (first_us % 1000000),
+					measurement, primary ? "primary" : "secondary", whole.size());
+			line = field;
+			for (size_t i = 0; i < whole.size(); i++) {
+				snprintf(field, sizeof (field), (i == 0) ? "%u" : " %u", whole[i]);
+				line += field;
+			}
+			std::cout << line << "\n";
+			whole.clear();
+			frames++;
+		}
+		damaged += reader.damaged();
+	}
+	std::cerr << "Frames: " << frames << std::endl;
+	std::cerr << "Damaged records skipped: " << damaged << std::endl;
+	return 0;
+}
@@ -0,0 +1,172 @@
+/**
+ * REXUS PIOneERS - Pi_1
+ * rxsm_sim.cpp
+ * Purpose: Stands in for the RXSM so raspi1 (or anything using the RXSM
+ * class) can be run and load tested without the hardware. Opens a pty, sends
+ * commands up it and reads the downlink no faster than the RXSM would at the
+ * given baud rate, so the program sees the same back pressure as in flight.
+ *
+ * Usage: rxsm_sim [-b baud] [-c command] [-i command ms] [-d seconds]
+ *				[-l link] [-q]
+ *		-b	Rate of the downlink (default 38400)
+ *		-c	Command byte to send (default 0, which is answered "Not
+ *			Recognised"; 1, 2, 5 and 6 reboot or rebuild the Pi)
+ *		-i	Time between commands, 0 for none (default 1000)
+ *		-d	Stop after this long (default run until interrupted)
+ *		-l	Make a symlink to the pty here, e.g. /tmp/rxsm
+ *		-q	Don't print the messages
+ * Give the printed pty (or the link) as the RXSM device (uart_device in
+ * raspi1.cpp).
+ *
+ * Output lines:
+ *		port,<path>
+ *		msg,<text>
+ *		stats,<seconds>,<bytes/s>,<% of line>,<packets/s>,<lost>,<commands>,<acks>
+ * Lost counts missing packets in the sequenced streams (see sequence.h),
+ * acks the "ACK" messages sent back for commands.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <poll.h>
+#include <errno.h>
+#include <algorithm>
+#include <iostream>
+
+#include "comms/packet.h"
+#include "comms/protocol.h"
+#include "comms/transceiver.h"
+#include "comms/message.h"
+#include "comms/sequence.h"
+#include "timing/timer.h"
+#include "sim_port.h"
+
+static volatile sig_atomic_t stop = 0;
+
+static void on_signal(int) {
+	stop = 1;
+}
+
+int main(int argc, char* argv[]) {
+	int baudrate = 38400;
+	int command = 0;
+	int command_ms = 1000;
+	int duration_s = 0;
+	std::string link;
+	bool quiet = false;
+	int opt;
+	while ((opt = getopt(argc, argv, "b:c:i:d:l:q")) != -1) {
+		switch (opt) {
+			case 'b': baudrate = atoi(optarg);
+				break;
+			case 'c': command = atoi(optarg);
+				break;
+			case 'i': command_ms = atoi(optarg);
+				break;
+			case 'd': duration_s = atoi(optarg);
+				break;
+			case 'l': link = optarg;
+				break;
+			case 'q': quiet = true;
+				break;
+			default:
+				std::cerr << "Usage: " << argv[0] << " [-b baud] [-c command] [-i command ms]"
+						" [-d seconds] [-l link] [-q]" << std::endl;
+				return 1;
+		}
+	}
+	if (baudrate <= 0) {
+		std::cerr << "Baud rate must be positive" << std::endl;
+		return 1;
+	}
+	SimPort port(baudrate, link);
+	if (port.fd() < 0) {
+		perror("Failed to open pty");
+		return 1;
+	}
+	signal(SIGINT, on_signal);
+	signal(SIGTERM, on_signal);
+	std::cout << "port," << port.path() << std::endl;
+
+	comms::Transceiver uplink(port.fd());
+	comms::PacketChecker checker;
+	comms::SequenceTracker sequence;
+	comms::MsgReassembler messages;
+	LinePacer pacer(baudrate);
+	Timer run;
+	int32_t next_command = command_ms;
+	int32_t next_report = 1000;
+	uint16_t command_index = 0;
+	unsigned long commands = 0, acks = 0;
+	unsigned long bytes = 0, packets = 0; // Since the last report
+	comms::byte1_t buf[4096];
+	while (!stop && (duration_s == 0 || run.elapsed() < duration_s * 1000)) {
+		int32_t now = run.elapsed();
+		if (command_ms > 0 && now >= next_command) {
+			comms::Command cmd;
+			memset(&cmd, 0, sizeof (cmd));
+			cmd.cmd = command;
+			comms::Packet p;
+			comms::Protocol::pack<ID_CMD>(p, command_index++, cmd);
+			uplink.sendPacket(&p);
+			commands++;
+			next_command += command_ms;
+		}
+		if (now >= next_report) {
+			unsigned long lost = 0;
+			for (int id = 0; id < 256; id++)
+				lost += sequence.stream(id).lost;
+			std::cout << "stats," << now / 1000 << "," << bytes << "," <<
+					100.0 * bytes * 10 / baudrate << "," << packets << "," << lost <<
+					"," << commands << "," << acks << std::endl;
+			bytes = packets = 0;
+			next_report += 1000;
+		}
+		// Sleep until the line is free or the next command or report
+		int wait = next_report - now;
+		if (command_ms > 0)
+			wait = std::min(wait, next_command - now);
+		int line = pacer.wait_ms();
+		if (line > 0) {
+			Timer::sleep_ms(std::min(line, std::max(wait, 0)));
+			continue;
+		}
+		struct pollfd fds[1];
+		fds[0].fd = port.fd();
+		fds[0].events = POLLIN;
+		if (poll(fds, 1, std::max(wait, 0)) <= 0)
+			continue;
+		int n = read(port.fd(), buf, std::min((int) sizeof (buf), pacer.chunk()));
+		if (n < 0 && errno != EINTR && errno != EAGAIN) {
+			perror("Failed to read from pty");
+			break;
+		}
+		if (n <= 0)
+			continue;
+		pacer.used(n);
+		bytes += n;
+		comms::Packet p;
+		for (int i = 0; i < n; i++) {
+			if (!checker.push_byte(buf[i]) || !checker.get_packet(&p))
+				continue;
+			packets++;
+			sequence.add(p);
+			char msg[comms::MsgReassembler::MAX_LEN + 1];
+			int len = messages.add(p, run.elapsed(), msg);
+			if (len <= 0)
+				continue;
+			if (msg[len - 1] == '\n')
+				msg[--len] = '\0';
+			if (len >= 3 && strcmp(msg + len - 3, "ACK") == 0)
+				acks++;
+			if (!quiet)
+				std::cout << "msg," << msg << std::endl;
+		}
+	}
+	std::cerr << "Commands sent: " << commands << ", acknowledged: " << acks << std::endl;
+	std::cerr << "Messages lost with missing packets: " << messages.lost() << std::endl;
+	return 0;
+}
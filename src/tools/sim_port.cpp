@@ -0,0 +1,58 @@
+/**
+ * REXUS PIOneERS - Pi_1
+ * sim_port.cpp
+ * Purpose: Function implementations for the SimPort and LinePacer classes
+ */
+
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+
+#include "sim_port.h"
+#include "UART/baud.h"
+#include "timing/timer.h"
+
+SimPort::SimPort(int baudrate, const std::string &link) {
+	_master = posix_openpt(O_RDWR | O_NOCTTY);
+	if (_master < 0)
+		return;
+	if (grantpt(_master) || unlockpt(_master) ||
+			(_slave = open(ptsname(_master), O_RDWR | O_NOCTTY)) < 0) {
+		close(_master);
+		_master = -1;
+		return;
+	}
+	setup_serial(_slave, baudrate);
+	_path = ptsname(_master);
+	if (!link.empty()) {
+		unlink(link.c_str());
+		if (symlink(_path.c_str(), link.c_str()) == 0) {
+			_link = link;
+			_path = link;
+		}
+	}
+}
+
+SimPort::~SimPort() {
+	if (!_link.empty())
+		unlink(_link.c_str());
+	if (_slave >= 0)
+		close(_slave);
+	if (_master >= 0)
+		close(_master);
+}
+
+LinePacer::LinePacer(int baudrate) : _baudrate(baudrate) {
+	_chunk = std::max(1, baudrate / 2000);
+}
+
+void LinePacer::used(int bytes) {
+	int64_t now = Timer::now_us();
+	_free_us = std::max(_free_us, now) + (int64_t) bytes * 10000000 / _baudrate;
+}
+
+int LinePacer::wait_ms() const {
+	int64_t left = _free_us - Timer::now_us();
+	return (left > 0) ? (int) ((left + 999) / 1000) : 0;
+}
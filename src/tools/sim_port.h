@@ -0,0 +1,83 @@
+/**
+ * REXUS PIOneERS - Pi_1
+ * sim_port.h
+ * Purpose: Pty and line rate helpers shared by the RXSM and ImP simulators
+ *			(rxsm_sim and imp_sim), which stand in for the hardware on the
+ *			other end of the UART.
+ *
+ * The simulator keeps the master side of a pty. The slave side is the
+ * "serial port" given to the program under test as its UART device.
+ */
+
+#ifndef SIM_PORT_H
+#define SIM_PORT_H
+
+#include <stdint.h>
+#include <string>
+
+class SimPort {
+public:
+
+	/**
+	 * Open a pty and set the slave up as a raw serial port, so nothing
+	 * written before the program under test opens it is echoed back
+	 * @param baudrate: Rate the slave reports (the pty itself is not limited)
+	 * @param link: Make a symlink to the slave here if not empty, so the
+	 * program can be given the same path every time
+	 */
+	SimPort(int baudrate, const std::string &link = "");
+	~SimPort();
+
+	/**
+	 * @return Master side, -1 if the pty could not be opened
+	 */
+	int fd() const {
+		return _master;
+	}
+
+	/**
+	 * @return Path of the slave side (or the link to it)
+	 */
+	const std::string &path() const {
+		return _path;
+	}
+
+private:
+	int _master = -1;
+	int _slave = -1; // Held open so the master never sees a hang up
+	std::string _path;
+	std::string _link;
+};
+
+/**
+ * Keeps reads or writes to the rate of a serial line: 10 bits a byte (8N1).
+ */
+class LinePacer {
+public:
+
+	LinePacer(int baudrate);
+
+	/**
+	 * Record bytes sent or received now
+	 */
+	void used(int bytes);
+
+	/**
+	 * @return Time until the line is free, in ms rounded up
+	 */
+	int wait_ms() const;
+
+	/**
+	 * @return Most bytes to move at once, about 5ms of the line
+	 */
+	int chunk() const {
+		return _chunk;
+	}
+
+private:
+	int _baudrate;
+	int _chunk;
+	int64_t _free_us = 0; // Time the bytes so far have been through the line
+};
+
+#endif /* SIM_PORT_H */
@@ -0,0 +1,1183 @@
+/*
+ * Tests for the communication protocol. These do not need any hardware so
+ * can be run on any machine.
+ */
+
+#include "catch.h"
+
+#include "comms/protocol.h"
+#include "comms/packet.h"
+#include "comms/transceiver.h"
+#include "comms/shm_pipe.h"
+#include "comms/reactor.h"
+#include "comms/imu_codec.h"
+#include "comms/tx_scheduler.h"
+#include "comms/rate_governor.h"
+#include "comms/message.h"
+#include "comms/sequence.h"
+#include "comms/link_window.h"
+#include "comms/fan_out.h"
+#include "comms/multicast.h"
+#include "comms/backup_log.h"
+#include "comms/clock_sync.h"
+#include "timing/timer.h"
+#include <stdint.h>
+#include <vector>
+#include <string>
+#include <cstring>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+SCENARIO("CRC16 lookup tables match the bitwise implementation", "[comms]") {
+
+	GIVEN("The standard check string") {
+		const comms::byte1_t check[] = "123456789";
+
+		THEN("Each generator gives its catalogue check value") {
+			REQUIRE(comms::Protocol::crc16Gen(check, 9, CRC16_GEN_BUYPASS) == 0xFEE8);
+			REQUIRE(comms::Protocol::crc16Gen(check, 9, CRC16_GEN_XMODEM) == 0x31C3);
+			REQUIRE(comms::Protocol::crc16Gen(check, 9, CRC16_GEN_DECTX) == 0x007F);
+			REQUIRE(comms::Protocol::crc16Gen(check, 9, CRC16_GEN_T10DIFF) == 0xD0DB);
+		}
+	}
+
+	GIVEN("Buffers of every length up to 64 bytes") {
+		comms::byte1_t buf[64];
+		for (int i = 0; i < 64; i++)
+			buf[i] = (comms::byte1_t) (i * 37 + 11);
+		const comms::byte2_t gens[] = {CRC16_GEN_BUYPASS, CRC16_GEN_XMODEM,
+			CRC16_GEN_DECTX, CRC16_GEN_T10DIFF};
+
+		THEN("Table and bitwise checksums agree") {
+			for (int g = 0; g < 4; g++)
+				for (size_t len = 0; len <= sizeof (buf); len++)
+					REQUIRE(comms::Protocol::crc16Gen(buf, len, gens[g]) ==
+						comms::Protocol::crc16Bitwise(buf, len, gens[g]));
+		}
+	}
+}
+
+SCENARIO("Packets survive packing and unpacking", "[comms]") {
+
+	GIVEN("A packed data packet") {
+		comms::byte1_t data[16] = {0, 1, 2, 0, 4, 5, 0, 0, 8, 9, 10, 11, 0, 0, 0, 0};
+		comms::Packet p;
+		REQUIRE(comms::Protocol::pack(p, ID_DATA1, 0x1234, data) == 0);
+
+		THEN("The packet is COBS framed") {
+			comms::byte1_t *raw = (comms::byte1_t*) & p;
+			REQUIRE(raw[0] == 0);
+			REQUIRE(raw[sizeof (p) - 1] == 0);
+			for (size_t i = 1; i < sizeof (p) - 1; i++)
+				REQUIRE(raw[i] != 0);
+		}
+
+		AND_THEN("Unpacking returns the original data") {
+			comms::byte1_t id;
+			comms::byte2_t index;
+			comms::byte1_t out[16];
+			REQUIRE(comms::Protocol::unpack(p, id, index, out) == 0);
+			REQUIRE(id == ID_DATA1);
+			REQUIRE(index == 0x1234);
+			REQUIRE(memcmp(out, data, comms::lengthByID(ID_DATA1)) == 0);
+		}
+	}
+}
+
+SCENARIO("Transceiver frames packets from a byte stream", "[comms]") {
+
+	GIVEN("A socket with packets and line noise written to it") {
+		int fds[2];
+		REQUIRE(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+		comms::Transceiver tx(fds[0]);
+		comms::Transceiver rx(fds[1]);
+		comms::byte1_t data[16] = {0};
+		comms::Packet p;
+		comms::byte1_t noise[] = {0x55, 0x00, 0x00, 0x12, 0x34};
+		for (int i = 0; i < 50; i++) {
+			data[0] = i;
+			comms::Protocol::pack(p, ID_DATA1, i, data);
+			if (i % 10 == 5)
+				tx.sendBytes(noise, sizeof (noise));
+			tx.sendPacket(&p);
+		}
+
+		WHEN("Reading packets in bulk") {
+			comms::Packet recv[64];
+			int total = 0;
+			int n;
+			while ((n = rx.recvPackets(recv + total, 64 - total, 100)) > 0)
+				total += n;
+
+			THEN("Every packet is received in order and intact") {
+				REQUIRE(total == 50);
+				for (int i = 0; i < total; i++) {
+					comms::byte1_t id;
+					comms::byte2_t index;
+					REQUIRE(comms::Protocol::unpack(recv[i], id, index, data) == 0);
+					REQUIRE(index == i);
+					REQUIRE(data[0] == i);
+				}
+			}
+		}
+
+		AND_WHEN("The sender closes the connection") {
+			close(fds[0]);
+			comms::Packet recv[64];
+			int n;
+			while ((n = rx.recvPackets(recv, 64, 100)) > 0);
+
+			THEN("The receiver reports an error") {
+				REQUIRE(n == -1);
+			}
+		}
+		close(fds[0]);
+		close(fds[1]);
+	}
+}
+
+SCENARIO("Several packets can be sent with one call", "[comms]") {
+
+	GIVEN("A batch of packets and a connected socket") {
+		int fds[2];
+		REQUIRE(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+		comms::Transceiver tx(fds[0]);
+		comms::Transceiver rx(fds[1]);
+		comms::byte1_t data[16] = {0};
+		comms::Packet batch[8];
+		for (int i = 0; i < 8; i++)
+			comms::Protocol::pack(batch[i], ID_DATA2, i, data);
+
+		WHEN("The batch is sent") {
+			int sent = tx.sendPackets(batch, 8);
+
+			THEN("All packets are accepted and arrive") {
+				REQUIRE(sent == 8);
+				comms::Packet recv[8];
+				REQUIRE(rx.recvPackets(recv, 8, 100) == 8);
+				REQUIRE(memcmp(recv, batch, sizeof (batch)) == 0);
+			}
+		}
+		close(fds[0]);
+		close(fds[1]);
+	}
+}
+
+SCENARIO("Packets are passed between processes through shared memory", "[comms]") {
+
+	GIVEN("A forked shared memory pipe") {
+		comms::ShmPipe pipe;
+		if (pipe.Fork() == 0) {
+			// Child echoes everything back until the parent closes the pipe
+			comms::Packet buf[16];
+			int n;
+			while ((n = pipe.binread(buf, sizeof (buf))) >= 0) {
+				if (n == 0)
+					pipe.waitRead(-1);
+				else
+					pipe.binwrite(buf, n);
+			}
+			_exit(0);
+		}
+
+		WHEN("Packets are sent to the child") {
+			comms::byte1_t data[16] = {0};
+			comms::Packet batch[8];
+			for (int i = 0; i < 8; i++)
+				comms::Protocol::pack(batch[i], ID_DATA1, i, data);
+			REQUIRE(pipe.binwriteBatch(batch, 8) == 8);
+
+			THEN("They are echoed back unchanged") {
+				comms::Packet recv[8];
+				int total = 0;
+				while (total < 8) {
+					REQUIRE(pipe.waitRead(1000) > 0);
+					total += pipe.binread(recv + total, sizeof (recv) - total * sizeof (comms::Packet)) / sizeof (comms::Packet);
+				}
+				REQUIRE(memcmp(recv, batch, sizeof (batch)) == 0);
+			}
+		}
+		pipe.close_pipes();
+		wait(NULL);
+	}
+}
+
+SCENARIO("A shared memory pipe wakes a reader which has never read", "[comms]") {
+
+	GIVEN("A child waiting in a reactor before its first read") {
+		comms::ShmPipe pipe;
+		if (pipe.Fork() == 0) {
+			comms::Reactor reactor;
+			int got = 0;
+			comms::Packet buf[16];
+			reactor.add(pipe.getReadfd(), [&]() {
+				int n;
+				while ((n = pipe.binread(buf, sizeof (buf))) > 0)
+					got += n / sizeof (comms::Packet);
+			});
+			// Only the reactor is waited on, so a missed wake up fails here
+			for (int i = 0; i < 20 && got == 0; i++)
+				reactor.run_once(100);
+			if (got > 0)
+				pipe.binwrite(buf, sizeof (comms::Packet));
+			_exit(got > 0 ? 0 : 1);
+		}
+
+		WHEN("A packet is sent after the child is waiting") {
+			Timer::sleep_ms(50);
+			comms::byte1_t data[16] = {0};
+			comms::Packet p;
+			comms::Protocol::pack(p, ID_DATA1, 1, data);
+			REQUIRE(pipe.binwrite(&p, sizeof (p)) == sizeof (p));
+			int status = -1;
+			waitpid(-1, &status, 0);
+
+			THEN("The child is woken and reads it") {
+				REQUIRE(WIFEXITED(status));
+				REQUIRE(WEXITSTATUS(status) == 0);
+				comms::Packet recv;
+				REQUIRE(pipe.binread(&recv, sizeof (recv)) == sizeof (recv));
+				REQUIRE(memcmp(&recv, &p, sizeof (p)) == 0);
+			}
+		}
+		pipe.close_pipes();
+	}
+}
+
+SCENARIO("The reactor dispatches ready file descriptors", "[comms]") {
+
+	GIVEN("A reactor watching a socket") {
+		int fds[2];
+		REQUIRE(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+		comms::Reactor reactor;
+		int reads = 0;
+		int writes = 0;
+		reactor.add(fds[1], [&]() {
+			char buf[16];
+			read(fds[1], buf, sizeof (buf));
+			reads++;
+		}, [&]() {
+			writes++;
+			reactor.want_write(fds[1], false);
+		});
+
+		WHEN("Nothing has been sent") {
+			THEN("The reactor times out") {
+				REQUIRE(reactor.run_once(10) == 0);
+				REQUIRE(reads == 0);
+			}
+		}
+
+		WHEN("Data is sent and write notifications are enabled") {
+			write(fds[0], "x", 1);
+			reactor.want_write(fds[1], true);
+			reactor.run_once(100);
+
+			THEN("Both callbacks are run once") {
+				REQUIRE(reads == 1);
+				REQUIRE(writes == 1);
+				REQUIRE(reactor.run_once(10) == 0);
+			}
+		}
+		close(fds[0]);
+		close(fds[1]);
+	}
+}
+
+SCENARIO("Large frames carry variable length data", "[comms]") {
+
+	GIVEN("Frames of every length") {
+		comms::byte1_t data[LARGE_PACKET_MAX_DATA];
+		for (int i = 0; i < LARGE_PACKET_MAX_DATA; i++)
+			data[i] = (comms::byte1_t) (i % 7);
+
+		THEN("Each one packs, frames and unpacks correctly") {
+			for (size_t len = 0; len <= LARGE_PACKET_MAX_DATA; len++) {
+				comms::LargePacket frame;
+				int size = comms::Protocol::packLarge(frame, ID_BULK, len, data, len);
+				REQUIRE(size == (int) (len + LARGE_PACKET_OVERHEAD));
+				comms::byte1_t *raw = (comms::byte1_t*) & frame;
+				REQUIRE(raw[0] == 0);
+				REQUIRE(raw[size - 1] == 0);
+				for (int i = 1; i < size - 1; i++)
+					REQUIRE(raw[i] != 0);
+
+				comms::byte1_t id;
+				comms::byte2_t index;
+				comms::byte1_t out[LARGE_PACKET_MAX_DATA];
+				size_t out_len;
+				REQUIRE(comms::Protocol::unpackLarge(frame, size, id, index, out, out_len) == 0);
+				REQUIRE(id == ID_BULK);
+				REQUIRE(index == len);
+				REQUIRE(out_len == len);
+				REQUIRE(memcmp(out, data, len) == 0);
+			}
+		}
+
+		AND_THEN("Too much data is refused") {
+			comms::LargePacket frame;
+			REQUIRE(comms::Protocol::packLarge(frame, ID_BULK, 0, data, LARGE_PACKET_MAX_DATA + 1) == -1);
+		}
+	}
+
+	GIVEN("A bulk frame made from several packets") {
+		comms::Packet in[20];
+		comms::byte1_t data[16];
+		for (int i = 0; i < 20; i++) {
+			memset(data, i, sizeof (data));
+			comms::Protocol::pack(in[i], (i % 2) ? ID_DATA2 : ID_DATA1, i, data);
+		}
+		comms::byte1_t payload[LARGE_PACKET_MAX_DATA];
+		int len = 0;
+		int bundled = 0;
+		int n;
+		while (bundled < 20 && (n = comms::Protocol::bundle(payload, len, in[bundled])) > 0) {
+			len = n;
+			bundled++;
+		}
+
+		THEN("It is smaller than sending the packets and unbundles exactly") {
+			REQUIRE(bundled > 10);
+			REQUIRE(len + LARGE_PACKET_OVERHEAD < bundled * (int) sizeof (comms::Packet));
+			comms::Packet out[20];
+			REQUIRE(comms::Protocol::unbundle(payload, len, out, 20) == bundled);
+			REQUIRE(memcmp(out, in, bundled * sizeof (comms::Packet)) == 0);
+		}
+	}
+
+	GIVEN("A stream of packets and large frames") {
+		int fds[2];
+		REQUIRE(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+		comms::Transceiver tx(fds[0]);
+		comms::Transceiver rx(fds[1]);
+		comms::byte1_t data[100] = {1, 2, 0, 4};
+		comms::Packet p;
+		comms::LargePacket frame;
+		comms::Protocol::pack(p, ID_DATA1, 1, data);
+		int size = comms::Protocol::packLarge(frame, ID_BULK, 2, data, 100);
+		tx.sendPacket(&p);
+		tx.sendFrame(&frame, size);
+		tx.sendPacket(&p);
+
+		THEN("Frames are delimited by the transceiver") {
+			comms::LargePacket got;
+			REQUIRE(rx.recvFrame(&got, 100) == (int) sizeof (comms::Packet));
+			REQUIRE(rx.recvFrame(&got, 100) == size);
+			REQUIRE(memcmp(&got, &frame, size) == 0);
+			REQUIRE(rx.recvFrame(&got, 100) == (int) sizeof (comms::Packet));
+		}
+
+		AND_THEN("And by the packet checker one byte at a time") {
+			comms::PacketChecker checker;
+			comms::byte1_t byte;
+			int lengths[3];
+			int found = 0;
+			while (found < 3 && read(fds[1], &byte, 1) == 1) {
+				int n = checker.push_byte(byte);
+				if (n > 0)
+					lengths[found++] = n;
+			}
+			REQUIRE(found == 3);
+			REQUIRE(lengths[0] == (int) sizeof (comms::Packet));
+			REQUIRE(lengths[1] == size);
+			REQUIRE(lengths[2] == (int) sizeof (comms::Packet));
+			comms::Packet last;
+			REQUIRE(checker.get_packet(&last));
+			REQUIRE(memcmp(&last, &p, sizeof (p)) == 0);
+		}
+		close(fds[0]);
+		close(fds[1]);
+	}
+}
+
+SCENARIO("IMU samples are delta encoded for the downlink", "[comms]") {
+
+	GIVEN("A stream of noisy IMU samples") {
+		const int total = 1000;
+		std::vector<comms::ImuSample> samples(total);
+		uint32_t seed = 12345;
+		for (int i = 0; i < total; i++) {
+			for (int j = 0; j < 9; j++) {
+				seed = seed * 1103515245 + 12345;
+				int16_t base = (j == 2) ? 16384 : 100 * j;
+				samples[i].axes[j] = base + (int) ((seed >> 16) % 9) - 4;
+			}
+			seed = seed * 1103515245 + 12345;
+			samples[i].time = 20000 * i + (seed >> 16) % 40;
+		}
+		comms::ImuEncoder encoder(32);
+		std::vector<comms::Packet> packets;
+		comms::Packet out[comms::ImuEncoder::MAX_OUT];
+		for (int i = 0; i < total; i++) {
+			int n = encoder.encode(samples[i], out);
+			packets.insert(packets.end(), out, out + n);
+		}
+		int n = encoder.flush(out);
+		packets.insert(packets.end(), out, out + n);
+
+		THEN("They use at most a third of the bytes of ID_DATA1/ID_DATA2 pairs") {
+			REQUIRE(packets.size() * 3 <= 2 * total);
+		}
+
+		AND_THEN("The decoder recovers every sample exactly") {
+			comms::ImuDecoder decoder;
+			comms::ImuSample got[comms::ImuDecoder::MAX_OUT];
+			int count = 0;
+			for (size_t i = 0; i < packets.size(); i++) {
+				int m = decoder.decode(packets[i], got);
+				REQUIRE(m >= 0);
+				for (int k = 0; k < m; k++, count++) {
+					REQUIRE(got[k].time == samples[count].time);
+					REQUIRE(memcmp(got[k].axes, samples[count].axes, sizeof (got[k].axes)) == 0);
+				}
+			}
+			REQUIRE(count == total);
+			REQUIRE(decoder.dropped() == 0);
+		}
+
+		AND_THEN("A lost packet only loses samples until the next keyframe") {
+			comms::ImuDecoder decoder;
+			comms::ImuSample got[comms::ImuDecoder::MAX_OUT];
+			int count = 0;
+			bool resynced = false;
+			for (size_t i = 0; i < packets.size(); i++) {
+				if (i == 5)
+					continue;
+				int m = decoder.decode(packets[i], got);
+				for (int k = 0; k < m; k++) {
+					count++;
+					// Samples are numbered by the time they were taken
+					int number = got[k].time / 20000;
+					REQUIRE(got[k].time == samples[number].time);
+					if (number > 32)
+						resynced = true;
+				}
+			}
+			REQUIRE(resynced);
+			REQUIRE(decoder.dropped() > 0);
+			REQUIRE(count + (int) decoder.dropped() < total);
+		}
+	}
+
+	GIVEN("A sample split over ID_DATA1 and ID_DATA2 packets by the IMU process") {
+		comms::byte1_t raw[22];
+		for (int i = 0; i < 22; i++)
+			raw[i] = i * 7;
+		comms::Packet p[2];
+		comms::Protocol::pack(p[0], ID_DATA1, 9, raw);
+		comms::Protocol::pack(p[1], ID_DATA2, 9, raw + 12);
+		comms::ImuEncoder encoder;
+		comms::Packet out[comms::ImuEncoder::MAX_OUT];
+
+		THEN("The halves are joined into one sample") {
+			REQUIRE(encoder.encode(p[0], out) == 0);
+			REQUIRE(encoder.encode(p[1], out) == 2);
+			comms::ImuDecoder decoder;
+			comms::ImuSample s;
+			REQUIRE(decoder.decode(out[0], &s) == 0);
+			REQUIRE(decoder.decode(out[1], &s) == 1);
+			comms::byte1_t back[22];
+			s.toRaw(back);
+			REQUIRE(memcmp(back, raw, 22) == 0);
+		}
+	}
+}
+
+SCENARIO("The downlink scheduler puts critical packets first", "[comms]") {
+
+	GIVEN("A scheduler at 38400 baud with a backlog of IMU data") {
+		comms::TxScheduler scheduler(38400, 4, 4, 8, 16);
+		comms::byte1_t data[16] = {0};
+		comms::Packet imu, msg, cmd;
+		comms::Protocol::pack(imu, ID_DATA1, 0, data);
+		comms::Protocol::pack(msg, ID_MSG1, 0, data);
+		comms::Protocol::pack(cmd, ID_CMD, 0, data);
+		for (int i = 0; i < 20; i++)
+			scheduler.push(imu);
+		uint64_t now = 1000000;
+		comms::Packet out[32];
+
+		THEN("The oldest bulk packets are dropped and counted") {
+			REQUIRE(scheduler.queued(comms::TxScheduler::BULK) == 16);
+			REQUIRE(scheduler.dropped(comms::TxScheduler::BULK) == 4);
+		}
+
+		WHEN("A message and a command are queued behind it") {
+			scheduler.push(msg);
+			scheduler.push(cmd);
+			int n = scheduler.next(out, 32, now);
+
+			THEN("They are sent before the data") {
+				REQUIRE(n == 4);
+				REQUIRE(out[0].ID == ID_CMD);
+				REQUIRE(out[1].ID == ID_MSG1);
+				REQUIRE(out[2].ID == ID_DATA1);
+			}
+		}
+
+		WHEN("Time passes") {
+			int first = scheduler.next(out, 32, now);
+			REQUIRE(scheduler.next(out, 32, now) == 0);
+			int wait = scheduler.wait_ms(now);
+
+			THEN("Packets are released at the baud rate") {
+				REQUIRE(first == 4);
+				// 24 bytes at 3840 bytes/s is 6.25ms
+				REQUIRE(wait == 7);
+				REQUIRE(scheduler.next(out, 32, now + 100000) == 4);
+				REQUIRE(scheduler.next(out, 32, now + 100000 + 6300) == 1);
+			}
+		}
+
+		WHEN("Packets could not be written") {
+			int n = scheduler.next(out, 32, now);
+			scheduler.requeue(out + 1, n - 1);
+
+			THEN("They go back to the front of the queue") {
+				REQUIRE(scheduler.queued(comms::TxScheduler::BULK) == 15);
+				REQUIRE(scheduler.sent(comms::TxScheduler::BULK) == 1);
+				REQUIRE(scheduler.wait_ms(now) == 0);
+			}
+		}
+	}
+}
+
+SCENARIO("The rate governor keeps IMU data within the link budget", "[comms]") {
+
+	GIVEN("Samples at 100Hz and a budget of 960 bytes/s (40 packets/s)") {
+		comms::ImuSample s;
+		for (int j = 0; j < 9; j++)
+			s.axes[j] = 0;
+
+		WHEN("Samples are averaged") {
+			comms::RateGovernor governor(960, comms::RateGovernor::AVERAGE);
+			comms::ImuSample out;
+			int sent = 0;
+			for (int i = 0; i < 1000; i++) {
+				s.time = i * 10000;
+				s.axes[0] = i;
+				if (governor.offer(s, out)) {
+					sent++;
+					REQUIRE(out.time <= s.time);
+					REQUIRE(out.axes[0] <= i);
+					governor.charge(sizeof (comms::Packet));
+				}
+			}
+
+			THEN("Only what fits is sent and every sample is accounted for") {
+				REQUIRE(sent >= 390);
+				REQUIRE(sent <= 410);
+				REQUIRE(governor.forwarded() == (unsigned long) sent);
+				REQUIRE(governor.dropped() == 0);
+				REQUIRE(governor.summarized() > 0);
+				REQUIRE(governor.summarized() <= 1000);
+			}
+		}
+
+		WHEN("Samples are decimated") {
+			comms::RateGovernor governor(960, comms::RateGovernor::DECIMATE);
+			comms::ImuSample out;
+			for (int i = 0; i < 1000; i++) {
+				s.time = i * 10000;
+				if (governor.offer(s, out)) {
+					REQUIRE(out.time == s.time);
+					governor.charge(sizeof (comms::Packet));
+				}
+			}
+
+			THEN("Samples which do not fit are dropped") {
+				REQUIRE(governor.forwarded() + governor.dropped() == 1000);
+				REQUIRE(governor.summarized() == 0);
+			}
+		}
+
+		WHEN("Other data was charged while no samples arrived") {
+			comms::RateGovernor governor(960, comms::RateGovernor::DECIMATE);
+			for (int i = 0; i < 10000; i++)
+				governor.charge(sizeof (comms::Packet));
+			comms::ImuSample out;
+			int first = -1;
+			for (int i = 0; i < 100 && first < 0; i++) {
+				s.time = i * 10000;
+				if (governor.offer(s, out))
+					first = i;
+			}
+
+			THEN("Samples are sent again within a fraction of a second") {
+				REQUIRE(first >= 0);
+				// At most two bursts (144 bytes) to pay back at 960 bytes/s
+				REQUIRE(first <= 16);
+			}
+		}
+	}
+}
+
+SCENARIO("Messages are split into packets and put back together", "[comms]") {
+
+	GIVEN("Two long messages from each Pi sent at the same time") {
+		std::string text1 = "Pi1: Count: 19500 Rate: 250, boom extended\n";
+		std::string text2 = "Pi2: Eth_u, RXSM_u, Cam_u, IMU_u, ImP_u\n";
+		comms::MsgFragmenter pi1(ID_MSG1), pi2(ID_MSG2);
+		int n1 = pi1.begin(text1.data(), text1.length());
+		int n2 = pi2.begin(text2.data(), text2.length());
+		std::vector<comms::Packet> packets;
+		comms::Packet p;
+		bool more1 = true, more2 = true;
+		while (more1 || more2) {
+			if ((more1 = pi1.next(p)))
+				packets.push_back(p);
+			if ((more2 = pi2.next(p)))
+				packets.push_back(p);
+		}
+		REQUIRE(n1 == 3);
+		REQUIRE(n2 == 3);
+		REQUIRE(packets.size() == 6);
+		comms::MsgReassembler messages;
+		char out[comms::MsgReassembler::MAX_LEN + 1];
+
+		THEN("Both are rebuilt even when fragments arrive out of order") {
+			std::vector<std::string> got;
+			for (int i = packets.size() - 1; i >= 0; i--) {
+				int len = messages.add(packets[i], 0, out);
+				if (len > 0)
+					got.push_back(std::string(out, len));
+			}
+			REQUIRE(got.size() == 2);
+			REQUIRE(got[0] == text2);
+			REQUIRE(got[1] == text1);
+		}
+
+		AND_THEN("A message with a missing fragment is given up after the timeout") {
+			for (size_t i = 1; i < packets.size(); i++) {
+				int len = messages.add(packets[i], 0, out);
+				if (len > 0)
+					REQUIRE(std::string(out, len) == text2);
+			}
+			REQUIRE(messages.lost() == 0);
+			comms::MsgFragmenter later(ID_MSG1);
+			later.begin("ACK", 3);
+			later.next(p);
+			REQUIRE(messages.add(p, 20000, out) == 3);
+			REQUIRE(std::string(out) == "ACK");
+			REQUIRE(messages.lost() == 1);
+		}
+
+		AND_THEN("Other packets are not treated as messages") {
+			comms::byte1_t data[16] = {0};
+			comms::Protocol::pack(p, ID_DATA1, 0, data);
+			REQUIRE(messages.add(p, 0, out) == -1);
+		}
+	}
+}
+
+SCENARIO("Typed payloads are packed by packet ID", "[comms]") {
+
+	GIVEN("An IMU magnetometer and time payload") {
+		comms::ImuMagTime in;
+		in.mag[0] = -1;
+		in.mag[1] = 300;
+		in.mag[2] = 0;
+		in.set_time(123456789);
+		comms::Packet p;
+		comms::Protocol::pack<ID_DATA2>(p, 42, in);
+
+		THEN("It unpacks to the same payload") {
+			comms::ImuMagTime out;
+			comms::byte2_t index;
+			REQUIRE(comms::Protocol::unpack<ID_DATA2>(p, index, out) == 0);
+			REQUIRE(index == 42);
+			REQUIRE(memcmp(&in, &out, sizeof (in)) == 0);
+			REQUIRE(out.time() == 123456789);
+		}
+
+		AND_THEN("It matches packing the raw bytes") {
+			comms::Packet raw;
+			comms::Protocol::pack(raw, ID_DATA2, 42, &in);
+			REQUIRE(memcmp(&raw, &p, sizeof (p)) == 0);
+			REQUIRE(comms::lengthByID(ID_DATA2) == sizeof (comms::ImuMagTime));
+		}
+
+		AND_THEN("Unpacking as another type is refused") {
+			comms::ImuAccGyr wrong;
+			comms::byte2_t index;
+			REQUIRE(comms::Protocol::unpack<ID_DATA1>(p, index, wrong) == -3);
+		}
+	}
+}
+
+SCENARIO("Packet indexes are unwrapped and gaps counted", "[comms]") {
+
+	GIVEN("A stream which wraps its 16 bit index") {
+		comms::SequenceTracker seq;
+		uint32_t ext = 0;
+		for (uint32_t i = 65000; i < 70000; i++)
+			REQUIRE(seq.add(ID_DATA1, (comms::byte2_t) i, &ext) == 0);
+
+		THEN("The sequence number keeps counting") {
+			REQUIRE(ext == 69999);
+			REQUIRE(seq.stream(ID_DATA1).received == 5000);
+			REQUIRE(seq.lost() == 0);
+		}
+
+		WHEN("Packets are lost, repeated and reordered") {
+			REQUIRE(seq.add(ID_DATA1, 70003 & 0xFFFF) == 3);
+			REQUIRE(seq.add(ID_DATA1, 70001 & 0xFFFF) == -2);
+			REQUIRE(seq.add(ID_DATA1, 70001 & 0xFFFF) == -1);
+			REQUIRE(seq.add(ID_DATA1, 70003 & 0xFFFF) == -1);
+			REQUIRE(seq.add(ID_DATA1, 70004 & 0xFFFF, &ext) == 0);
+
+			THEN("Each is counted once") {
+				const comms::SequenceTracker::Stream &s = seq.stream(ID_DATA1);
+				REQUIRE(ext == 70004);
+				REQUIRE(s.lost == 2);
+				REQUIRE(s.reordered == 1);
+				REQUIRE(s.duplicates == 2);
+				REQUIRE(s.received == 5003);
+			}
+
+			AND_THEN("Other streams are unaffected") {
+				REQUIRE(seq.add(ID_DATA2, 7) == 0);
+				REQUIRE(seq.stream(ID_DATA2).lost == 0);
+			}
+		}
+	}
+
+	GIVEN("Packed packets") {
+		comms::SequenceTracker seq;
+		comms::Packet p;
+		comms::byte1_t data[16] = {0};
+		// An index of 0x0100 has a zero byte which COBS changes
+		comms::Protocol::pack(p, ID_DATA3, 0x00FF, data);
+		REQUIRE(seq.add(p) == 0);
+		comms::Protocol::pack(p, ID_DATA3, 0x0100, data);
+		REQUIRE(seq.add(p) == 0);
+
+		THEN("Message fragments are not tracked") {
+			comms::MsgFragmenter frag(ID_MSG1);
+			frag.begin("hello", 5);
+			frag.next(p);
+			REQUIRE(seq.add(p) == -3);
+		}
+	}
+}
+
+/*
+ * Deliver the frames a window has not sent yet to the other side
+ * @return Number of new frames accepted
+ */
+static int deliver(comms::LinkWindow &from, comms::LinkWindow &to) {
+	int size;
+	int accepted = 0;
+	const comms::LargePacket *f;
+	while ((f = from.unsent(size)) != NULL) {
+		comms::LargePacket frame;
+		memcpy(&frame, f, size);
+		comms::byte1_t id;
+		comms::byte2_t index;
+		comms::byte1_t data[LARGE_PACKET_MAX_DATA];
+		size_t len;
+		REQUIRE(comms::Protocol::unpackLarge(frame, size, id, index, data, len) == 0);
+		if (to.accept(index) >= 0)
+			accepted++;
+		from.sent();
+	}
+	return accepted;
+}
+
+static void ack(comms::LinkWindow &from, comms::LinkWindow &to) {
+	comms::Packet p;
+	from.make_ack(p);
+	from.ack_sent();
+	to.on_ack(p);
+}
+
+SCENARIO("Frames on the Ethernet link survive reconnecting", "[comms]") {
+
+	GIVEN("Two sides which have exchanged acks") {
+		comms::LinkWindow pi1(8), pi2(8);
+		pi1.rewind();
+		pi2.rewind();
+		ack(pi1, pi2);
+		ack(pi2, pi1);
+		comms::byte1_t data[20] = {1, 2, 3};
+
+		WHEN("Frames are sent without waiting for acks") {
+			for (int i = 0; i < 8; i++)
+				REQUIRE(pi1.add(data, sizeof (data)) > 0);
+
+			THEN("They are held until the window is full") {
+				REQUIRE(pi1.room() == 0);
+				REQUIRE(pi1.add(data, sizeof (data)) == -1);
+				REQUIRE(deliver(pi1, pi2) == 8);
+				REQUIRE(pi2.ack_due());
+				ack(pi2, pi1);
+				REQUIRE(pi1.room() == 8);
+				REQUIRE(pi1.unacked() == 0);
+			}
+		}
+
+		WHEN("The connection is lost before the ack arrives") {
+			for (int i = 0; i < 5; i++)
+				pi1.add(data, sizeof (data));
+			REQUIRE(deliver(pi1, pi2) == 5);
+			pi1.add(data, sizeof (data));
+			// Reconnect: the unacknowledged frames go again
+			pi1.rewind();
+			pi2.rewind();
+			ack(pi1, pi2);
+			ack(pi2, pi1);
+
+			THEN("Only the new frame is passed on") {
+				REQUIRE(pi1.unacked() == 1);
+				REQUIRE(deliver(pi1, pi2) == 1);
+				REQUIRE(pi2.duplicates() == 0);
+				REQUIRE(pi1.resent() == 5);
+			}
+		}
+
+		WHEN("The connection is lost before frames arrive") {
+			for (int i = 0; i < 3; i++)
+				pi1.add(data, sizeof (data));
+			int size;
+			pi1.unsent(size);
+			pi1.sent(); // Lost with the connection
+			pi1.rewind();
+			ack(pi1, pi2);
+
+			THEN("Every frame arrives once") {
+				REQUIRE(deliver(pi1, pi2) == 3);
+				REQUIRE(pi2.duplicates() == 0);
+				REQUIRE(pi2.lost() == 0);
+				ack(pi2, pi1);
+				REQUIRE(pi1.unacked() == 0);
+			}
+		}
+
+		WHEN("Frames are repeated after the acks were lost") {
+			for (int i = 0; i < 3; i++)
+				pi1.add(data, sizeof (data));
+			deliver(pi1, pi2);
+			pi1.rewind();
+
+			THEN("The repeats are ignored and acknowledged") {
+				REQUIRE(deliver(pi1, pi2) == 0);
+				REQUIRE(pi2.duplicates() == 3);
+				ack(pi2, pi1);
+				REQUIRE(pi1.unacked() == 0);
+			}
+		}
+
+		WHEN("The sender restarts") {
+			for (int i = 0; i < 3; i++)
+				pi1.add(data, sizeof (data));
+			deliver(pi1, pi2);
+			comms::LinkWindow restarted(8);
+			restarted.rewind();
+			ack(restarted, pi2);
+			ack(pi2, restarted);
+			restarted.add(data, sizeof (data));
+
+			THEN("Its frames numbered from 0 are accepted") {
+				REQUIRE(restarted.session() != pi1.session());
+				REQUIRE(deliver(restarted, pi2) == 1);
+				REQUIRE(pi2.duplicates() == 0);
+			}
+		}
+	}
+}
+
+SCENARIO("Frames are copied to every listening client", "[comms]") {
+
+	GIVEN("Three clients connected to the server") {
+		comms::FanOut fan(4096);
+		int server[3], client[3];
+		for (int i = 0; i < 3; i++) {
+			int sv[2];
+			REQUIRE(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0);
+			server[i] = sv[0];
+			client[i] = sv[1];
+			fcntl(server[i], F_SETFL, O_NONBLOCK);
+			fcntl(client[i], F_SETFL, O_NONBLOCK);
+			fan.add(server[i]);
+		}
+		comms::byte1_t frame[200];
+		comms::byte1_t buf[sizeof (frame)];
+		for (size_t i = 0; i < sizeof (frame); i++)
+			frame[i] = i;
+
+		WHEN("A frame is broadcast") {
+			REQUIRE(fan.broadcast(frame, sizeof (frame)).empty());
+
+			THEN("Every client receives it") {
+				for (int i = 0; i < 3; i++) {
+					REQUIRE(read(client[i], buf, sizeof (buf)) == sizeof (frame));
+					REQUIRE(memcmp(buf, frame, sizeof (frame)) == 0);
+					REQUIRE(fan.pending(server[i]) == 0);
+				}
+			}
+		}
+
+		WHEN("One client stops reading") {
+			std::vector<int> dropped;
+			for (int n = 0; n < 2000 && dropped.empty(); n++) {
+				dropped = fan.broadcast(frame, sizeof (frame));
+				// The others keep up
+				for (int i = 1; i < 3; i++)
+					REQUIRE(read(client[i], buf, sizeof (buf)) == sizeof (frame));
+			}
+
+			THEN("Only that client is dropped") {
+				REQUIRE(dropped.size() == 1);
+				REQUIRE(dropped[0] == server[0]);
+				REQUIRE(fan.evicted() == 1);
+				REQUIRE(fan.size() == 2);
+				REQUIRE_FALSE(fan.contains(server[0]));
+				REQUIRE(fan.broadcast(frame, sizeof (frame)).empty());
+				REQUIRE(read(client[1], buf, sizeof (buf)) == sizeof (frame));
+			}
+		}
+
+		WHEN("A client disconnects") {
+			close(client[2]);
+			client[2] = -1;
+
+			THEN("It is dropped on the next broadcast") {
+				std::vector<int> dropped = fan.broadcast(frame, sizeof (frame));
+				REQUIRE(dropped.size() == 1);
+				REQUIRE(dropped[0] == server[2]);
+				REQUIRE(fan.evicted() == 0);
+			}
+		}
+
+		for (int i = 0; i < 3; i++) {
+			close(server[i]);
+			if (client[i] >= 0)
+				close(client[i]);
+		}
+	}
+
+	GIVEN("A window with nobody acknowledging its frames") {
+		comms::LinkWindow window(4);
+		comms::byte1_t data[20] = {1, 2, 3};
+		for (int i = 0; i < 4; i++)
+			window.add(data, sizeof (data));
+
+		WHEN("The oldest frames are dropped to make room") {
+			window.drop_oldest();
+			window.drop_oldest();
+
+			THEN("New frames can be added and the old ones are not sent") {
+				REQUIRE(window.room() == 2);
+				REQUIRE(window.dropped() == 2);
+				int size;
+				REQUIRE(window.add(data, sizeof (data)) > 0);
+				REQUIRE(window.unsent(size) == window.frame(2, size));
+			}
+		}
+	}
+}
+
+SCENARIO("Datagrams are exchanged through a multicast group", "[comms]") {
+
+	GIVEN("Two sockets in the same group on loopback") {
+		int port = 41000 + getpid() % 1000;
+		comms::MulticastSocket pi1, pi2;
+		REQUIRE(pi1.open("239.255.31.41", port, port + 1, "127.0.0.1") == 0);
+		REQUIRE(pi2.open("239.255.31.41", port + 1, port, "127.0.0.1") == 0);
+		comms::byte1_t data[100];
+		comms::byte1_t buf[200];
+		for (size_t i = 0; i < sizeof (data); i++)
+			data[i] = i;
+
+		WHEN("Each sends a datagram") {
+			REQUIRE(pi1.send(data, sizeof (data)) == sizeof (data));
+			REQUIRE(pi2.send(data, 10) == 10);
+			usleep(10000);
+
+			THEN("Only the other one receives it, whole") {
+				REQUIRE(pi2.recv(buf, sizeof (buf)) == sizeof (data));
+				REQUIRE(memcmp(buf, data, sizeof (data)) == 0);
+				REQUIRE(pi1.recv(buf, sizeof (buf)) == 10);
+				REQUIRE(pi1.recv(buf, sizeof (buf)) == 0);
+				REQUIRE(pi2.recv(buf, sizeof (buf)) == 0);
+			}
+		}
+	}
+
+	GIVEN("An address which is not a multicast group") {
+		comms::MulticastSocket sock;
+
+		THEN("Joining fails") {
+			REQUIRE(sock.open("not an address", 41000, 41001) == -1);
+			REQUIRE(sock.fd() == -1);
+		}
+	}
+}
+
+SCENARIO("Received packets are backed up in binary", "[comms]") {
+
+	GIVEN("A backup of 1000 packets") {
+		char name[] = "/tmp/backup_testXXXXXX";
+		int fd = mkstemp(name);
+		close(fd);
+		unlink(name); // A new file gets a header
+		comms::BackupLog backup(4096, 0);
+		REQUIRE(backup.open(name) == 0);
+		std::vector<comms::Packet> packets(1000);
+		for (int i = 0; i < 1000; i++) {
+			comms::byte1_t data[16];
+			for (int j = 0; j < 16; j++)
+				data[j] = i + j;
+			comms::Protocol::pack(packets[i], ID_DATA1, i, data);
+			REQUIRE(backup.add(packets[i]) == 0);
+			if (i % 100 == 99)
+				REQUIRE(backup.flush() == 0);
+		}
+		backup.close();
+		REQUIRE(backup.records() == 1000);
+
+		WHEN("It is read back") {
+			comms::BackupReader reader;
+			REQUIRE(reader.open(name) == 0);
+
+			THEN("Every packet comes back exactly as received") {
+				comms::BackupRecord r;
+				for (int i = 0; i < 1000; i++) {
+					REQUIRE(reader.next(r) == 1);
+					REQUIRE(memcmp(&r.packet, &packets[i], sizeof (comms::Packet)) == 0);
+				}
+				REQUIRE(reader.next(r) == 0);
+				REQUIRE(reader.skipped() == 0);
+			}
+		}
+
+		WHEN("A record is damaged") {
+			int fd = open(name, O_WRONLY);
+			comms::byte1_t junk = 0xFF;
+			pwrite(fd, &junk, 1, sizeof (comms::BackupHeader) + 10 * sizeof (comms::BackupRecord) + 12);
+			close(fd);
+
+			THEN("Only that record is lost") {
+				comms::BackupReader reader;
+				REQUIRE(reader.open(name) == 0);
+				comms::BackupRecord r;
+				int count = 0;
+				while (reader.next(r)) {
+					REQUIRE(r.packet.index != packets[10].index);
+					count++;
+				}
+				REQUIRE(count == 999);
+				REQUIRE(reader.skipped() == sizeof (comms::BackupRecord));
+			}
+		}
+
+		WHEN("More is added after reopening") {
+			REQUIRE(backup.open(name) == 0);
+			backup.add(packets[0]);
+			backup.close();
+
+			THEN("It follows on in the same file") {
+				comms::BackupReader reader;
+				REQUIRE(reader.open(name) == 0);
+				comms::BackupRecord r;
+				int count = 0;
+				while (reader.next(r))
+					count++;
+				REQUIRE(count == 1001);
+			}
+		}
+
+		unlink(name);
+	}
+}
+
+SCENARIO("The clock offset between the Pis is estimated from pings", "[comms]") {
+
+	GIVEN("A clock 2.5s ahead of ours and running 40ppm fast") {
+		const int64_t start = 1500000000000000LL;
+		const int64_t ahead = 2500000;
+		const double fast = 40e-6;
+		int64_t step = 0;
+		auto remote = [&](int64_t local) {
+			return local + ahead + step + (int64_t) (fast * (local - start));
+		};
+		comms::ClockSync sync;
+		srand(3);
+		int64_t now = start;
+		// One ping a second, each way takes 300us plus sometimes up to 20ms
+		// waiting behind data
+		auto exchange = [&]() {
+			comms::Packet ping, pong;
+			sync.make_ping(ping, now);
+			int64_t there = now + 300 + ((rand() % 3 == 0) ? rand() % 20000 : 0);
+			REQUIRE(comms::ClockSync::make_pong(ping, pong, remote(there), remote(there) + 50) == 0);
+			int64_t back = there + 50 + 300 + ((rand() % 3 == 0) ? rand() % 20000 : 0);
+			int result = sync.on_pong(pong, back);
+			now += 1000000;
+			return result;
+		};
+
+		WHEN("Pings have been exchanged for ten minutes") {
+			int used = 0;
+			for (int i = 0; i < 600; i++)
+				used += exchange();
+
+			THEN("The offset and drift are close to the real ones") {
+				const comms::ClockEstimate &e = sync.estimate();
+				REQUIRE(e.samples == 600);
+				REQUIRE(used > 0);
+				REQUIRE(used < 600); // Slow samples are not used
+				REQUIRE(e.rtt_us < 1000);
+				REQUIRE(std::abs(e.to_remote(now) - remote(now)) < 200);
+				REQUIRE(std::abs(e.drift - fast) < 2e-6);
+				REQUIRE(std::abs(e.to_local(e.to_remote(now)) - now) <= 1);
+				REQUIRE(sync.steps() == 0);
+			}
+
+			AND_WHEN("The other clock is set forward by a second") {
+				step = 1000000;
+				for (int i = 0; i < 60; i++)
+					exchange();
+
+				THEN("The jump is noticed and the offset follows it") {
+					REQUIRE(sync.steps() == 1);
+					REQUIRE(std::abs(sync.estimate().to_remote(now) - remote(now)) < 500);
+				}
+			}
+		}
+
+		WHEN("A pong is corrupt") {
+			comms::Packet ping, pong;
+			sync.make_ping(ping, now);
+			comms::ClockSync::make_pong(ping, pong, remote(now), remote(now));
+			pong.data[3] ^= 0x10;
+
+			THEN("It is not used") {
+				REQUIRE(sync.on_pong(pong, now + 1000) == -1);
+				REQUIRE(sync.estimate().samples == 0);
+				REQUIRE(sync.estimate().to_remote(now) == now);
+			}
+		}
+
+		WHEN("The estimate is shared with another process") {
+			comms::SharedClock shared;
+			for (int i = 0; i < 10; i++)
+				exchange();
+			pid_t pid = fork();
+			if (pid == 0) {
+				shared.store(sync.estimate());
+				_exit(0);
+			}
+			waitpid(pid, NULL, 0);
+
+			THEN("The other process reads the same estimate") {
+				comms::ClockEstimate e = shared.load();
+				REQUIRE(e.samples == 10);
+				REQUIRE(e.offset_us == sync.estimate().offset_us);
+				REQUIRE(e.ref_us == sync.estimate().ref_us);
+			}
+		}
+	}
+}
@@ -4,3 +4,143 @@
  * and open the template in the editor.
  */
 
+
+#include "catch.h"
+#include "timing/backoff.h"
+#include "Ethernet/replication.h"
+#include "UART/imp_file.h"
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <fstream>
+#include <sstream>
+#include <string>
+
+SCENARIO("Reconnection attempts back off", "[ethernet]") {
+
+	GIVEN("A backoff from 20ms to 2s") {
+		Backoff backoff(20, 2000);
+
+		THEN("Delays double with jitter up to the limit") {
+			int limit = 20;
+			for (int i = 0; i < 12; i++) {
+				int d = backoff.next_ms();
+				REQUIRE(d >= limit / 2);
+				REQUIRE(d <= limit);
+				limit = std::min(limit * 2, 2000);
+			}
+		}
+
+		AND_THEN("Succeeding starts again from the shortest delay") {
+			for (int i = 0; i < 5; i++)
+				backoff.next_ms();
+			backoff.reset();
+			REQUIRE(backoff.next_ms() <= 20);
+		}
+	}
+}
+
+static void write_file(const std::string &path, size_t size, size_t from = 0) {
+	std::ofstream outf(path.c_str(), std::ofstream::binary);
+	for (size_t i = from; i < size; i++)
+		outf.put((char) (i * 7 + i / 251));
+}
+
+static std::string read_file(const std::string &path) {
+	std::ifstream inf(path.c_str(), std::ifstream::binary);
+	std::stringstream ss;
+	ss << inf.rdbuf();
+	return ss.str();
+}
+
+SCENARIO("Data files are copied to the other Pi", "[ethernet]") {
+
+	GIVEN("Each Pi with files to copy, connected together") {
+		char base[] = "/tmp/replication_XXXXXX";
+		REQUIRE(mkdtemp(base) != NULL);
+		std::string dir = base;
+		mkdir((dir + "/pi1").c_str(), 0755);
+		mkdir((dir + "/pi2").c_str(), 0755);
+		write_file(dir + "/pi1/imu_0000.txt", 300000);
+		write_file(dir + "/pi1/imu_0001.txt", 1000);
+		write_file(dir + "/pi2/imp_0000.txt", 50000);
+		// Part of one file arrived before the connection was lost
+		mkdir((dir + "/copy_on_pi2").c_str(), 0755);
+		mkdir((dir + "/copy_on_pi2/Pi1").c_str(), 0755);
+		write_file(dir + "/copy_on_pi2/Pi1/imu_0000.txt", 100000);
+
+		Logger Log(dir + "/log");
+		int sv[2];
+		REQUIRE(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0);
+		pid_t pid = fork();
+		if (pid == 0) {
+			close(sv[0]);
+			std::vector<ReplicaSource> sources = {{dir + "/pi2", "Pi2"}};
+			FileSync pi2(sv[1], Log, sources, dir + "/copy_on_pi2", 0);
+			try {
+				pi2.serve();
+			} catch (EthernetException e) {
+			}
+			_exit(0);
+		}
+		close(sv[1]);
+		std::vector<ReplicaSource> sources = {{dir + "/pi1", "Pi1"}};
+		FileSync pi1(sv[0], Log, sources, dir + "/copy_on_pi1", 0);
+
+		WHEN("They exchange files") {
+			int sent = pi1.send_files();
+			pi1.request();
+			int received = pi1.receive_files();
+
+			THEN("Each has a copy of the other's files") {
+				REQUIRE(sent == 2);
+				REQUIRE(received == 1);
+				REQUIRE(read_file(dir + "/copy_on_pi2/Pi1/imu_0000.txt") ==
+						read_file(dir + "/pi1/imu_0000.txt"));
+				REQUIRE(read_file(dir + "/copy_on_pi2/Pi1/imu_0001.txt") ==
+						read_file(dir + "/pi1/imu_0001.txt"));
+				REQUIRE(read_file(dir + "/copy_on_pi1/Pi2/imp_0000.txt") ==
+						read_file(dir + "/pi2/imp_0000.txt"));
+			}
+
+			AND_THEN("Only the part not already copied was sent") {
+				REQUIRE(pi1.bytes_sent() == 300000 - 100000 + 1000);
+			}
+
+			AND_THEN("Files are not sent again until they change") {
+				REQUIRE(pi1.send_files() == 0);
+				write_file(dir + "/pi1/imu_0001.txt", 1500);
+				REQUIRE(pi1.send_files() == 1);
+				REQUIRE(pi1.bytes_sent() == 300000 - 100000 + 1500);
+				pi1.request();
+				REQUIRE(pi1.receive_files() == 0);
+				REQUIRE(read_file(dir + "/copy_on_pi2/Pi1/imu_0001.txt") ==
+						read_file(dir + "/pi1/imu_0001.txt"));
+			}
+		}
+
+		WHEN("An ImP segment is still being written") {
+			ImpFile imp(4096, 8, 0);
+			REQUIRE(imp.open(dir + "/pi1/imp") == 0);
+			comms::byte1_t frame[28] = {1};
+			REQUIRE(imp.add(IMP_FRAME_PRIMARY, frame, sizeof (frame)) == 0);
+			REQUIRE(imp.flush() == 0);
+
+			THEN("It is only copied once closed") {
+				REQUIRE(pi1.send_files() == 2);
+				imp.close();
+				REQUIRE(pi1.send_files() == 1);
+				pi1.request();
+				pi1.receive_files();
+				REQUIRE(read_file(dir + "/copy_on_pi2/Pi1/imp_0000.imp") ==
+						read_file(dir + "/pi1/imp_0000.imp"));
+			}
+		}
+
+		close(sv[0]);
+		waitpid(pid, NULL, 0);
+		system(("rm -rf " + dir).c_str());
+	}
+}
@@ -0,0 +1,443 @@
+/*
+ * Tests for the serial port set up. A pty pair stands in for the UART so
+ * these can be run on any machine.
+ */
+
+#include "catch.h"
+
+#include "UART/baud.h"
+#include "UART/UART.h"
+#include "UART/imp_pipeline.h"
+#include "UART/imp_file.h"
+#include "comms/protocol.h"
+#include "comms/packet.h"
+#include "comms/transceiver.h"
+#include "timing/timer.h"
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <deque>
+
+SCENARIO("Serial ports run at any baud rate", "[uart]") {
+
+	GIVEN("A pty pair standing in for the UART") {
+		int master = posix_openpt(O_RDWR | O_NOCTTY);
+		REQUIRE(master >= 0);
+		REQUIRE(grantpt(master) == 0);
+		REQUIRE(unlockpt(master) == 0);
+		int port = open(ptsname(master), O_RDWR | O_NOCTTY);
+		REQUIRE(port >= 0);
+
+		WHEN("Rates above 230400 are set") {
+
+			THEN("They are used") {
+				REQUIRE(setup_serial(port, 460800) == 460800);
+				REQUIRE(setup_serial(port, 921600) == 921600);
+			}
+		}
+
+		WHEN("A rate with no Bxxx constant is set") {
+
+			THEN("It is used") {
+				REQUIRE(setup_serial(port, 250000) == 250000);
+				REQUIRE(setup_serial(port, 1234567) == 1234567);
+			}
+		}
+
+		WHEN("The rate or port is not valid") {
+
+			THEN("It fails") {
+				REQUIRE(setup_serial(port, 0) == -1);
+				REQUIRE(setup_serial(-1, 9600) == -1);
+			}
+		}
+
+		WHEN("Packets are streamed through it at 921600") {
+			REQUIRE(setup_serial(port, 921600) == 921600);
+			const int total = 20000;
+			pid_t pid = fork();
+			if (pid == 0) {
+				comms::Transceiver tx(master);
+				comms::Packet p[32];
+				comms::byte1_t data[16];
+				for (int i = 0; i < total; i += 32) {
+					for (int j = 0; j < 32; j++) {
+						for (int k = 0; k < 16; k++)
+							data[k] = (i + j) * 7 + k;
+						comms::Protocol::pack(p[j], ID_DATA3, i + j, data);
+					}
+					int n = std::min(32, total - i);
+					for (int sent = 0; sent < n;)
+						sent += tx.sendPackets(p + sent, n - sent);
+				}
+				_exit(0);
+			}
+			comms::Transceiver rx(port);
+			comms::Packet recv[64];
+			int received = 0;
+			int bad = 0;
+			int out_of_order = 0;
+			Timer tmr;
+			int n;
+			while (received < total && (n = rx.recvPackets(recv, 64, 1000)) > 0) {
+				for (int i = 0; i < n; i++) {
+					comms::byte1_t id;
+					comms::byte2_t index;
+					comms::byte1_t data[16];
+					if (comms::Protocol::unpack(recv[i], id, index, data) != 0 ||
+							data[11] != (comms::byte1_t) (received * 7 + 11)) {
+						bad++;
+					} else if (index != (comms::byte2_t) received) {
+						out_of_order++;
+					}
+					received++;
+				}
+			}
+			double seconds = tmr.elapsed_micro() / 1e6;
+			waitpid(pid, NULL, 0);
+
+			THEN("Every frame arrives intact and faster than the line rate") {
+				REQUIRE(received == total);
+				REQUIRE(bad == 0);
+				REQUIRE(out_of_order == 0);
+				// 921600 baud is 92160 bytes/s with start and stop bits
+				REQUIRE(total * sizeof (comms::Packet) / seconds > 92160);
+			}
+		}
+
+		close(port);
+		close(master);
+	}
+}
+
+SCENARIO("ImP frames are read in blocks", "[uart]") {
+
+	GIVEN("A pty pair standing in for the UART") {
+		int master = posix_openpt(O_RDWR | O_NOCTTY);
+		REQUIRE(master >= 0);
+		REQUIRE(grantpt(master) == 0);
+		REQUIRE(unlockpt(master) == 0);
+		int port = open(ptsname(master), O_RDWR | O_NOCTTY);
+		REQUIRE(port >= 0);
+		REQUIRE(setup_serial(port, 230400) == 230400);
+		FrameReader reader(port);
+		comms::byte1_t frame[64];
+		for (int i = 0; i < 40; i++)
+			frame[i] = i + 1;
+		frame[40] = 0;
+
+		WHEN("A frame arrives in pieces") {
+			pid_t pid = fork();
+			if (pid == 0) {
+				for (int i = 0; i < 41; i += 10) {
+					write(master, frame + i, std::min(10, 41 - i));
+					Timer::sleep_ms(5);
+				}
+				_exit(0);
+			}
+			comms::byte1_t got[64];
+			int n = reader.next(got, sizeof (got), 1000, 41);
+			waitpid(pid, NULL, 0);
+
+			THEN("It is read whole after one wake up") {
+				REQUIRE(n == 41);
+				REQUIRE(memcmp(got, frame, 41) == 0);
+				REQUIRE(reader.reads() == 1);
+			}
+		}
+
+		WHEN("Several frames arrive at once") {
+			write(master, frame, 41);
+			write(master, frame + 30, 11);
+			comms::byte1_t got[64];
+
+			THEN("They come out one at a time") {
+				REQUIRE(reader.next(got, sizeof (got), 1000) == 41);
+				REQUIRE(reader.next(got, sizeof (got), 1000) == 11);
+				REQUIRE(got[10] == 0);
+				REQUIRE(reader.reads() <= 2);
+			}
+		}
+
+		WHEN("A frame is not finished in time") {
+			write(master, frame, 20);
+			comms::byte1_t got[64];
+			Timer tmr;
+			int n = reader.next(got, sizeof (got), 50, 41);
+
+			THEN("Nothing is returned until the rest arrives") {
+				REQUIRE(n == 0);
+				REQUIRE(tmr.elapsed() >= 50);
+				write(master, frame + 20, 21);
+				REQUIRE(reader.next(got, sizeof (got), 1000, 41) == 41);
+				REQUIRE(memcmp(got, frame, 41) == 0);
+			}
+		}
+
+		WHEN("A frame is longer than the buffer") {
+			write(master, frame, 41);
+			comms::byte1_t got[16];
+
+			THEN("It is returned in pieces") {
+				REQUIRE(reader.next(got, sizeof (got), 1000) == 16);
+				REQUIRE(reader.next(got, sizeof (got), 1000) == 16);
+				REQUIRE(reader.next(got, sizeof (got), 1000) == 9);
+				REQUIRE(got[8] == 0);
+			}
+		}
+
+		close(port);
+		close(master);
+	}
+}
+
+SCENARIO("The RXSM downlink is sent from a child process", "[uart]") {
+
+	GIVEN("An RXSM on a pty with its downlink buffered") {
+		int master = posix_openpt(O_RDWR | O_NOCTTY);
+		REQUIRE(master >= 0);
+		REQUIRE(grantpt(master) == 0);
+		REQUIRE(unlockpt(master) == 0);
+		RXSM rxsm(230400, ptsname(master));
+		rxsm.buffer();
+
+		WHEN("Messages are sent") {
+			for (int i = 0; i < 20; i++)
+				REQUIRE(rxsm.sendMsg("Message " + std::to_string(i)) > 0);
+			comms::Transceiver ground(master);
+			comms::MsgReassembler messages;
+			comms::Packet p[16];
+			int received = 0;
+			int n;
+			while (received < 20 && (n = ground.recvPackets(p, 16, 2000)) > 0) {
+				for (int i = 0; i < n; i++) {
+					char msg[comms::MsgReassembler::MAX_LEN + 1];
+					if (messages.add(p[i], 0, msg) > 0)
+						received++;
+				}
+			}
+
+			THEN("They all reach the other end") {
+				REQUIRE(received == 20);
+			}
+		}
+
+		rxsm.end_buffer();
+		for (int i = 0; i < 100 && rxsm.status(); i++)
+			Timer::sleep_ms(10);
+		REQUIRE_FALSE(rxsm.status());
+		close(master);
+	}
+}
+
+/**
+ * Run a pipeline against a simulated ImP, which takes 30ms per measurement
+ * and sends the primary frame after 25ms
+ * @return Measurements per second
+ */
+static double simulate_imp(ImPPipeline &pipeline, int32_t duration) {
+	std::deque<int32_t> queue; // Requests waiting for the ImP
+	int32_t busy_until = 0, primary_at = -1, secondary_at = -1;
+	pipeline.rate_hz(0);
+	for (int32_t now = 0; now < duration; now++) {
+		for (int n = pipeline.due(now); n > 0; n--) {
+			queue.push_back(now);
+			pipeline.requested(now);
+		}
+		if (now == primary_at)
+			REQUIRE(pipeline.received(now) == ImPPipeline::PRIMARY);
+		if (now == secondary_at)
+			REQUIRE(pipeline.received(now) == ImPPipeline::SECONDARY);
+		if (now >= busy_until && !queue.empty()) {
+			queue.pop_front();
+			primary_at = now + 25;
+			secondary_at = now + 30;
+			busy_until = now + 30;
+		}
+	}
+	return pipeline.rate_hz(duration);
+}
+
+SCENARIO("Requests to the ImP are pipelined", "[uart]") {
+
+	GIVEN("A pipeline allowing two outstanding requests") {
+		ImPPipeline pipeline(2, 0, 400);
+
+		WHEN("Nothing has been sent") {
+
+			THEN("Both requests are due at once") {
+				REQUIRE(pipeline.due(0) == 2);
+				REQUIRE(pipeline.wait_ms(0) == 0);
+			}
+		}
+
+		WHEN("Both have been sent and a primary frame arrives") {
+			pipeline.requested(0);
+			pipeline.requested(0);
+			REQUIRE(pipeline.due(10) == 0);
+			REQUIRE(pipeline.received(20) == ImPPipeline::PRIMARY);
+
+			THEN("The next request is due before the secondary frame") {
+				REQUIRE(pipeline.in_flight() == 1);
+				REQUIRE(pipeline.due(20) == 1);
+				REQUIRE(pipeline.expecting() == ImPPipeline::SECONDARY);
+				REQUIRE(pipeline.received(25) == ImPPipeline::SECONDARY);
+				REQUIRE(pipeline.completed() == 1);
+				REQUIRE(pipeline.latency_ms() == 20);
+			}
+		}
+
+		WHEN("The ImP does not answer") {
+			pipeline.requested(0);
+			pipeline.requested(0);
+
+			THEN("The requests are sent again after the timeout") {
+				REQUIRE(pipeline.wait_ms(100) == 300);
+				REQUIRE_FALSE(pipeline.timed_out(399));
+				REQUIRE(pipeline.timed_out(400));
+				REQUIRE(pipeline.timeouts() == 1);
+				REQUIRE(pipeline.in_flight() == 0);
+				REQUIRE(pipeline.due(400) == 2);
+			}
+		}
+	}
+
+	GIVEN("An ImP taking 30ms per measurement") {
+
+		WHEN("Requests are sent as soon as each primary frame arrives") {
+			ImPPipeline one(1, 0);
+			ImPPipeline two(2, 0);
+
+			THEN("The ImP sets the rate") {
+				REQUIRE(std::abs(simulate_imp(one, 10000) - 1000.0 / 30) < 1);
+				REQUIRE(std::abs(simulate_imp(two, 10000) - 1000.0 / 30) < 1);
+				REQUIRE(one.timeouts() == 0);
+			}
+		}
+
+		WHEN("Measurements are spaced 200ms apart") {
+			ImPPipeline paced(2, 200);
+
+			THEN("There are five a second") {
+				REQUIRE(std::abs(simulate_imp(paced, 10000) - 5) < 0.2);
+				REQUIRE(paced.in_flight() <= 1);
+			}
+		}
+	}
+}
+
+SCENARIO("ImP frames are saved in binary segments", "[uart]") {
+
+	GIVEN("Segments of 4096 bytes with room for 8 records") {
+		char dir[] = "/tmp/imp_testXXXXXX";
+		REQUIRE(mkdtemp(dir) != NULL);
+		std::string base = std::string(dir) + "/imp";
+		ImpFile file(4096, 8, 0);
+		REQUIRE(file.open(base) == 0);
+		comms::byte1_t frame[1000];
+		for (int i = 0; i < 1000; i++)
+			frame[i] = i % 255 + 1;
+		ImpFileReader reader;
+		ImpRecordHeader h;
+		comms::byte1_t got[0x10000];
+
+		WHEN("A few measurements are saved") {
+			for (int i = 0; i < 3; i++) {
+				frame[0] = i + 1;
+				REQUIRE(file.add(IMP_FRAME_PRIMARY, frame, 28) == 0);
+				REQUIRE(file.add(IMP_FRAME_SECONDARY, frame, 101) == 0);
+				REQUIRE(file.flush() == 0);
+			}
+			file.close();
+			REQUIRE(reader.open(base + "_0000.imp") == 0);
+
+			THEN("They are read back through the index") {
+				REQUIRE(reader.frames() == 6);
+				REQUIRE(reader.read(4, h, got) == 28);
+				REQUIRE(h.kind == IMP_FRAME_PRIMARY);
+				REQUIRE(got[0] == 3);
+				REQUIRE(memcmp(got + 1, frame + 1, 27) == 0);
+				for (int i = 0; i < 6; i++) {
+					REQUIRE(reader.next(h, got) == ((i % 2) ? 101 : 28));
+					REQUIRE(h.kind == ((i % 2) ? IMP_FRAME_SECONDARY : IMP_FRAME_PRIMARY));
+				}
+				REQUIRE(reader.next(h, got) == 0);
+				REQUIRE(reader.damaged() == 0);
+			}
+		}
+
+		WHEN("The index fills") {
+			for (int i = 0; i < 10; i++)
+				REQUIRE(file.add(IMP_FRAME_PRIMARY, frame, 28) == 0);
+			REQUIRE(file.segment() == 1);
+			file.close();
+
+			THEN("The next segment is started") {
+				REQUIRE(reader.open(base + "_0000.imp") == 0);
+				REQUIRE(reader.frames() == 8);
+				REQUIRE(reader.open(base + "_0001.imp") == 0);
+				REQUIRE(reader.frames() == 2);
+				REQUIRE(reader.header().segment == 1);
+			}
+		}
+
+		WHEN("The segment runs out of space") {
+			for (int i = 0; i < 3; i++)
+				REQUIRE(file.add(IMP_FRAME_SECONDARY, frame, 1000) == 0);
+			REQUIRE(file.segment() == 0);
+			REQUIRE(file.add(IMP_FRAME_SECONDARY, frame, 1000) == 0);
+
+			THEN("The frame goes in the next segment") {
+				REQUIRE(file.segment() == 1);
+				REQUIRE(file.records() == 4);
+				REQUIRE(file.add(IMP_FRAME_SECONDARY, frame, 5000) == -1);
+			}
+		}
+
+		WHEN("A record is damaged") {
+			for (int i = 0; i < 3; i++)
+				REQUIRE(file.add(IMP_FRAME_PRIMARY, frame, 28) == 0);
+			file.close();
+			int fd = open((base + "_0000.imp").c_str(), O_RDWR);
+			comms::byte1_t bad = 0;
+			REQUIRE(pwrite(fd, &bad, 1, sizeof (ImpFileHeader) + 8 * 4 +
+					sizeof (ImpRecordHeader) + 28 + sizeof (ImpRecordHeader) + 5) == 1);
+			close(fd);
+			REQUIRE(reader.open(base + "_0000.imp") == 0);
+
+			THEN("It is skipped") {
+				REQUIRE(reader.read(1, h, got) == -1);
+				REQUIRE(reader.next(h, got) == 28);
+				REQUIRE(reader.next(h, got) == 28);
+				REQUIRE(reader.next(h, got) == 0);
+				REQUIRE(reader.damaged() == 1);
+			}
+		}
+
+		WHEN("An index entry was never written") {
+			for (int i = 0; i < 3; i++) {
+				frame[0] = i + 1;
+				REQUIRE(file.add(IMP_FRAME_PRIMARY, frame, 28) == 0);
+			}
+			file.close();
+			int fd = open((base + "_0000.imp").c_str(), O_RDWR);
+			uint32_t none = 0;
+			REQUIRE(pwrite(fd, &none, sizeof (none), sizeof (ImpFileHeader) + 4) == 4);
+			close(fd);
+			REQUIRE(reader.open(base + "_0000.imp") == 0);
+
+			THEN("The records after it can still be read") {
+				REQUIRE(reader.frames() == 2);
+				REQUIRE(reader.next(h, got) == 28);
+				REQUIRE(got[0] == 1);
+				REQUIRE(reader.next(h, got) == 28);
+				REQUIRE(got[0] == 3);
+			}
+		}
+
+		reader.close();
+		file.close();
+		system((std::string("rm -rf ") + dir).c_str());
+	}
+}